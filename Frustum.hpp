@@ -0,0 +1,63 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_X86 1
+#include <emmintrin.h>
+#endif
+
+//The view frustum, as planes (nx, ny, nz, d) that have every visible point p on their positive side (dot(n, p) + d >= 0).
+// Stored a component at a time so that a box can be tested against four planes at once;
+// the six planes are padded to eight with a plane (0, 0, 0, 1) that everything is inside.
+//Scene::draw uses it to skip drawables that are out of view (check-frustum.cpp tests it against brute force).
+struct Frustum {
+	Frustum(glm::mat4 const &world_to_clip) {
+		//points with -w <= x,y,z <= w in clip space are visible, so the planes are clip's w row plus and minus its x, y, z rows:
+		for (uint32_t p = 0; p < 8; ++p) {
+			if (p < 6) {
+				uint32_t row = p / 2;
+				float sign = (p % 2 == 0 ? 1.0f : -1.0f);
+				nx[p] = world_to_clip[0][3] + sign * world_to_clip[0][row];
+				ny[p] = world_to_clip[1][3] + sign * world_to_clip[1][row];
+				nz[p] = world_to_clip[2][3] + sign * world_to_clip[2][row];
+				d[p] = world_to_clip[3][3] + sign * world_to_clip[3][row];
+			} else {
+				nx[p] = ny[p] = nz[p] = 0.0f;
+				d[p] = 1.0f;
+			}
+		}
+	}
+
+	alignas(16) float nx[8], ny[8], nz[8], d[8];
+
+	//is the box with (world-space) center and half-size 'extent' entirely on the outside of one of the planes?
+	// (n.b. boxes near the frustum's corners can be outside without being outside any single plane; those are drawn)
+	bool outside(glm::vec3 const &center, glm::vec3 const &extent) const {
+		#ifdef FRUSTUM_X86
+		__m128 const cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+		__m128 const ex = _mm_set1_ps(extent.x), ey = _mm_set1_ps(extent.y), ez = _mm_set1_ps(extent.z);
+		__m128 const abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		for (uint32_t p = 0; p < 8; p += 4) {
+			__m128 px = _mm_load_ps(nx + p), py = _mm_load_ps(ny + p), pz = _mm_load_ps(nz + p);
+			//signed distance (scaled by normal length) of the box corner farthest along each plane's normal:
+			__m128 dist = _mm_add_ps(_mm_load_ps(d + p), _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(px, cx), _mm_add_ps(_mm_mul_ps(py, cy), _mm_mul_ps(pz, cz))),
+				_mm_add_ps(_mm_mul_ps(_mm_and_ps(px, abs_mask), ex), _mm_add_ps(_mm_mul_ps(_mm_and_ps(py, abs_mask), ey), _mm_mul_ps(_mm_and_ps(pz, abs_mask), ez)))
+			));
+			if (_mm_movemask_ps(_mm_cmplt_ps(dist, _mm_setzero_ps()))) return true;
+		}
+		return false;
+		#else
+		for (uint32_t p = 0; p < 6; ++p) {
+			float dist = d[p] + (nx[p] * center.x + ny[p] * center.y + nz[p] * center.z)
+				+ (std::abs(nx[p]) * extent.x + std::abs(ny[p]) * extent.y + std::abs(nz[p]) * extent.z);
+			if (dist < 0.0f) return true;
+		}
+		return false;
+		#endif
+	}
+};
@@ -5,15 +5,31 @@
 
 Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
 
+//(n.b. defined before lit_color_texture_program, so it is loaded first and can go in the pipeline template)
+Load< LitColorTextureProgram > lit_color_texture_instanced_program(LoadTagEarly, []() -> LitColorTextureProgram const * {
+	return new LitColorTextureProgram(LitColorTextureProgram::Instanced);
+});
+
 Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> LitColorTextureProgram const * {
 	LitColorTextureProgram *ret = new LitColorTextureProgram();
 
 	//----- build the pipeline template -----
 	lit_color_texture_program_pipeline.program = ret->program;
 
-	lit_color_texture_program_pipeline.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
-	lit_color_texture_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
-	lit_color_texture_program_pipeline.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
+	//matrices come from the texture buffer Scene::draw binds to its reserved unit:
+	lit_color_texture_program_pipeline.objects.buffer = ret->objects_buffer;
+	lit_color_texture_program_pipeline.objects.texture = ret->objects_texture;
+	lit_color_texture_program_pipeline.objects.OBJECT_INDEX_int = ret->OBJECT_INDEX_int;
+	lit_color_texture_program_pipeline.objects.WORLD_TO_CLIP_mat4 = ret->WORLD_TO_CLIP_mat4;
+	lit_color_texture_program_pipeline.objects.WORLD_TO_LIGHT_mat4x3 = ret->WORLD_TO_LIGHT_mat4x3;
+	lit_color_texture_program_pipeline.objects.NORMAL_WORLD_TO_LIGHT_mat3 = ret->NORMAL_WORLD_TO_LIGHT_mat3;
+
+	//the instanced variant (each drawable's pipeline still needs an instanced.vao before it is used):
+	lit_color_texture_program_pipeline.instanced.program = lit_color_texture_instanced_program->program;
+	lit_color_texture_program_pipeline.instanced.buffer = lit_color_texture_instanced_program->instance_buffer;
+	lit_color_texture_program_pipeline.instanced.WORLD_TO_CLIP_mat4 = lit_color_texture_instanced_program->WORLD_TO_CLIP_mat4;
+	lit_color_texture_program_pipeline.instanced.WORLD_TO_LIGHT_mat4x3 = lit_color_texture_instanced_program->WORLD_TO_LIGHT_mat4x3;
+	lit_color_texture_program_pipeline.instanced.NORMAL_WORLD_TO_LIGHT_mat3 = lit_color_texture_instanced_program->NORMAL_WORLD_TO_LIGHT_mat3;
 
 	/* This will be used later if/when we build a light loop into the Scene:
 	lit_color_texture_program_pipeline.LIGHT_TYPE_int = ret->LIGHT_TYPE_int;
@@ -43,14 +59,51 @@ Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> L
 	return ret;
 });
 
-LitColorTextureProgram::LitColorTextureProgram() {
+LitColorTextureProgram::LitColorTextureProgram(Variant variant) {
 	//Compile vertex and fragment shaders using the convenient 'gl_compile_program' helper function:
 	program = gl_compile_program(
 		//vertex shader:
+		(variant == Single ?
+		//(object-to-world and normal matrices are rows in OBJECTS -- six texels per object -- the rest of the transform is shared)
+		"#version 330\n"
+		"uniform samplerBuffer OBJECTS;\n"
+		"uniform int OBJECT_INDEX;\n"
+		"uniform mat4 WORLD_TO_CLIP;\n"
+		"uniform mat4x3 WORLD_TO_LIGHT;\n"
+		"uniform mat3 NORMAL_WORLD_TO_LIGHT;\n"
+		"in vec4 Position;\n"
+		"in vec3 Normal;\n"
+		"in vec4 Color;\n"
+		"in vec2 TexCoord;\n"
+		"out vec3 position;\n"
+		"out vec3 normal;\n"
+		"out vec4 color;\n"
+		"out vec2 texCoord;\n"
+		"void main() {\n"
+		"	int base = 6 * OBJECT_INDEX;\n"
+		"	vec4 world = vec4(\n"
+		"		dot(texelFetch(OBJECTS, base + 0), Position),\n"
+		"		dot(texelFetch(OBJECTS, base + 1), Position),\n"
+		"		dot(texelFetch(OBJECTS, base + 2), Position),\n"
+		"		Position.w);\n"
+		"	vec3 world_normal = vec3(\n"
+		"		dot(texelFetch(OBJECTS, base + 3).xyz, Normal),\n"
+		"		dot(texelFetch(OBJECTS, base + 4).xyz, Normal),\n"
+		"		dot(texelFetch(OBJECTS, base + 5).xyz, Normal));\n"
+		"	gl_Position = WORLD_TO_CLIP * world;\n"
+		"	position = WORLD_TO_LIGHT * world;\n"
+		"	normal = NORMAL_WORLD_TO_LIGHT * world_normal;\n"
+		"	color = Color;\n"
+		"	texCoord = TexCoord;\n"
+		"}\n"
+		:
+		//(instanced: object-to-world matrices come in per-instance, the rest of the transform is shared)
 		"#version 330\n"
-		"uniform mat4 OBJECT_TO_CLIP;\n"
-		"uniform mat4x3 OBJECT_TO_LIGHT;\n"
-		"uniform mat3 NORMAL_TO_LIGHT;\n"
+		"uniform mat4 WORLD_TO_CLIP;\n"
+		"uniform mat4x3 WORLD_TO_LIGHT;\n"
+		"uniform mat3 NORMAL_WORLD_TO_LIGHT;\n"
+		"in mat4x3 OBJECT_TO_WORLD;\n"
+		"in mat3 NORMAL_TO_WORLD;\n"
 		"in vec4 Position;\n"
 		"in vec3 Normal;\n"
 		"in vec4 Color;\n"
@@ -60,12 +113,14 @@ LitColorTextureProgram::LitColorTextureProgram() {
 		"out vec4 color;\n"
 		"out vec2 texCoord;\n"
 		"void main() {\n"
-		"	gl_Position = OBJECT_TO_CLIP * Position;\n"
-		"	position = OBJECT_TO_LIGHT * Position;\n"
-		"	normal = NORMAL_TO_LIGHT * Normal;\n"
+		"	vec4 world = vec4(OBJECT_TO_WORLD * Position, Position.w);\n"
+		"	gl_Position = WORLD_TO_CLIP * world;\n"
+		"	position = WORLD_TO_LIGHT * world;\n"
+		"	normal = NORMAL_WORLD_TO_LIGHT * (NORMAL_TO_WORLD * Normal);\n"
 		"	color = Color;\n"
 		"	texCoord = TexCoord;\n"
 		"}\n"
+		)
 	,
 		//fragment shader:
 		"#version 330\n"
@@ -114,11 +169,14 @@ LitColorTextureProgram::LitColorTextureProgram() {
 	Normal_vec3 = glGetAttribLocation(program, "Normal");
 	Color_vec4 = glGetAttribLocation(program, "Color");
 	TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
+	OBJECT_TO_WORLD_mat4x3 = glGetAttribLocation(program, "OBJECT_TO_WORLD");
+	NORMAL_TO_WORLD_mat3 = glGetAttribLocation(program, "NORMAL_TO_WORLD");
 
 	//look up the locations of uniforms:
-	OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
-	OBJECT_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "OBJECT_TO_LIGHT");
-	NORMAL_TO_LIGHT_mat3 = glGetUniformLocation(program, "NORMAL_TO_LIGHT");
+	OBJECT_INDEX_int = glGetUniformLocation(program, "OBJECT_INDEX");
+	WORLD_TO_CLIP_mat4 = glGetUniformLocation(program, "WORLD_TO_CLIP");
+	WORLD_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "WORLD_TO_LIGHT");
+	NORMAL_WORLD_TO_LIGHT_mat3 = glGetUniformLocation(program, "NORMAL_WORLD_TO_LIGHT");
 
 	LIGHT_TYPE_int = glGetUniformLocation(program, "LIGHT_TYPE");
 	LIGHT_LOCATION_vec3 = glGetUniformLocation(program, "LIGHT_LOCATION");
@@ -128,16 +186,51 @@ LitColorTextureProgram::LitColorTextureProgram() {
 
 
 	GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
+	GLuint OBJECTS_samplerBuffer = glGetUniformLocation(program, "OBJECTS");
 
 	//set TEX to always refer to texture binding zero:
 	glUseProgram(program); //bind program -- glUniform* calls refer to this program now
 
 	glUniform1i(TEX_sampler2D, 0); //set TEX to sample from GL_TEXTURE0
+	glUniform1i(OBJECTS_samplerBuffer, Scene::Drawable::Pipeline::ObjectsTextureUnit); //set OBJECTS to sample from the unit Scene::draw binds Pipeline::Objects::texture to
 
 	glUseProgram(0); //unbind program -- glUniform* calls refer to ??? now
+
+	if (variant == Single) {
+		//make the buffer drawables' matrices will be written into, and a texture to read it through:
+		// (binding the buffer once makes it exist, so the texture can refer to it before it has any data)
+		glGenBuffers(1, &objects_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, objects_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		glGenTextures(1, &objects_texture);
+		glBindTexture(GL_TEXTURE_BUFFER, objects_texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, objects_buffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+
+	if (variant == Instanced) {
+		//make the buffer per-instance data will be streamed into:
+		// (binding it once makes it exist, so vertex arrays can refer to it before it has any data)
+		glGenBuffers(1, &instance_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
 }
 
 LitColorTextureProgram::~LitColorTextureProgram() {
+	if (objects_texture != 0) {
+		glDeleteTextures(1, &objects_texture);
+		objects_texture = 0;
+	}
+	if (objects_buffer != 0) {
+		glDeleteBuffers(1, &objects_buffer);
+		objects_buffer = 0;
+	}
+	if (instance_buffer != 0) {
+		glDeleteBuffers(1, &instance_buffer);
+		instance_buffer = 0;
+	}
 	glDeleteProgram(program);
 	program = 0;
 }
@@ -5,8 +5,12 @@
 #include "Scene.hpp"
 
 //Shader program that draws transformed, lit, textured vertices tinted with vertex colors:
+// the 'Single' variant reads each drawable's matrices from a texture buffer written by Scene::draw (see Scene::Drawable::Pipeline::Objects).
 struct LitColorTextureProgram {
-	LitColorTextureProgram();
+	//The 'Instanced' variant draws many copies of a mesh in one call (see Scene::Drawable::Pipeline::Instanced):
+	// it reads each copy's matrices from per-instance attributes instead.
+	enum Variant { Single, Instanced };
+	LitColorTextureProgram(Variant variant = Single);
 	~LitColorTextureProgram();
 
 	GLuint program = 0;
@@ -17,10 +21,15 @@ struct LitColorTextureProgram {
 	GLuint Color_vec4 = -1U;
 	GLuint TexCoord_vec2 = -1U;
 
+	//(Instanced only) per-instance attribute locations, sourced from a MeshInstance:
+	GLuint OBJECT_TO_WORLD_mat4x3 = -1U;
+	GLuint NORMAL_TO_WORLD_mat3 = -1U;
+
 	//Uniform (per-invocation variable) locations:
-	GLuint OBJECT_TO_CLIP_mat4 = -1U;
-	GLuint OBJECT_TO_LIGHT_mat4x3 = -1U;
-	GLuint NORMAL_TO_LIGHT_mat3 = -1U;
+	GLuint OBJECT_INDEX_int = -1U; //(Single only) which of the matrices in OBJECTS to use
+	GLuint WORLD_TO_CLIP_mat4 = -1U;
+	GLuint WORLD_TO_LIGHT_mat4x3 = -1U;
+	GLuint NORMAL_WORLD_TO_LIGHT_mat3 = -1U;
 
 	//lighting:
 	GLuint LIGHT_TYPE_int = -1U;
@@ -31,10 +40,22 @@ struct LitColorTextureProgram {
 	
 	//Textures:
 	//TEXTURE0 - texture that is accessed by TexCoord
+	//TEXTURE4 - (Single only) OBJECTS, a texture buffer of Scene::ObjectMatrices (i.e., 'objects_texture'; the unit is Scene::Drawable::Pipeline::ObjectsTextureUnit)
+
+	//(Single only) array buffer that Scene::draw writes drawables' matrices into, and the GL_TEXTURE_BUFFER texture that reads it:
+	GLuint objects_buffer = 0;
+	GLuint objects_texture = 0;
+
+	//(Instanced only) array buffer that Scene::draw streams per-instance data into:
+	GLuint instance_buffer = 0;
 };
 
 extern Load< LitColorTextureProgram > lit_color_texture_program;
+//the Instanced variant (n.b. its LIGHT_* uniforms need to be set separately):
+extern Load< LitColorTextureProgram > lit_color_texture_instanced_program;
 
 //For convenient scene-graph setup, copy this object:
 // NOTE: by default, has texture bound to 1-pixel white texture -- so it's okay to use with vertex-color-only meshes.
+// NOTE: objects.buffer/texture hold the matrices the program reads; Scene::draw binds them itself, so textures[1..3] are free.
+// NOTE: instanced.program/buffer are filled in with the Instanced variant; set instanced.vao to allow instanced drawing.
 extern Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
@@ -117,9 +117,26 @@ if (maek.OS === 'windows') {
 const game_names = [
 	maek.CPP('PlayMode.cpp'),
 	maek.CPP('main.cpp'),
-	maek.CPP('LitColorTextureProgram.cpp'),
 	//maek.CPP('ColorTextureProgram.cpp'),  //not used right now, but you might want it
+];
+
+//(shader programs also used by bench-draw-calls)
+const lit_color_texture_program_names = [
+	maek.CPP('LitColorTextureProgram.cpp')
+];
+
+const show_scene_program_names = [
+	maek.CPP('ShowSceneProgram.cpp')
+];
+
+const sound_names = [
 	maek.CPP('Sound.cpp'),
+	maek.CPP('mix_kernels.cpp'),
+	maek.CPP('worker_pool.cpp'),
+	maek.CPP('adpcm.cpp'),
+	maek.CPP('fft.cpp'),
+	maek.CPP('sample_cache.cpp'),
+	maek.CPP('audio_convert.cpp'),
 	maek.CPP('load_wav.cpp'),
 	maek.CPP('load_opus.cpp')
 ];
@@ -147,7 +164,6 @@ const show_meshes_names = [
 
 const show_scene_names = [
 	maek.CPP('show-scene.cpp'),
-	maek.CPP('ShowSceneProgram.cpp'),
 	maek.CPP('ShowSceneMode.cpp')
 ];
 
@@ -155,9 +171,55 @@ const show_scene_names = [
 // objFiles: array of objects to link
 // exeFileBase: name of executable file to produce
 //returns exeFile: exeFileBase + a platform-dependant suffix (e.g., '.exe' on windows)
-const game_exe = maek.LINK([...game_names, ...common_names], 'dist/game');
+const bench_transforms_names = [
+	maek.CPP('bench-transforms.cpp')
+];
+
+const bench_draw_calls_names = [
+	maek.CPP('bench-draw-calls.cpp')
+];
+
+const check_frustum_names = [
+	maek.CPP('check-frustum.cpp')
+];
+
+const bench_sound_commands_names = [
+	maek.CPP('bench-sound-commands.cpp')
+];
+
+const bench_mix_kernels_names = [
+	maek.CPP('bench-mix-kernels.cpp')
+];
+
+const bench_sound_voices_names = [
+	maek.CPP('bench-sound-voices.cpp')
+];
+
+const bench_reverb_names = [
+	maek.CPP('bench-reverb.cpp')
+];
+
+const bench_capture_names = [
+	maek.CPP('bench-capture.cpp')
+];
+
+const game_exe = maek.LINK([...game_names, ...lit_color_texture_program_names, ...sound_names, ...common_names], 'dist/game');
 const show_meshes_exe = maek.LINK([...show_meshes_names, ...common_names], 'scenes/show-meshes');
-const show_scene_exe = maek.LINK([...show_scene_names, ...common_names], 'scenes/show-scene');
+const show_scene_exe = maek.LINK([...show_scene_names, ...show_scene_program_names, ...common_names], 'scenes/show-scene');
+const bench_transforms_exe = maek.LINK([...bench_transforms_names, ...common_names], 'scenes/bench-transforms');
+const bench_draw_calls_exe = maek.LINK([...bench_draw_calls_names, ...lit_color_texture_program_names, ...show_scene_program_names, ...common_names], 'scenes/bench-draw-calls');
+const check_frustum_exe = maek.LINK([...check_frustum_names, ...common_names], 'scenes/check-frustum');
+const bench_sound_commands_exe = maek.LINK([...bench_sound_commands_names, ...sound_names, ...common_names], 'scenes/bench-sound-commands');
+const bench_mix_kernels_exe = maek.LINK([...bench_mix_kernels_names, ...sound_names, ...common_names], 'scenes/bench-mix-kernels');
+const bench_sound_voices_exe = maek.LINK([...bench_sound_voices_names, ...sound_names, ...common_names], 'scenes/bench-sound-voices');
+const bench_reverb_exe = maek.LINK([...bench_reverb_names, ...sound_names, ...common_names], 'scenes/bench-reverb');
+const bench_capture_exe = maek.LINK([...bench_capture_names, ...sound_names, ...common_names], 'scenes/bench-capture');
+
+//benchmarks and checks aren't built by default; build them with 'node Maekfile.js :benches' (or by name):
+const benches_task = async () => { };
+benches_task.depends = [bench_transforms_exe, bench_draw_calls_exe, check_frustum_exe, bench_sound_commands_exe, bench_mix_kernels_exe, bench_sound_voices_exe, bench_reverb_exe, bench_capture_exe];
+benches_task.label = 'BENCHES';
+maek.tasks[':benches'] = benches_task;
 
 //set the default target to the game (and copy the readme files):
 maek.TARGETS = [game_exe, show_meshes_exe, show_scene_exe, ...copies];
@@ -106,7 +106,7 @@ const Mesh &MeshBuffer::lookup(std::string const &name) const {
 	return f->second;
 }
 
-GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
+GLuint MeshBuffer::make_vao_for_program(GLuint program, GLuint instance_buffer) const {
 	//create a new vertex array object:
 	GLuint vao = 0;
 	glGenVertexArrays(1, &vao);
@@ -127,6 +127,25 @@ GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
 	bind_attribute("Normal", Normal);
 	bind_attribute("Color", Color);
 	bind_attribute("TexCoord", TexCoord);
+
+	//Per-instance attributes (advanced once per instance rather than once per vertex) come from the instance buffer:
+	if (instance_buffer != 0) {
+		glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+		auto bind_instance_attribute = [&](char const *name, GLuint columns, size_t offset) {
+			GLint location = glGetAttribLocation(program, name);
+			if (location == -1) return; //can't bind missing attribs
+			//matrix attributes take one location per column:
+			for (GLuint c = 0; c < columns; ++c) {
+				glVertexAttribPointer(location + c, 3, GL_FLOAT, GL_FALSE, sizeof(MeshInstance), (GLbyte *)0 + offset + c * sizeof(glm::vec3));
+				glEnableVertexAttribArray(location + c);
+				glVertexAttribDivisor(location + c, 1);
+			}
+			bound.insert(location);
+		};
+		bind_instance_attribute("OBJECT_TO_WORLD", 4, offsetof(MeshInstance, object_to_world));
+		bind_instance_attribute("NORMAL_TO_WORLD", 3, offsetof(MeshInstance, normal_to_world));
+	}
+
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
 
@@ -29,6 +29,14 @@ struct Mesh {
 	glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
 };
 
+//Per-instance data for instanced drawing, one per copy of a mesh:
+// vertex arrays made with an instance buffer (see MeshBuffer::make_vao_for_program) read OBJECT_TO_WORLD and NORMAL_TO_WORLD from this layout.
+struct MeshInstance {
+	glm::mat4x3 object_to_world;
+	glm::mat3 normal_to_world;
+};
+static_assert(sizeof(MeshInstance) == 4*12 + 4*9, "MeshInstance is packed.");
+
 struct MeshBuffer {
 	//construct from a file:
 	// note: will throw if file fails to read.
@@ -39,8 +47,10 @@ struct MeshBuffer {
 	const Mesh &lookup(std::string const &name) const;
 	
 	//build a vertex array object that links this vbo to attributes to a program:
+	// if 'instance_buffer' is given, per-instance attributes (OBJECT_TO_WORLD, NORMAL_TO_WORLD) are read from it, laid out as MeshInstance
+	// (this is how to make the vao for an instanced program -- see Scene::Drawable::Pipeline::Instanced)
 	// note: will throw if program defines attributes not contained in this buffer
-	GLuint make_vao_for_program(GLuint program) const;
+	GLuint make_vao_for_program(GLuint program, GLuint instance_buffer = 0) const;
 
 	//This is the OpenGL vertex buffer object containing the mesh data:
 	GLuint buffer = 0;
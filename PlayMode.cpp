@@ -10,14 +10,19 @@
 
 #include <glm/gtc/type_ptr.hpp>
 
+#include <cstdio>
+#include <fstream>
+#include <iostream>
 #include <random>
 #include <thread>
 #include <ctime>
 
 GLuint hexapod_meshes_for_lit_color_texture_program = 0;
+GLuint hexapod_meshes_for_lit_color_texture_instanced_program = 0;
 Load< MeshBuffer > hexapod_meshes(LoadTagDefault, []() -> MeshBuffer const * {
 	MeshBuffer const *ret = new MeshBuffer(data_path("final.pnct"));
 	hexapod_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program);
+	hexapod_meshes_for_lit_color_texture_instanced_program = ret->make_vao_for_program(lit_color_texture_instanced_program->program, lit_color_texture_instanced_program->instance_buffer);
 	return ret;
 });
 
@@ -31,59 +36,62 @@ Load< Scene > hexapod_scene(LoadTagDefault, []() -> Scene const * {
 		drawable.pipeline = lit_color_texture_program_pipeline;
 
 		drawable.pipeline.vao = hexapod_meshes_for_lit_color_texture_program;
+		drawable.pipeline.instanced.vao = hexapod_meshes_for_lit_color_texture_instanced_program;
 		drawable.pipeline.type = mesh.type;
 		drawable.pipeline.start = mesh.start;
 		drawable.pipeline.count = mesh.count;
+		drawable.pipeline.min = mesh.min;
+		drawable.pipeline.max = mesh.max;
 
 	});
 });
 
-// noise samples
+// noise samples (short feedback sounds, so ADPCM's noise floor doesn't matter):
 Load< Sound::Sample > wrong_sample(LoadTagDefault, []() -> Sound::Sample const * {
-	return new Sound::Sample(data_path("wrongrealreal.wav"));
+	Sound::Sample *sample = new Sound::Sample(data_path("wrongrealreal.wav"), Sound::Sample::Format::ADPCM);
+	sample->bus = Sound::Bus::UI;
+	return sample;
 });
 
 Load< Sound::Sample > correct_sample(LoadTagDefault, []() -> Sound::Sample const * {
-	return new Sound::Sample(data_path("correctreal.wav"));
+	Sound::Sample *sample = new Sound::Sample(data_path("correctreal.wav"), Sound::Sample::Format::ADPCM);
+	sample->bus = Sound::Bus::UI;
+	return sample;
 });
 
-//player samples
-
-Load< Sound::Sample > high_c_sample(LoadTagDefault, []() -> Sound::Sample const * {
-	return new Sound::Sample(data_path("Ch.wav"));
-});
+//note samples -- every note is played by pitching up one of these low C samples:
+// (kept as 16-bit PCM; pitched-up ADPCM noise is more noticeable on sustained tones)
 
 Load< Sound::Sample > low_c_sample(LoadTagDefault, []() -> Sound::Sample const * {
-	return new Sound::Sample(data_path("C.wav"));
-});
-
-Load< Sound::Sample > mid_e_sample(LoadTagDefault, []() -> Sound::Sample const * {
-	return new Sound::Sample(data_path("E.wav"));
-});
-
-Load< Sound::Sample > mid_g_sample(LoadTagDefault, []() -> Sound::Sample const * {
-	return new Sound::Sample(data_path("G.wav"));
-});
-
-//choir samples
-
-Load< Sound::Sample > high_c_choir_sample(LoadTagDefault, []() -> Sound::Sample const * {
-	return new Sound::Sample(data_path("ChC.wav"));
+	return new Sound::Sample(data_path("C.wav"), Sound::Sample::Format::Int16);
 });
 
 Load< Sound::Sample > low_c_choir_sample(LoadTagDefault, []() -> Sound::Sample const * {
-	return new Sound::Sample(data_path("CC.wav"));
+	Sound::Sample *sample = new Sound::Sample(data_path("CC.wav"), Sound::Sample::Format::Int16);
+	sample->bus = Sound::Bus::Choir;
+	return sample;
 });
 
-Load< Sound::Sample > mid_e_choir_sample(LoadTagDefault, []() -> Sound::Sample const * {
-	return new Sound::Sample(data_path("EC.wav"));
-});
-
-Load< Sound::Sample > mid_g_choir_sample(LoadTagDefault, []() -> Sound::Sample const * {
-	return new Sound::Sample(data_path("GC.wav"));
-});
-
-
+//playback rates for each note (indexed like Note::note: low C, mid E, mid G, high C):
+static float const NoteRates[4] = {
+	1.0f,
+	std::pow(2.0f, 4.0f / 12.0f), //major third
+	std::pow(2.0f, 7.0f / 12.0f), //perfect fifth
+	2.0f, //octave
+};
+
+//impulse response for the choir's reverb -- a synthetic hall: noise fading out over 'seconds'
+// (seeded differently for each ear, so the reverb sounds wide):
+static std::vector< float > hall_impulse_response(float seconds, uint32_t seed) {
+	std::mt19937 mt(seed);
+	std::uniform_real_distribution< float > noise(-1.0f, 1.0f);
+	std::vector< float > response(size_t(seconds * Sound::AudioRate));
+	for (size_t i = 0; i < response.size(); ++i) {
+		float t = float(i) / float(Sound::AudioRate);
+		response[i] = 0.02f * noise(mt) * std::exp(-6.9f * t / seconds); //(-60dB by the end)
+	}
+	return response;
+}
 
 PlayMode::PlayMode() : scene(*hexapod_scene) {
 	//get pointers to objects for convenience:
@@ -104,20 +112,35 @@ PlayMode::PlayMode() : scene(*hexapod_scene) {
 
 
 	low_c = Sound::loop(*low_c_sample, 1.0f);
-	low_c.get()->stop();
+	low_c.stop();
 
-	high_c = Sound::loop(*high_c_sample, 1.0f);
-	high_c.get()->stop();
+	high_c = Sound::loop(*low_c_sample, 1.0f);
+	high_c.set_rate(NoteRates[3], 0.0f);
+	high_c.stop();
 
-	mid_e = Sound::loop(*mid_e_sample, 1.0f);
-	mid_e.get()->stop();
+	mid_e = Sound::loop(*low_c_sample, 1.0f);
+	mid_e.set_rate(NoteRates[1], 0.0f);
+	mid_e.stop();
 
-	mid_g = Sound::loop(*mid_g_sample, 1.0f);
-	mid_g.get()->stop();
+	mid_g = Sound::loop(*low_c_sample, 1.0f);
+	mid_g.set_rate(NoteRates[2], 0.0f);
+	mid_g.stop();
 
+	//the choir sits a little behind the player's notes, and the compressor keeps overlapping notes from clipping:
+	Sound::add_effect(Sound::Bus::Choir, &choir_filter);
+	Sound::add_effect(Sound::Bus::Master, &master_compressor);
+
+	//...and sings in a hall:
+	choir_reverb.reset(new Sound::ConvolutionReverb(hall_impulse_response(1.8f, 1), hall_impulse_response(1.8f, 2), 0.35f, 1.0f));
+	Sound::add_effect(Sound::Bus::Choir, choir_reverb.get());
 }
 
 PlayMode::~PlayMode() {
+	Sound::remove_effect(Sound::Bus::Choir, choir_reverb.get());
+	Sound::remove_effect(Sound::Bus::Choir, &choir_filter);
+	Sound::remove_effect(Sound::Bus::Master, &master_compressor);
+	Sound::set_bus_volume(Sound::Bus::Choir, 1.0f, 0.0f);
+	if (capturing_audio) Sound::stop_capture();
 }
 
 bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size) {
@@ -146,6 +169,25 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 			space.downs += 1;
 			space.pressed = true;
 			return true;
+		} else if (evt.key.keysym.sym == SDLK_F2) {
+			show_audio_stats = !show_audio_stats;
+			return true;
+		} else if (evt.key.keysym.sym == SDLK_F3) {
+			//dump the last few seconds of mixer stats:
+			std::string filename = data_path("audio-stats.csv");
+			std::ofstream csv(filename);
+			Sound::write_stats_csv(csv);
+			std::cout << "Wrote audio stats to '" << filename << "'." << std::endl;
+			return true;
+		} else if (evt.key.keysym.sym == SDLK_F4) {
+			//start/stop recording exactly what is being played (e.g., to attach to a bug report):
+			if (capturing_audio) {
+				Sound::stop_capture();
+				capturing_audio = false;
+			} else {
+				capturing_audio = Sound::start_capture(data_path("capture.wav"));
+			}
+			return true;
 		}
 	} else if (evt.type == SDL_KEYUP) {
 		if (evt.key.keysym.sym == SDLK_a) {
@@ -188,11 +230,12 @@ void PlayMode::update(float elapsed) {
 				glm::radians(5.0f * std::sin(wobble * 2.0f * float(M_PI))),
 				glm::vec3(0.0f, 1.0f, 0.0f)
 			);
-			low_c.get()->stop();
-			mid_g.get()->stop();
-			high_c.get()->stop();
+			low_c.stop();
+			mid_g.stop();
+			high_c.stop();
 			// move.x =-1.0f;
-			mid_e = Sound::play(*mid_e_sample, 1.0f);
+			mid_e = Sound::play(*low_c_sample, 1.0f);
+			mid_e.set_rate(NoteRates[1], 0.0f);
 			player_note = 1;
 			//CHECK CORRECT NOTE
 			size_t note_count = 0;
@@ -218,11 +261,12 @@ void PlayMode::update(float elapsed) {
 				glm::radians(5.0f * std::sin(wobble * 2.0f * float(M_PI))),
 				glm::vec3(0.0f, 1.0f, 0.0f)
 			);
-			low_c.get()->stop();
-			mid_e.get()->stop();
-			high_c.get()->stop();
+			low_c.stop();
+			mid_e.stop();
+			high_c.stop();
 			// move.x = 1.0f;
-			mid_g = Sound::play(*mid_g_sample, 1.0f);
+			mid_g = Sound::play(*low_c_sample, 1.0f);
+			mid_g.set_rate(NoteRates[2], 0.0f);
 			player_note = 2;
 			//CHECK CORRECT NOTE
 			size_t note_count = 0;
@@ -249,9 +293,9 @@ void PlayMode::update(float elapsed) {
 				glm::radians(5.0f * std::sin(wobble * 2.0f * float(M_PI))),
 				glm::vec3(0.0f, 1.0f, 0.0f)
 			);
-			mid_g.get()->stop();
-			mid_e.get()->stop();
-			high_c.get()->stop();
+			mid_g.stop();
+			mid_e.stop();
+			high_c.stop();
 			// move.y =-1.0f;
 			low_c = Sound::play(*low_c_sample, 1.0f);
 			player_note = 0;
@@ -282,11 +326,12 @@ void PlayMode::update(float elapsed) {
 				glm::radians(5.0f * std::sin(wobble * 2.0f * float(M_PI))),
 				glm::vec3(0.0f, 1.0f, 0.0f)
 			);
-			low_c.get()->stop();
-			mid_e.get()->stop();
-			mid_g.get()->stop();
+			low_c.stop();
+			mid_e.stop();
+			mid_g.stop();
 			// move.y = 1.0f;
-			high_c = Sound::play(*high_c_sample, 1.0f);
+			high_c = Sound::play(*low_c_sample, 1.0f);
+			high_c.set_rate(NoteRates[3], 0.0f);
 			player_note = 3;
 			//CHECK CORRECT NOTE
 			size_t note_count = 0;
@@ -308,6 +353,15 @@ void PlayMode::update(float elapsed) {
 				note_count++;
 			}
 		}
+		//duck the choir under the player's note:
+		if (player_note != 4) {
+			Sound::set_bus_volume(Sound::Bus::Choir, ChoirDuckVolume, 0.05f);
+			choir_duck = ChoirDuckTime;
+		} else if (choir_duck > 0.0f) {
+			choir_duck -= elapsed;
+			if (choir_duck <= 0.0f) Sound::set_bus_volume(Sound::Bus::Choir, 1.0f, 0.5f);
+		}
+
 		if (space.downs==1){
 			for (uint32_t x = 0; x < 4; ++x) {
 				song[x].done = false;
@@ -343,29 +397,54 @@ void PlayMode::update(float elapsed) {
 		}
 		
 
-		//if playing the song:
-		if(playing){
-			//wobble carrot singing the song
+		//wobble carrot singing the song, as much as its notes are actually sounding:
+		{
+			float choir_rms = 0.0f;
+			for (Sound::PlayingSample const *note : {&low_c_c, &mid_e_c, &mid_g_c, &high_c_c}) {
+				choir_rms = std::max(choir_rms, note->level().rms);
+			}
+			//(-50dB .. -15dB maps to [0,1]; rises quickly and falls slowly, like a level meter)
+			float target = glm::clamp((20.0f * std::log10(std::max(choir_rms, 1.0e-5f)) + 50.0f) / 35.0f, 0.0f, 1.0f);
+			float speed = (target > carrot_singing ? 20.0f : 4.0f);
+			carrot_singing += (target - carrot_singing) * (1.0f - std::exp(-speed * elapsed));
 			carrot->rotation = carrot_base_rotation * glm::angleAxis(
-			glm::radians(5.0f * std::sin(wobble * 2.0f * float(M_PI))),
+			glm::radians(8.0f * carrot_singing * std::sin(wobble * 2.0f * float(M_PI))),
 			glm::vec3(0.0f, 1.0f, 0.0f)
 			);
-			//update note_elapsed
-			note_elapsed+=elapsed;
-			if(note_elapsed>1.5f){
+		}
+
+		//if playing the song:
+		if(playing){
+			//schedule the carrot's notes on the audio clock, a little ahead of time, so they start exactly 1.5s apart:
+			// (rather than on whichever mix block happens to follow the frame where a timer ran out)
+			constexpr uint64_t NoteFrames = Sound::AudioRate * 3 / 2;
+			constexpr uint64_t LookaheadFrames = Sound::AudioRate / 10;
+			Sound::Clock clock = Sound::now();
+			if(next_note_frame == 0){
+				next_note_frame = clock.frame + NoteFrames;
+			}
+			if(next_note_frame < clock.frame + LookaheadFrames){
 				bool note_played = false;
 				for ( size_t i = 0; i < 4; i++){
 					if(!note_played){
 						if(!song[i].done){
 							uint8_t current_note = song[i].note;
+							//(choir notes get a higher priority so the carrot's song is never dropped in favor of player notes)
 							if(current_note == 0){
-								low_c_c = Sound::play(*low_c_choir_sample, 1.0f);
+								low_c_c = Sound::play_at(*low_c_choir_sample, next_note_frame, 1.0f);
+								low_c_c.set_priority(1.0f);
 							} else if(current_note ==1){
-								mid_e_c = Sound::play(*mid_e_choir_sample, 1.0f);
+								mid_e_c = Sound::play_at(*low_c_choir_sample, next_note_frame, 1.0f);
+								mid_e_c.set_rate(NoteRates[1], 0.0f);
+								mid_e_c.set_priority(1.0f);
 							} else if(current_note==2){
-								mid_g_c = Sound::play(*mid_g_choir_sample, 1.0f);
+								mid_g_c = Sound::play_at(*low_c_choir_sample, next_note_frame, 1.0f);
+								mid_g_c.set_rate(NoteRates[2], 0.0f);
+								mid_g_c.set_priority(1.0f);
 							}else{
-								high_c_c = Sound::play(*high_c_choir_sample, 1.0f);
+								high_c_c = Sound::play_at(*low_c_choir_sample, next_note_frame, 1.0f);
+								high_c_c.set_rate(NoteRates[3], 0.0f);
+								high_c_c.set_priority(1.0f);
 							}
 							song[i].done = true;
 							note_played = true;
@@ -376,8 +455,10 @@ void PlayMode::update(float elapsed) {
 				if(!note_played){
 					//song done playing
 					playing = false;
+					next_note_frame = 0; //next song starts 1.5s after it is requested
+				} else {
+					next_note_frame += NoteFrames;
 				}
-				note_elapsed=0; //reset for next note, wait 4 seconds
 			}
 		}
 
@@ -408,12 +489,14 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 	//update camera aspect ratio for drawable:
 	camera->aspect = float(drawable_size.x) / float(drawable_size.y);
 
-	//set up light type and position for lit_color_texture_program:
+	//set up light type and position for lit_color_texture_program (and its instanced variant):
 	// TODO: consider using the Light(s) in the scene to do this
-	glUseProgram(lit_color_texture_program->program);
-	glUniform1i(lit_color_texture_program->LIGHT_TYPE_int, 1);
-	glUniform3fv(lit_color_texture_program->LIGHT_DIRECTION_vec3, 1, glm::value_ptr(glm::vec3(0.0f, 0.0f,-1.0f)));
-	glUniform3fv(lit_color_texture_program->LIGHT_ENERGY_vec3, 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 0.95f)));
+	for (LitColorTextureProgram const *program : {&*lit_color_texture_program, &*lit_color_texture_instanced_program}) {
+		glUseProgram(program->program);
+		glUniform1i(program->LIGHT_TYPE_int, 1);
+		glUniform3fv(program->LIGHT_DIRECTION_vec3, 1, glm::value_ptr(glm::vec3(0.0f, 0.0f,-1.0f)));
+		glUniform3fv(program->LIGHT_ENERGY_vec3, 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 0.95f)));
+	}
 	glUseProgram(0);
 
 	glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
@@ -423,7 +506,7 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 	glEnable(GL_DEPTH_TEST);
 	glDepthFunc(GL_LESS); //this is the default depth comparison function, but FYI you can change it.
 
-	scene.draw(*camera);
+	Scene::DrawStats draw_stats = scene.draw(*camera);
 
 	{ //use DrawLines to overlay some text:
 		glDisable(GL_DEPTH_TEST);
@@ -448,6 +531,36 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 			glm::vec3(H, 0.0f, 0.0f), glm::vec3(0.0f, H, 0.0f),
 			glm::u8vec4(0xf0, 0x0a, 0x75, 0x00));
 
+		if (show_audio_stats) {
+			//summarize the last ~second of mixer stats:
+			Sound::Stats stats = Sound::stats();
+			std::vector< Sound::BlockStats > recent(Sound::AudioRate / Sound::block_size());
+			recent.resize(Sound::stats_history(recent.data(), uint32_t(recent.size())));
+			float load = 0.0f, peak = 0.0f;
+			for (auto const &block : recent) {
+				load = std::max(load, block.load);
+				peak = std::max(peak, block.peak);
+			}
+			char buffer[4][128];
+			std::snprintf(buffer[0], sizeof(buffer[0]), "audio load %.1f%% (max %.1f%%)", 100.0f * load, 100.0f * stats.max_load);
+			Sound::Level level = Sound::master_level();
+			std::snprintf(buffer[1], sizeof(buffer[1]), "voices %u (%u real) peak %.1fdB rms %.1fdB",
+				stats.last.active_voices, stats.last.real_voices, 20.0f * std::log10(std::max(peak, 1.0e-5f)),
+				20.0f * std::log10(std::max(level.rms, 1.0e-5f)));
+			std::snprintf(buffer[2], sizeof(buffer[2]), "overruns %llu late %llu clipped %llu%s",
+				(unsigned long long)stats.overruns, (unsigned long long)stats.late_blocks, (unsigned long long)stats.clipped_blocks,
+				(capturing_audio ? " [capturing]" : ""));
+			std::snprintf(buffer[3], sizeof(buffer[3]), "drawables %u drawn %u culled, %u draws %u GL calls", draw_stats.drawn, draw_stats.culled, draw_stats.draw_calls, draw_stats.gl_calls);
+
+			constexpr float S = 0.06f;
+			for (uint32_t i = 0; i < 4; ++i) {
+				lines.draw_text(buffer[i],
+					glm::vec3(-aspect + 0.5f * S, 1.0f - (1.5f * i + 1.5f) * S, 0.0),
+					glm::vec3(S, 0.0f, 0.0f), glm::vec3(0.0f, S, 0.0f),
+					glm::u8vec4(0xff, 0xff, 0xff, 0x00));
+			}
+		}
+
 		
 	}
 	GL_ERRORS();
@@ -7,6 +7,7 @@
 
 #include <vector>
 #include <deque>
+#include <memory>
 
 struct PlayMode : Mode {
 	PlayMode();
@@ -43,27 +44,43 @@ struct PlayMode : Mode {
 	glm::quat bunny_base_rotation;
 	glm::quat carrot_base_rotation;
 	float wobble = 0.0f;
+	float carrot_singing = 0.0f; //how loudly the carrot's notes are playing, in [0,1] (smoothed; drives its wobble)
 	uint8_t score = 0;
 
 	glm::vec3 get_leg_tip_position();
 
 	//music coming from the tip of the leg (as a demonstration):
-	std::shared_ptr< Sound::PlayingSample > low_c;
-	std::shared_ptr< Sound::PlayingSample > high_c;
-	std::shared_ptr< Sound::PlayingSample > mid_e;
-	std::shared_ptr< Sound::PlayingSample > mid_g;
-	std::shared_ptr< Sound::PlayingSample > low_c_c;
-	std::shared_ptr< Sound::PlayingSample > high_c_c;
-	std::shared_ptr< Sound::PlayingSample > mid_e_c;
-	std::shared_ptr< Sound::PlayingSample > mid_g_c;
-	std::shared_ptr< Sound::PlayingSample > wrong;
-	std::shared_ptr< Sound::PlayingSample > correct;
+	Sound::PlayingSample low_c;
+	Sound::PlayingSample high_c;
+	Sound::PlayingSample mid_e;
+	Sound::PlayingSample mid_g;
+	Sound::PlayingSample low_c_c;
+	Sound::PlayingSample high_c_c;
+	Sound::PlayingSample mid_e_c;
+	Sound::PlayingSample mid_g_c;
+	Sound::PlayingSample wrong;
+	Sound::PlayingSample correct;
+
+	//effects on the choir and master buses:
+	Sound::Biquad choir_filter = Sound::Biquad(Sound::Biquad::LowPass, 4000.0f);
+	Sound::Compressor master_compressor = Sound::Compressor(-6.0f, 4.0f);
+	std::unique_ptr< Sound::ConvolutionReverb > choir_reverb;
+
+	//the choir bus is turned down while the player plays a note, and comes back up 'choir_duck' seconds later:
+	static constexpr float ChoirDuckVolume = 0.35f;
+	static constexpr float ChoirDuckTime = 0.6f;
+	float choir_duck = 0.0f;
+
+	//show mixer (and drawing) stats overlay? (toggled with F2; F3 dumps the mixer stats as CSV)
+	bool show_audio_stats = false;
+	//recording the mix to a WAV file? (toggled with F4)
+	bool capturing_audio = false;
 
 
 
 	bool playing = true;
 	bool completed = false;
-	float note_elapsed = 0.0f;
+	uint64_t next_note_frame = 0; //audio frame the carrot sings its next note on (0 == not scheduled yet)
 	
 	//camera:
 	Scene::Camera *camera = nullptr;
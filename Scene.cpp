@@ -1,14 +1,127 @@
 #include "Scene.hpp"
 
+#include "Frustum.hpp"
 #include "gl_errors.hpp"
 #include "read_write_chunk.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <cassert>
+#include <cstring>
 #include <fstream>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SCENE_X86 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+//Every transform's values, along with its cached world matrices, are kept in a slot of these arrays.
+// Slots are grouped in fixed-size blocks, which never move once made (so a Transform can refer to its values directly):
+constexpr uint32_t TransformBlockSize = 1024;
+struct TransformBlock {
+	//values (what Transform::position, rotation, scale, and parent refer to):
+	glm::vec3 position[TransformBlockSize];
+	glm::quat rotation[TransformBlockSize];
+	glm::vec3 scale[TransformBlockSize];
+	Scene::Transform *parent[TransformBlockSize];
+
+	//the values local_to_world was last computed from (so that Scene::update_world_matrices can notice changes):
+	glm::vec3 seen_position[TransformBlockSize];
+	glm::quat seen_rotation[TransformBlockSize];
+	glm::vec3 seen_scale[TransformBlockSize];
+	Scene::Transform *seen_parent[TransformBlockSize];
+
+	//world matrices:
+	uint64_t version[TransformBlockSize]; //changes whenever local_to_world is recomputed (unique across transforms; 0 == not computed by a scene)
+	uint64_t parent_version[TransformBlockSize]; //parent's 'version' when local_to_world was computed (0 if no parent)
+	glm::mat4x3 local_to_world[TransformBlockSize];
+	uint64_t world_to_local_version[TransformBlockSize]; //'version' that world_to_local was made for (it's made on demand)
+	glm::mat4x3 world_to_local[TransformBlockSize];
+};
+
+struct TransformStorage {
+	std::vector< std::unique_ptr< TransformBlock > > blocks;
+	std::vector< uint32_t > released; //slots that can be handed out again
+	uint32_t used = 0; //slots [0,used) have been handed out at some point
+	uint64_t layout = 1; //changes whenever a slot is handed out or released (so scenes know to re-sort)
+	uint64_t next_version = 1;
+
+	TransformBlock &block(uint32_t slot) {
+		return *blocks[slot / TransformBlockSize];
+	}
+
+	uint32_t allocate() {
+		uint32_t slot;
+		if (!released.empty()) {
+			slot = released.back();
+			released.pop_back();
+		} else {
+			if (used % TransformBlockSize == 0) blocks.emplace_back(new TransformBlock);
+			slot = used++;
+		}
+		TransformBlock &b = block(slot);
+		uint32_t k = slot % TransformBlockSize;
+		b.position[k] = b.seen_position[k] = glm::vec3(0.0f, 0.0f, 0.0f);
+		b.rotation[k] = b.seen_rotation[k] = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+		b.scale[k] = b.seen_scale[k] = glm::vec3(1.0f, 1.0f, 1.0f);
+		b.parent[k] = b.seen_parent[k] = nullptr;
+		b.version[k] = 0;
+		b.parent_version[k] = 0;
+		b.world_to_local_version[k] = 0;
+		++layout;
+		return slot;
+	}
+
+	void release(uint32_t slot) {
+		block(slot).version[slot % TransformBlockSize] = 0;
+		released.emplace_back(slot);
+		++layout;
+	}
+};
+
+TransformStorage &transform_storage() {
+	//(never destroyed, since transforms in static objects may be destroyed after it otherwise)
+	static TransformStorage *storage = new TransformStorage;
+	return *storage;
+}
+
+//is the cached local_to_world of 'transform' still right?
+// (it is if neither the transform nor any of its ancestors has changed -- or been recomputed -- since it was computed)
+bool cached_world_valid(Scene::Transform const &transform) {
+	TransformStorage &storage = transform_storage();
+	for (Scene::Transform const *at = &transform; at; at = at->parent) {
+		TransformBlock const &b = storage.block(at->slot);
+		uint32_t k = at->slot % TransformBlockSize;
+		if (b.version[k] == 0) return false;
+		if (b.parent[k] != b.seen_parent[k]
+		 || b.position[k] != b.seen_position[k] || b.rotation[k] != b.seen_rotation[k] || b.scale[k] != b.seen_scale[k]) return false;
+		if (at->parent && storage.block(at->parent->slot).version[at->parent->slot % TransformBlockSize] != b.parent_version[k]) return false;
+	}
+	return true;
+}
+
+}
+
 //-------------------------
 
+Scene::Transform::Transform() : Transform(transform_storage().allocate()) {
+}
+
+Scene::Transform::Transform(uint32_t slot_) :
+	position(transform_storage().block(slot_).position[slot_ % TransformBlockSize]),
+	rotation(transform_storage().block(slot_).rotation[slot_ % TransformBlockSize]),
+	scale(transform_storage().block(slot_).scale[slot_ % TransformBlockSize]),
+	parent(transform_storage().block(slot_).parent[slot_ % TransformBlockSize]),
+	slot(slot_) {
+}
+
+Scene::Transform::~Transform() {
+	transform_storage().release(slot);
+}
+
 glm::mat4x3 Scene::Transform::make_local_to_parent() const {
 	//compute:
 	//   translate   *   rotate    *   scale
@@ -57,6 +170,10 @@ glm::mat4x3 Scene::Transform::make_parent_to_local() const {
 }
 
 glm::mat4x3 Scene::Transform::make_local_to_world() const {
+	TransformBlock &b = transform_storage().block(slot);
+	uint32_t k = slot % TransformBlockSize;
+	if (cached_world_valid(*this)) return b.local_to_world[k];
+	//not kept up to date by a scene (or changed since), so work it out from the parent chain:
 	if (!parent) {
 		return make_local_to_parent();
 	} else {
@@ -64,10 +181,318 @@ glm::mat4x3 Scene::Transform::make_local_to_world() const {
 	}
 }
 glm::mat4x3 Scene::Transform::make_world_to_local() const {
-	if (!parent) {
-		return make_parent_to_local();
-	} else {
-		return make_parent_to_local() * glm::mat4(parent->make_world_to_local()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+	TransformBlock &b = transform_storage().block(slot);
+	uint32_t k = slot % TransformBlockSize;
+	if (!cached_world_valid(*this)) {
+		//not kept up to date by a scene (or changed since), so work it out from the parent chain:
+		if (!parent) {
+			return make_parent_to_local();
+		} else {
+			return make_parent_to_local() * glm::mat4(parent->make_world_to_local()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+		}
+	}
+	if (b.world_to_local_version[k] != b.version[k]) {
+		//invert the cached local_to_world (so that the two always agree):
+		// the inverse of its upper 3x3 has the cross products of its columns, over the determinant, as rows
+		glm::mat4x3 const &m = b.local_to_world[k];
+		glm::vec3 r0 = glm::cross(m[1], m[2]);
+		glm::vec3 r1 = glm::cross(m[2], m[0]);
+		glm::vec3 r2 = glm::cross(m[0], m[1]);
+		float det = glm::dot(m[0], r0);
+		//taking some care so that we don't end up with NaN's, just a degenerate matrix, if scale is zero:
+		float inv_det = (det == 0.0f ? 0.0f : 1.0f / det);
+		glm::mat3 inv(
+			glm::vec3(r0.x, r1.x, r2.x) * inv_det,
+			glm::vec3(r0.y, r1.y, r2.y) * inv_det,
+			glm::vec3(r0.z, r1.z, r2.z) * inv_det
+		);
+		b.world_to_local[k] = glm::mat4x3(inv[0], inv[1], inv[2], inv * -m[3]);
+		b.world_to_local_version[k] = b.version[k];
+	}
+	return b.world_to_local[k];
+}
+
+//-------------------------
+
+namespace {
+
+//(re-)build the sorted order of transform_arrays, and fill the arrays with the values and matrices last computed (from storage):
+void sort_transforms(std::list< Scene::Transform > const &transforms, Scene::TransformArrays *arrays_) {
+	assert(arrays_);
+	auto &arrays = *arrays_;
+	TransformStorage &storage = transform_storage();
+
+	std::vector< Scene::Transform const * > listed;
+	std::unordered_map< Scene::Transform const *, uint32_t > listed_index;
+	listed.reserve(transforms.size());
+	for (auto const &t : transforms) {
+		listed_index.emplace(&t, uint32_t(listed.size()));
+		listed.emplace_back(&t);
+	}
+	uint32_t count = uint32_t(listed.size());
+
+	//depth of each transform, following parents until reaching one with known depth:
+	// (transforms whose parent isn't in the list count as roots -- update_world_matrices handles them specially)
+	std::vector< uint32_t > depth(count, -1U);
+	std::vector< uint32_t > path;
+	for (uint32_t i = 0; i < count; ++i) {
+		uint32_t at = i;
+		while (depth[at] == -1U) {
+			path.emplace_back(at);
+			auto f = (listed[at]->parent ? listed_index.find(listed[at]->parent) : listed_index.end());
+			if (f == listed_index.end()) {
+				depth[at] = 0;
+				path.pop_back();
+				break;
+			}
+			at = f->second;
+		}
+		uint32_t d = depth[at];
+		while (!path.empty()) {
+			depth[path.back()] = ++d;
+			path.pop_back();
+		}
+	}
+
+	//counting sort by depth:
+	arrays.depth_begin.assign(1, 0);
+	for (uint32_t i = 0; i < count; ++i) {
+		if (depth[i] + 2 > arrays.depth_begin.size()) arrays.depth_begin.resize(depth[i] + 2, 0);
+		arrays.depth_begin[depth[i] + 1] += 1;
+	}
+	for (uint32_t d = 1; d < arrays.depth_begin.size(); ++d) {
+		arrays.depth_begin[d] += arrays.depth_begin[d - 1];
+	}
+	std::vector< uint32_t > next(arrays.depth_begin.begin(), arrays.depth_begin.end() - 1);
+	std::vector< uint32_t > sorted_index(count); //index in 'slots' of each listed transform
+	arrays.slots.assign(count, 0);
+	for (uint32_t i = 0; i < count; ++i) {
+		uint32_t s = next[depth[i]]++;
+		arrays.slots[s] = listed[i]->slot;
+		sorted_index[i] = s;
+	}
+
+	arrays.parent.assign(count, nullptr);
+	arrays.parent_index.assign(count, -1U);
+	for (uint32_t i = 0; i < count; ++i) {
+		uint32_t s = sorted_index[i];
+		arrays.parent[s] = listed[i]->parent;
+		auto f = listed_index.find(arrays.parent[s]);
+		if (f != listed_index.end()) arrays.parent_index[s] = sorted_index[f->second];
+	}
+
+	arrays.scan.resize(count);
+	for (uint32_t s = 0; s < count; ++s) {
+		arrays.scan[s] = std::make_pair(arrays.slots[s], s);
+	}
+	std::sort(arrays.scan.begin(), arrays.scan.end());
+
+	//values and matrices as of the last computation (update_world_matrices copies in and redoes whatever has changed since):
+	for (auto &v : arrays.position) v.resize(count);
+	for (auto &v : arrays.rotation) v.resize(count);
+	for (auto &v : arrays.scale) v.resize(count);
+	for (auto &v : arrays.local_to_world) v.resize(count);
+	for (uint32_t s = 0; s < count; ++s) {
+		TransformBlock const &b = storage.block(arrays.slots[s]);
+		uint32_t k = arrays.slots[s] % TransformBlockSize;
+		for (uint32_t c = 0; c < 3; ++c) {
+			arrays.position[c][s] = b.seen_position[k][c];
+			arrays.scale[c][s] = b.seen_scale[k][c];
+		}
+		arrays.rotation[0][s] = b.seen_rotation[k].w;
+		arrays.rotation[1][s] = b.seen_rotation[k].x;
+		arrays.rotation[2][s] = b.seen_rotation[k].y;
+		arrays.rotation[3][s] = b.seen_rotation[k].z;
+		if (b.version[k] == 0) continue; //(will be recomputed)
+		for (uint32_t c = 0; c < 12; ++c) arrays.local_to_world[c][s] = b.local_to_world[k][c / 3][c % 3];
+	}
+	arrays.dirty.assign(count, 0);
+
+	arrays.layout = storage.layout;
+}
+
+//world matrices for sorted transforms [begin,end), which all have the same depth (so their parents' are already done):
+// 'roots' says if they are depth-zero transforms (whose world matrix is just their local-to-parent matrix)
+void compute_world_scalar(Scene::TransformArrays &arrays, uint32_t begin, uint32_t end, bool roots) {
+	auto const &p = arrays.position;
+	auto const &q = arrays.rotation;
+	auto const &s = arrays.scale;
+	auto &m = arrays.local_to_world;
+	for (uint32_t i = begin; i < end; ++i) {
+		//local-to-parent, as in make_local_to_parent() (the rotation is glm::mat3_cast's, with columns scaled):
+		float w = q[0][i], x = q[1][i], y = q[2][i], z = q[3][i];
+		float local[12] = {
+			(1.0f - (y * 2.0f * y + z * 2.0f * z)) * s[0][i], (x * 2.0f * y + w * 2.0f * z) * s[0][i], (x * 2.0f * z - w * 2.0f * y) * s[0][i],
+			(x * 2.0f * y - w * 2.0f * z) * s[1][i], (1.0f - (x * 2.0f * x + z * 2.0f * z)) * s[1][i], (y * 2.0f * z + w * 2.0f * x) * s[1][i],
+			(x * 2.0f * z + w * 2.0f * y) * s[2][i], (y * 2.0f * z - w * 2.0f * x) * s[2][i], (1.0f - (x * 2.0f * x + y * 2.0f * y)) * s[2][i],
+			p[0][i], p[1][i], p[2][i]
+		};
+		if (roots) {
+			for (uint32_t c = 0; c < 12; ++c) m[c][i] = local[c];
+			continue;
+		}
+		uint32_t pi = arrays.parent_index[i];
+		for (uint32_t c = 0; c < 4; ++c) {
+			for (uint32_t r = 0; r < 3; ++r) {
+				float v = m[r][pi] * local[3*c+0] + m[3+r][pi] * local[3*c+1] + m[6+r][pi] * local[3*c+2];
+				if (c == 3) v += m[9+r][pi];
+				m[3*c+r][i] = v;
+			}
+		}
+	}
+}
+
+#ifdef SCENE_X86
+//as above, but four transforms at a time (one per lane):
+void compute_world_sse2(Scene::TransformArrays &arrays, uint32_t begin, uint32_t end, bool roots) {
+	auto const &p = arrays.position;
+	auto const &q = arrays.rotation;
+	auto const &s = arrays.scale;
+	auto &m = arrays.local_to_world;
+	__m128 const one = _mm_set1_ps(1.0f);
+	__m128 const two = _mm_set1_ps(2.0f);
+
+	uint32_t i = begin;
+	for (; i + 4 <= end; i += 4) {
+		__m128 w = _mm_loadu_ps(&q[0][i]);
+		__m128 x = _mm_loadu_ps(&q[1][i]);
+		__m128 y = _mm_loadu_ps(&q[2][i]);
+		__m128 z = _mm_loadu_ps(&q[3][i]);
+		__m128 x2 = _mm_mul_ps(x, two), y2 = _mm_mul_ps(y, two), z2 = _mm_mul_ps(z, two);
+		__m128 xx = _mm_mul_ps(x, x2), yy = _mm_mul_ps(y, y2), zz = _mm_mul_ps(z, z2);
+		__m128 xy = _mm_mul_ps(x, y2), xz = _mm_mul_ps(x, z2), yz = _mm_mul_ps(y, z2);
+		__m128 wx = _mm_mul_ps(w, x2), wy = _mm_mul_ps(w, y2), wz = _mm_mul_ps(w, z2);
+		__m128 sx = _mm_loadu_ps(&s[0][i]), sy = _mm_loadu_ps(&s[1][i]), sz = _mm_loadu_ps(&s[2][i]);
+
+		__m128 local[12] = {
+			_mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx), _mm_mul_ps(_mm_add_ps(xy, wz), sx), _mm_mul_ps(_mm_sub_ps(xz, wy), sx),
+			_mm_mul_ps(_mm_sub_ps(xy, wz), sy), _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy), _mm_mul_ps(_mm_add_ps(yz, wx), sy),
+			_mm_mul_ps(_mm_add_ps(xz, wy), sz), _mm_mul_ps(_mm_sub_ps(yz, wx), sz), _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz),
+			_mm_loadu_ps(&p[0][i]), _mm_loadu_ps(&p[1][i]), _mm_loadu_ps(&p[2][i])
+		};
+		if (roots) {
+			for (uint32_t c = 0; c < 12; ++c) _mm_storeu_ps(&m[c][i], local[c]);
+			continue;
+		}
+
+		//parents' matrices, transposed into lanes:
+		uint32_t const *pi = &arrays.parent_index[i];
+		__m128 parent[12];
+		for (uint32_t c = 0; c < 12; ++c) {
+			parent[c] = _mm_setr_ps(m[c][pi[0]], m[c][pi[1]], m[c][pi[2]], m[c][pi[3]]);
+		}
+		for (uint32_t c = 0; c < 4; ++c) {
+			for (uint32_t r = 0; r < 3; ++r) {
+				__m128 v = _mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(parent[r], local[3*c+0]),
+					_mm_mul_ps(parent[3+r], local[3*c+1])),
+					_mm_mul_ps(parent[6+r], local[3*c+2]));
+				if (c == 3) v = _mm_add_ps(v, parent[9+r]);
+				_mm_storeu_ps(&m[3*c+r][i], v);
+			}
+		}
+	}
+	compute_world_scalar(arrays, i, end, roots);
+}
+#endif //SCENE_X86
+
+}
+
+void Scene::update_world_matrices() const {
+	TransformArrays &arrays = transform_arrays;
+	TransformStorage &storage = transform_storage();
+
+	//the sorted order needs rebuilding whenever transforms have been made or destroyed:
+	if (arrays.layout != storage.layout || arrays.slots.size() != transforms.size()) {
+		sort_transforms(transforms, &arrays);
+	}
+
+	//look through storage (front to back) for transforms whose values have changed since their matrices were computed,
+	// and copy those values into the arrays, marking the transforms dirty (and their cached matrices out of date, with version 0).
+	//Returns false if a parent changed, since then the order may need to change, too:
+	auto scan = [&]() {
+		bool same_parents = true;
+		for (auto const &entry : arrays.scan) {
+			TransformBlock &b = storage.block(entry.first);
+			uint32_t k = entry.first % TransformBlockSize;
+			uint32_t s = entry.second;
+			if (b.version[k] != 0 && b.parent[k] == b.seen_parent[k]
+			 && b.position[k] == b.seen_position[k] && b.rotation[k] == b.seen_rotation[k] && b.scale[k] == b.seen_scale[k]) {
+				continue; //unchanged
+			}
+			if (b.parent[k] != b.seen_parent[k]) same_parents = false;
+			b.seen_position[k] = b.position[k];
+			b.seen_rotation[k] = b.rotation[k];
+			b.seen_scale[k] = b.scale[k];
+			b.seen_parent[k] = b.parent[k];
+			b.version[k] = 0;
+			for (uint32_t c = 0; c < 3; ++c) {
+				arrays.position[c][s] = b.position[k][c];
+				arrays.scale[c][s] = b.scale[k][c];
+			}
+			arrays.rotation[0][s] = b.rotation[k].w;
+			arrays.rotation[1][s] = b.rotation[k].x;
+			arrays.rotation[2][s] = b.rotation[k].y;
+			arrays.rotation[3][s] = b.rotation[k].z;
+			arrays.dirty[s] = 1;
+		}
+		return same_parents;
+	};
+	if (!scan()) {
+		//re-sort, then mark everything that changed (which now has version 0) dirty again:
+		sort_transforms(transforms, &arrays);
+		scan();
+	}
+
+	//recompute world matrices of dirty transforms and their descendants, one depth at a time:
+	for (uint32_t d = 0; d + 1 < arrays.depth_begin.size(); ++d) {
+		uint32_t begin = arrays.depth_begin[d];
+		uint32_t end = arrays.depth_begin[d + 1];
+		for (uint32_t i = begin; i < end; ++i) {
+			if (d > 0) {
+				arrays.dirty[i] |= arrays.dirty[arrays.parent_index[i]];
+			} else if (arrays.parent[i]) {
+				arrays.dirty[i] = 1; //(roots with a parent outside of 'transforms' are always redone; changes to that parent aren't tracked here)
+			}
+		}
+		//(in runs of contiguous dirty transforms)
+		for (uint32_t i = begin; i < end; ) {
+			if (!arrays.dirty[i]) {
+				++i;
+				continue;
+			}
+			uint32_t run_end = i + 1;
+			while (run_end < end && arrays.dirty[run_end]) ++run_end;
+			#ifdef SCENE_X86
+			compute_world_sse2(arrays, i, run_end, d == 0);
+			#else
+			compute_world_scalar(arrays, i, run_end, d == 0);
+			#endif
+			i = run_end;
+		}
+		if (d == 0) {
+			//roots with a parent outside of 'transforms' (e.g., in another scene) get that parent's world matrix from its cache:
+			for (uint32_t i = begin; i < end; ++i) {
+				if (!arrays.parent[i]) continue;
+				glm::mat4x3 local;
+				for (uint32_t c = 0; c < 12; ++c) local[c / 3][c % 3] = arrays.local_to_world[c][i];
+				glm::mat4x3 world = arrays.parent[i]->make_local_to_world() * glm::mat4(local);
+				for (uint32_t c = 0; c < 12; ++c) arrays.local_to_world[c][i] = world[c / 3][c % 3];
+			}
+		}
+	}
+
+	//store recomputed matrices in storage, with new versions:
+	// (in depth order, so parents' new versions are there to record with their children's)
+	for (uint32_t i = 0; i < arrays.slots.size(); ++i) {
+		if (!arrays.dirty[i]) continue;
+		arrays.dirty[i] = 0;
+		TransformBlock &b = storage.block(arrays.slots[i]);
+		uint32_t k = arrays.slots[i] % TransformBlockSize;
+		for (uint32_t c = 0; c < 12; ++c) b.local_to_world[k][c / 3][c % 3] = arrays.local_to_world[c][i];
+		b.version[k] = storage.next_version++;
+		Scene::Transform const *parent = arrays.parent[i];
+		b.parent_version[k] = (parent ? storage.block(parent->slot).version[parent->slot % TransformBlockSize] : 0);
 	}
 }
 
@@ -80,16 +505,46 @@ glm::mat4 Scene::Camera::make_projection() const {
 //-------------------------
 
 
-void Scene::draw(Camera const &camera) const {
+namespace {
+
+//rows of an object-to-world matrix and of its normal matrix (the inverse transpose of its upper 3x3), as read by programs using Pipeline::Objects:
+// (the normal matrix's columns are cross products of the matrix's columns, over the determinant -- cheaper than a general inverse)
+void make_object_matrices(glm::mat4x3 const &m, Scene::ObjectMatrices *out) {
+	glm::vec3 c0 = glm::cross(m[1], m[2]);
+	glm::vec3 c1 = glm::cross(m[2], m[0]);
+	glm::vec3 c2 = glm::cross(m[0], m[1]);
+	float inv_det = 1.0f / glm::dot(m[0], c0);
+	for (uint32_t r = 0; r < 3; ++r) {
+		out->object_to_world[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+		out->normal_to_world[r] = glm::vec4(c0[r] * inv_det, c1[r] * inv_det, c2[r] * inv_det, 0.0f);
+	}
+}
+
+}
+
+Scene::DrawStats Scene::draw(Camera const &camera) const {
 	assert(camera.transform);
+	//bring all world matrices (including the camera's) up to date at once:
+	update_world_matrices();
 	glm::mat4 world_to_clip = camera.make_projection() * glm::mat4(camera.transform->make_world_to_local());
 	glm::mat4x3 world_to_light = glm::mat4x3(1.0f);
-	draw(world_to_clip, world_to_light);
+	return draw_updated(world_to_clip, world_to_light);
+}
+
+Scene::DrawStats Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+	//bring all object-to-world matrices up to date at once:
+	update_world_matrices();
+	return draw_updated(world_to_clip, world_to_light);
 }
 
-void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+Scene::DrawStats Scene::draw_updated(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+	DrawStats stats;
 
-	//Iterate through all drawables, sending each one to OpenGL:
+	Frustum frustum(world_to_clip);
+
+	//Gather the drawables to send to OpenGL, each with a key to sort by:
+	std::vector< QueuedDraw > &queue = draw_queue;
+	queue.clear();
 	for (auto const &drawable : drawables) {
 		//Reference to drawable's pipeline for convenience:
 		Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
@@ -102,67 +557,313 @@ void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_lig
 		if (pipeline.count == 0) continue;
 
 
-		//Set shader program:
-		glUseProgram(pipeline.program);
+		//the object-to-world matrix is used for culling and in all three of the uniforms below:
+		assert(drawable.transform); //drawables *must* have a transform
+		glm::mat4x3 object_to_world = drawable.transform->make_local_to_world();
 
-		//Set attribute sources:
-		glBindVertexArray(pipeline.vao);
+		//skip any drawables whose bounding box is out of view:
+		glm::vec3 center = glm::vec3(object_to_world[3]);
+		if (pipeline.min.x <= pipeline.max.x) {
+			glm::vec3 extent = 0.5f * (pipeline.max - pipeline.min);
+			//box around the transformed box:
+			center = object_to_world * glm::vec4(0.5f * (pipeline.min + pipeline.max), 1.0f);
+			glm::vec3 world_extent = glm::abs(object_to_world[0]) * extent.x
+			                       + glm::abs(object_to_world[1]) * extent.y
+			                       + glm::abs(object_to_world[2]) * extent.z;
+			if (frustum.outside(center, world_extent)) {
+				stats.culled += 1;
+				continue;
+			}
+		}
 
-		//Configure program uniforms:
+		//Sort key -- program, vertex array, textures, and mesh (so draws that share state, or can be drawn as instances, end up together),
+		// then distance (front-to-back, so nearer objects fill the depth buffer first).
+		//GL names are folded down to fit; a collision just means less state gets shared, never that the wrong state is used:
+		auto fold = [](uint32_t x) { return uint64_t((x ^ (x >> 12) ^ (x >> 24)) & 0xfff); };
+		uint32_t textures = 0;
+		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+			textures = textures * 31 + pipeline.textures[i].texture * 7 + pipeline.textures[i].target;
+		}
+		uint32_t mesh = pipeline.start * 31 + pipeline.count;
+		float depth = world_to_clip[0][3] * center.x + world_to_clip[1][3] * center.y + world_to_clip[2][3] * center.z + world_to_clip[3][3];
+		uint32_t depth_bits = 0; //(the bits of a non-negative float sort like the float)
+		if (depth > 0.0f) std::memcpy(&depth_bits, &depth, sizeof(depth_bits));
+
+		queue.emplace_back();
+		queue.back().key = (uint64_t(pipeline.program & 0x3ff) << 54)
+		                 | (uint64_t(pipeline.vao & 0x3ff) << 44)
+		                 | (fold(textures) << 32)
+		                 | (fold(mesh) << 20)
+		                 | uint64_t(depth_bits >> 11);
+		queue.back().drawable = &drawable;
+		queue.back().object_to_world = object_to_world;
+	}
 
-		//the object-to-world matrix is used in all three of these uniforms:
-		assert(drawable.transform); //drawables *must* have a transform
-		glm::mat4x3 object_to_world = drawable.transform->make_local_to_world();
+	std::sort(queue.begin(), queue.end(), [](QueuedDraw const &a, QueuedDraw const &b) {
+		return a.key < b.key;
+	});
+
+	//can drawables with pipelines 'a' and 'b' be drawn as instances in one call? (is everything but their transforms the same?)
+	auto same_but_transform = [](Drawable::Pipeline const &a, Drawable::Pipeline const &b) {
+		if (a.program != b.program || a.vao != b.vao) return false;
+		if (a.type != b.type || a.start != b.start || a.count != b.count) return false;
+		if (a.set_uniforms || b.set_uniforms) return false; //(can't tell what these do per-drawable)
+		if (a.instanced.program != b.instanced.program || a.instanced.vao != b.instanced.vao || a.instanced.buffer != b.instanced.buffer) return false;
+		if (a.instanced.WORLD_TO_CLIP_mat4 != b.instanced.WORLD_TO_CLIP_mat4
+		 || a.instanced.WORLD_TO_LIGHT_mat4x3 != b.instanced.WORLD_TO_LIGHT_mat4x3
+		 || a.instanced.NORMAL_WORLD_TO_LIGHT_mat3 != b.instanced.NORMAL_WORLD_TO_LIGHT_mat3) return false;
+		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+			if (a.textures[i].texture != b.textures[i].texture) return false;
+			if (a.textures[i].texture != 0 && a.textures[i].target != b.textures[i].target) return false;
+		}
+		return true;
+	};
 
-		//OBJECT_TO_CLIP takes vertices from object space to clip space:
-		if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
-			glm::mat4 object_to_clip = world_to_clip * glm::mat4(object_to_world);
-			glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
+	//Find the runs of drawables (after sorting, they are adjacent) that can be drawn together as instances:
+	for (size_t q = 0; q < queue.size(); q += queue[q].run) {
+		Scene::Drawable::Pipeline const &pipeline = queue[q].drawable->pipeline;
+		size_t end = q + 1;
+		if (pipeline.instanced.program != 0 && pipeline.instanced.vao != 0 && pipeline.instanced.buffer != 0) {
+			while (end < queue.size() && same_but_transform(pipeline, queue[end].drawable->pipeline)) {
+				queue[end].run = 0;
+				++end;
+			}
 		}
+		queue[q].run = uint32_t(end - q);
+	}
 
-		//the object-to-light matrix is used in the next two uniforms:
-		glm::mat4x3 object_to_light = world_to_light * glm::mat4(object_to_world);
+	//OpenGL state set so far, so that only changes are sent.
+	// starts as draw() leaves it: no program, vertex array, array buffer, or textures bound, and texture unit zero active.
+	GLuint bound_program = 0;
+	GLuint bound_vao = 0;
+	GLuint bound_buffer = 0;
+	uint32_t active_texture = 0;
+	Drawable::Pipeline::TextureInfo bound_textures[Drawable::Pipeline::TextureCount + 1]; //(texture == 0 means nothing bound; the last is ObjectsTextureUnit)
+
+	auto bind_texture = [&](uint32_t i, Drawable::Pipeline::TextureInfo const &info) {
+		Drawable::Pipeline::TextureInfo &bound = bound_textures[i];
+		if (bound.texture == info.texture && (info.texture == 0 || bound.target == info.target)) return;
+		if (active_texture != i) {
+			glActiveTexture(GL_TEXTURE0 + i);
+			active_texture = i;
+			stats.gl_calls += 1;
+		}
+		if (bound.texture != 0 && (info.texture == 0 || bound.target != info.target)) {
+			glBindTexture(bound.target, 0);
+			stats.gl_calls += 1;
+		}
+		if (info.texture != 0) {
+			glBindTexture(info.target, info.texture);
+			stats.gl_calls += 1;
+		}
+		bound = info;
+	};
+
+	auto use_program = [&](GLuint program) {
+		if (bound_program == program) return;
+		glUseProgram(program);
+		bound_program = program;
+		stats.gl_calls += 1;
+	};
 
-		//OBJECT_TO_CLIP takes vertices from object space to light space:
-		if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
-			glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
+	auto bind_vertex_array = [&](GLuint vao) {
+		if (bound_vao == vao) return;
+		glBindVertexArray(vao);
+		bound_vao = vao;
+		stats.gl_calls += 1;
+	};
+
+	//Write the matrices of all drawables that read them from a buffer (and aren't drawn as instances), a buffer at a time.
+	// this way the matrix math is done in one tight loop, and each buffer gets one upload rather than each draw getting three glUniform* calls:
+	std::vector< GLuint > written_buffers;
+	for (size_t first = 0; first < queue.size(); ++first) {
+		GLuint buffer = queue[first].drawable->pipeline.objects.buffer;
+		if (buffer == 0 || queue[first].run != 1) continue;
+		if (std::find(written_buffers.begin(), written_buffers.end(), buffer) != written_buffers.end()) continue;
+		written_buffers.emplace_back(buffer);
+
+		object_matrices.clear();
+		for (size_t q = first; q < queue.size(); ++q) {
+			if (queue[q].drawable->pipeline.objects.buffer != buffer || queue[q].run != 1) continue;
+			queue[q].object_index = uint32_t(object_matrices.size());
+			object_matrices.emplace_back();
+			make_object_matrices(queue[q].object_to_world, &object_matrices.back());
 		}
 
-		//NORMAL_TO_CLIP takes normals from object space to light space:
-		if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
-			glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(object_to_light)));
-			glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
+		if (bound_buffer != buffer) {
+			glBindBuffer(GL_ARRAY_BUFFER, buffer);
+			bound_buffer = buffer;
+			stats.gl_calls += 1;
+		}
+		//(re-specifying the whole buffer lets the driver hand back fresh storage, rather than waiting for draws that still use the old contents)
+		glBufferData(GL_ARRAY_BUFFER, object_matrices.size() * sizeof(ObjectMatrices), object_matrices.data(), GL_STREAM_DRAW);
+		stats.gl_calls += 1;
+	}
+
+	//world-space normals to light space (used by all instanced draws and by programs using Pipeline::Objects):
+	glm::mat3 normal_world_to_light = glm::inverse(glm::transpose(glm::mat3(world_to_light)));
+
+	//programs using Pipeline::Objects whose world-to-* uniforms have been set (they don't change during the draw, so are set once per program):
+	std::vector< GLuint > world_uniforms_set;
+
+	//Send the drawables to OpenGL:
+	size_t q = 0;
+	while (q < queue.size()) {
+		Scene::Drawable::Pipeline const &pipeline = queue[q].drawable->pipeline;
+
+		size_t end = q + queue[q].run;
+
+		if (queue[q].run > 1) {
+			//Draw the whole run at once with the instanced program, which gets each drawable's matrices from the instance buffer:
+			use_program(pipeline.instanced.program);
+			bind_vertex_array(pipeline.instanced.vao);
+
+			instances.clear();
+			for (size_t i = q; i < end; ++i) {
+				glm::mat4x3 const &object_to_world = queue[i].object_to_world;
+				instances.emplace_back();
+				instances.back().object_to_world = object_to_world;
+				instances.back().normal_to_world = glm::inverse(glm::transpose(glm::mat3(object_to_world)));
+			}
+
+			if (bound_buffer != pipeline.instanced.buffer) {
+				glBindBuffer(GL_ARRAY_BUFFER, pipeline.instanced.buffer);
+				bound_buffer = pipeline.instanced.buffer;
+				stats.gl_calls += 1;
+			}
+			//(re-specifying the whole buffer lets the driver hand back fresh storage, rather than waiting for draws that still use the old contents)
+			glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(MeshInstance), instances.data(), GL_STREAM_DRAW);
+			stats.gl_calls += 1;
+
+			//the rest of the transformation is shared by all instances:
+			if (pipeline.instanced.WORLD_TO_CLIP_mat4 != -1U) {
+				glUniformMatrix4fv(pipeline.instanced.WORLD_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(world_to_clip));
+				stats.gl_calls += 1;
+			}
+			if (pipeline.instanced.WORLD_TO_LIGHT_mat4x3 != -1U) {
+				glUniformMatrix4x3fv(pipeline.instanced.WORLD_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(world_to_light));
+				stats.gl_calls += 1;
+			}
+			if (pipeline.instanced.NORMAL_WORLD_TO_LIGHT_mat3 != -1U) {
+				glUniformMatrix3fv(pipeline.instanced.NORMAL_WORLD_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_world_to_light));
+				stats.gl_calls += 1;
+			}
+
+			for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+				bind_texture(i, pipeline.textures[i]);
+			}
+
+			glDrawArraysInstanced(pipeline.type, pipeline.start, pipeline.count, GLsizei(end - q));
+			stats.drawn += uint32_t(end - q);
+			stats.draw_calls += 1;
+			stats.gl_calls += 1;
+
+			q = end;
+			continue;
+		}
+
+		glm::mat4x3 const &object_to_world = queue[q].object_to_world;
+
+		//Set shader program:
+		use_program(pipeline.program);
+
+		//Set attribute sources:
+		bind_vertex_array(pipeline.vao);
+
+		//Configure program uniforms:
+
+		if (pipeline.objects.buffer != 0) {
+			//the matrices are already in the buffer, so the program just needs to know where:
+			// (the texture that reads the buffer stays bound to its reserved unit until the end of the draw; drawables that don't use it ignore it)
+			Drawable::Pipeline::TextureInfo objects_texture;
+			objects_texture.texture = pipeline.objects.texture;
+			objects_texture.target = GL_TEXTURE_BUFFER;
+			bind_texture(Drawable::Pipeline::ObjectsTextureUnit, objects_texture);
+			if (std::find(world_uniforms_set.begin(), world_uniforms_set.end(), pipeline.program) == world_uniforms_set.end()) {
+				world_uniforms_set.emplace_back(pipeline.program);
+				if (pipeline.objects.WORLD_TO_CLIP_mat4 != -1U) {
+					glUniformMatrix4fv(pipeline.objects.WORLD_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(world_to_clip));
+					stats.gl_calls += 1;
+				}
+				if (pipeline.objects.WORLD_TO_LIGHT_mat4x3 != -1U) {
+					glUniformMatrix4x3fv(pipeline.objects.WORLD_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(world_to_light));
+					stats.gl_calls += 1;
+				}
+				if (pipeline.objects.NORMAL_WORLD_TO_LIGHT_mat3 != -1U) {
+					glUniformMatrix3fv(pipeline.objects.NORMAL_WORLD_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_world_to_light));
+					stats.gl_calls += 1;
+				}
+			}
+			if (pipeline.objects.OBJECT_INDEX_int != -1U) {
+				glUniform1i(pipeline.objects.OBJECT_INDEX_int, GLint(queue[q].object_index));
+				stats.gl_calls += 1;
+			}
+		} else {
+			//OBJECT_TO_CLIP takes vertices from object space to clip space:
+			if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
+				glm::mat4 object_to_clip = world_to_clip * glm::mat4(object_to_world);
+				glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
+				stats.gl_calls += 1;
+			}
+
+			//the object-to-light matrix is used in the next two uniforms:
+			glm::mat4x3 object_to_light = world_to_light * glm::mat4(object_to_world);
+
+			//OBJECT_TO_CLIP takes vertices from object space to light space:
+			if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
+				glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
+				stats.gl_calls += 1;
+			}
+
+			//NORMAL_TO_CLIP takes normals from object space to light space:
+			if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
+				glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(object_to_light)));
+				glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
+				stats.gl_calls += 1;
+			}
 		}
 
 		//set any requested custom uniforms:
 		if (pipeline.set_uniforms) pipeline.set_uniforms();
 
-		//set up textures:
+		//set up textures (including un-binding any that this drawable doesn't use):
 		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, pipeline.textures[i].texture);
-			}
+			bind_texture(i, pipeline.textures[i]);
 		}
 
 		//draw the object:
 		glDrawArrays(pipeline.type, pipeline.start, pipeline.count);
+		stats.drawn += 1;
+		stats.draw_calls += 1;
+		stats.gl_calls += 1;
 
-		//un-bind textures:
-		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, 0);
-			}
-		}
-		glActiveTexture(GL_TEXTURE0);
-
+		q += 1;
 	}
 
-	glUseProgram(0);
-	glBindVertexArray(0);
+	//leave state as it was found -- nothing bound:
+	for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount + 1; ++i) {
+		bind_texture(i, Drawable::Pipeline::TextureInfo());
+	}
+	if (active_texture != 0) {
+		glActiveTexture(GL_TEXTURE0);
+		stats.gl_calls += 1;
+	}
+	if (bound_program != 0) {
+		glUseProgram(0);
+		stats.gl_calls += 1;
+	}
+	if (bound_vao != 0) {
+		glBindVertexArray(0);
+		stats.gl_calls += 1;
+	}
+	if (bound_buffer != 0) {
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		stats.gl_calls += 1;
+	}
 
 	GL_ERRORS();
+
+	return stats;
 }
 
 
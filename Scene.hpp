@@ -11,10 +11,13 @@
  */
 
 #include "GL.hpp"
+#include "Mesh.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 
+#include <array>
+#include <limits>
 #include <list>
 #include <memory>
 #include <functional>
@@ -28,25 +31,37 @@ struct Scene {
 		std::string name;
 
 		//The core function of a transform is to store a transformation in the world:
-		glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f);
-		glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f); //n.b. wxyz init order
-		glm::vec3 scale = glm::vec3(1.0f, 1.0f, 1.0f);
+		// (the values live in a slot of contiguous arrays shared by all transforms -- see TransformStorage in Scene.cpp -- and these refer to them;
+		//  they start out as (0,0,0), the identity rotation, and (1,1,1))
+		glm::vec3 &position;
+		glm::quat &rotation; //n.b. glm::quat's constructor takes wxyz
+		glm::vec3 &scale;
 
-		//The transform above may be relative to some parent transform:
-		Transform *parent = nullptr;
+		//The transform above may be relative to some parent transform (initially nullptr):
+		Transform *&parent;
 
 		//It is often convenient to construct matrices representing this transformation:
 		// ..relative to its parent:
 		glm::mat4x3 make_local_to_parent() const;
 		glm::mat4x3 make_parent_to_local() const;
 		// ..relative to the world:
+		// (for transforms in a Scene, these come from a cache that Scene::update_world_matrices() -- which Scene::draw() runs first -- brings
+		//  up to date once per frame. The cache is checked against the transform's and its ancestors' current values first, so the result
+		//  is always up to date: if anything changed since the last update -- or no scene has updated the transform -- it is worked out
+		//  from the parent chain instead.)
 		glm::mat4x3 make_local_to_world() const;
 		glm::mat4x3 make_world_to_local() const;
 
-		//since hierarchy is tracked through pointers, copy-constructing a transform  is not advised:
+		//n.b. making and destroying transforms isn't thread-safe (their storage is shared):
+		Transform();
+		~Transform();
+		//since hierarchy is tracked through pointers, copying a transform is not advised:
 		Transform(Transform const &) = delete;
-		//if we delete some constructors, we need to let the compiler know that the default constructor is still okay:
-		Transform() = default;
+		Transform &operator=(Transform const &) = delete;
+
+		//internals:
+		uint32_t slot; //index of this transform's values (and cached world matrices) in the shared storage
+		explicit Transform(uint32_t slot); //(used by the default constructor)
 	};
 
 	struct Drawable {
@@ -65,15 +80,45 @@ struct Scene {
 			GLuint start = 0; //first vertex to draw; passed to glDrawArrays
 			GLuint count = 0; //number of vertices to draw; passed to glDrawArrays
 
+			//bounding box of the vertices (in object space; e.g., a Mesh's min and max), used to skip drawing things that are out of view:
+			// (the default -- an empty box -- means the bounds aren't known, and the drawable is never skipped)
+			glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+			glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+
 			//uniforms:
 			GLuint OBJECT_TO_CLIP_mat4 = -1U; //uniform location for object to clip space matrix
 			GLuint OBJECT_TO_LIGHT_mat4x3 = -1U; //uniform location for object to light space (== world space) matrix
 			GLuint NORMAL_TO_LIGHT_mat3 = -1U; //uniform location for normal to light space (== world space) matrix
 
+			//(optional) instead of the three uniforms above, the program can read its matrices (a Scene::ObjectMatrices) from a texture buffer:
+			// draw() writes the matrices of every such drawable into 'buffer' at once, before drawing, and then only sets OBJECT_INDEX per draw.
+			// (draw() binds 'texture' to texture unit ObjectsTextureUnit, below; the program's sampler should read from that unit)
+			struct Objects {
+				GLuint buffer = 0; //array buffer that the frame's Scene::ObjectMatrices are written to (0 == use the uniforms above)
+				GLuint texture = 0; //GL_TEXTURE_BUFFER texture that reads 'buffer'
+				GLuint OBJECT_INDEX_int = -1U; //uniform location for the index of this drawable's matrices in 'buffer'
+				GLuint WORLD_TO_CLIP_mat4 = -1U; //uniform location for world to clip space matrix
+				GLuint WORLD_TO_LIGHT_mat4x3 = -1U; //uniform location for world to light space matrix
+				GLuint NORMAL_WORLD_TO_LIGHT_mat3 = -1U; //uniform location for (world space) normal to light space matrix
+			} objects;
+
 			std::function< void() > set_uniforms; //(optional) function to set any other useful uniforms
 
+			//(optional) a variant of 'program' that draws many copies of the mesh in one call, reading each copy's matrices (a MeshInstance) from per-instance attributes.
+			// draw() uses it for runs of visible drawables whose pipelines are the same except for their transforms (and that have no set_uniforms):
+			struct Instanced {
+				GLuint program = 0; //instanced shader program (0 == never draw instanced)
+				GLuint vao = 0; //like 'vao', plus per-instance attributes read from 'buffer' (see MeshBuffer::make_vao_for_program)
+				GLuint buffer = 0; //array buffer that each run's MeshInstance data is streamed into
+				GLuint WORLD_TO_CLIP_mat4 = -1U; //uniform location for world to clip space matrix
+				GLuint WORLD_TO_LIGHT_mat4x3 = -1U; //uniform location for world to light space matrix
+				GLuint NORMAL_WORLD_TO_LIGHT_mat3 = -1U; //uniform location for (world space) normal to light space matrix
+			} instanced;
+
 			//texture objects to bind for the first TextureCount textures:
 			enum : uint32_t { TextureCount = 4 };
+			//texture unit reserved for objects.texture (just past the units used by 'textures', so it never displaces one of them):
+			enum : uint32_t { ObjectsTextureUnit = TextureCount };
 			struct TextureInfo {
 				GLuint texture = 0;
 				GLenum target = GL_TEXTURE_2D;
@@ -123,10 +168,66 @@ struct Scene {
 	std::list< Light > lights;
 
 	//The "draw" function provides a convenient way to pass all the things in a scene to OpenGL:
-	void draw(Camera const &camera) const;
+	// (drawables whose bounding box is entirely outside the view are skipped; the returned DrawStats say how many)
+	//n.b. drawables are sorted to share OpenGL state (program, vertex array, textures, mesh) and then front-to-back,
+	// so they are not drawn in the order they appear in 'drawables'. Draw things that need an order (e.g., blended ones) separately.
+	// Drawables of the same mesh whose pipelines have 'instanced' set up are drawn together, with one glDrawArraysInstanced call.
+	struct DrawStats {
+		uint32_t drawn = 0; //drawables sent to OpenGL
+		uint32_t culled = 0; //drawables skipped for being out of view
+		uint32_t draw_calls = 0; //glDrawArrays* calls made (drawables drawn as instances share one)
+		uint32_t gl_calls = 0; //OpenGL calls made (not counting any made by Pipeline::set_uniforms)
+	};
+	DrawStats draw(Camera const &camera) const;
 
 	//..sometimes, you want to draw with a custom projection matrix and/or light space:
-	void draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f)) const;
+	DrawStats draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f)) const;
+
+	//Bring the world matrices of all transforms up to date together, in one pass over flat arrays (draw() does this first):
+	// transforms whose values (or whose ancestors' values) changed since the last update are recomputed, and the rest are left alone.
+	// Afterward, make_local_to_world() on any of them just returns its cached matrix.
+	void update_world_matrices() const;
+
+	//internals used by update_world_matrices():
+	// the scene's transforms sorted by depth in the hierarchy, so parents come before their children, and transforms of the same
+	// depth -- which don't depend on each other -- are contiguous and can be done four at a time. Along with copies of their values
+	// (as of the last update) in flat arrays, one per component, so that computing matrices only needs contiguous loads.
+	struct TransformArrays {
+		uint64_t layout = 0; //storage's 'layout' when sorted (it changes whenever any transform is made or destroyed)
+		std::vector< uint32_t > slots; //storage slots of the transforms, by depth (then by order in 'transforms')
+		std::vector< std::pair< uint32_t, uint32_t > > scan; //(slot, index in 'slots') for each transform, in order of slot (to check for changes front to back)
+		std::vector< uint32_t > depth_begin; //transforms of depth d are slots[depth_begin[d]] .. slots[depth_begin[d+1]-1]
+		std::vector< Transform const * > parent; //parent of each sorted transform
+		std::vector< uint32_t > parent_index; //index in 'slots' of parent, or -1U for roots (and parents that aren't in 'transforms')
+		std::array< std::vector< float >, 3 > position; //x,y,z
+		std::array< std::vector< float >, 4 > rotation; //w,x,y,z
+		std::array< std::vector< float >, 3 > scale; //x,y,z
+		std::array< std::vector< float >, 12 > local_to_world; //column-major, three values per column
+		std::vector< uint8_t > dirty; //set for transforms whose local_to_world needs recomputing (during an update)
+	};
+	mutable TransformArrays transform_arrays;
+
+	//internals used by draw():
+	// draw, assuming update_world_matrices() has just been called:
+	DrawStats draw_updated(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const;
+	// the drawables to send to OpenGL this draw (kept between draws to reuse its memory):
+	struct QueuedDraw {
+		uint64_t key; //sort key (see Scene::draw)
+		Drawable const *drawable;
+		glm::mat4x3 object_to_world;
+		uint32_t run; //number of drawables (starting with this one) to draw together as instances; 0 for the rest of the run
+		uint32_t object_index; //index of matrices in pipeline.objects.buffer (if used)
+	};
+	mutable std::vector< QueuedDraw > draw_queue;
+	// matrices of drawables that use Pipeline::Objects, as written to its buffer (and read by programs as six RGBA32F texels each):
+	struct ObjectMatrices {
+		glm::vec4 object_to_world[3]; //rows of the object-to-world matrix
+		glm::vec4 normal_to_world[3]; //rows of the normal matrix (w is unused)
+	};
+	static_assert(sizeof(ObjectMatrices) == 4*4*6, "ObjectMatrices is packed.");
+	mutable std::vector< ObjectMatrices > object_matrices;
+	// matrices for the current run of instanced drawables, as streamed to Pipeline::Instanced::buffer:
+	mutable std::vector< MeshInstance > instances;
 
 	//add transforms/objects/cameras from a scene file to this scene:
 	// the 'on_drawable' callback gives your code a chance to look up mesh data and make Drawables:
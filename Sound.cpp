@@ -1,30 +1,359 @@
 #include "Sound.hpp"
 #include "load_wav.hpp"
 #include "load_opus.hpp"
+#include "ring_buffer.hpp"
+#include "mix_kernels.hpp"
+#include "worker_pool.hpp"
+#include "adpcm.hpp"
+#include "fft.hpp"
+#include "sample_cache.hpp"
+#include "read_write_chunk.hpp"
 
 #include <SDL.h>
 
-#include <list>
+#include <array>
 #include <cassert>
 #include <exception>
 #include <iostream>
 #include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <cstring>
+#include <fstream>
 
 //local (to this file) data used by the audio system:
 namespace {
 
 	//handy constants:
-	constexpr uint32_t const AUDIO_RATE = 48000; //sampling rate
-	constexpr uint32_t const MIX_SAMPLES = 1024; //number of samples to mix per call of mix_audio callback; n.b. SDL requires this to be a power of two
+	constexpr uint32_t const AUDIO_RATE = Sound::AudioRate; //sampling rate
+	constexpr uint32_t const STREAM_BUFFER_SAMPLES = 32768; //samples decoded ahead for each Stream (~0.7 seconds)
 
-	//The audio device:
+	//number of samples to mix per block (i.e., per call of the mix_audio callback); set by init():
+	// n.b. SDL requires this to be a power of two
+	uint32_t mix_samples = 1024;
+	float mix_seconds = float(mix_samples) / float(AUDIO_RATE); //duration of one block
+
+	//size of the (stack) buffer mix_voice decodes compressed sample data into; small enough to stay in L1:
+	constexpr uint32_t const DECODE_SAMPLES = 2048;
+	static_assert(DECODE_SAMPLES >= Sound::MaxBlockSize, "unpitched playback decodes up to a block at once");
+
+	//Which backend is driving the mixer:
+	Sound::Backend backend = Sound::Backend::SDL;
+
+	//SDL backend's audio device:
 	SDL_AudioDeviceID device = 0;
 
-	//list of all currently playing samples:
-	std::list< std::shared_ptr< Sound::PlayingSample > > playing_samples;
+	//Null backend's timer thread (and the mutex used by Sound::lock() to keep it from mixing):
+	std::thread null_thread;
+	std::atomic< bool > null_quit{false};
+	std::mutex null_mutex;
+
+	//Offline backend's most recently mixed block, and how much of it render() has handed out:
+	std::vector< float > offline_block;
+	uint32_t offline_used = 0;
+
+	//audio clock -- frames mixed since init():
+	uint64_t mixer_frame = 0; //(mixer's copy)
+	//copy published for Sound::now(), along with the (steady_clock) time it was published;
+	// written under a sequence counter so that readers see a matching pair:
+	std::atomic< uint32_t > clock_sequence{0};
+	std::atomic< uint64_t > clock_frame{0};
+	std::atomic< int64_t > clock_time{0};
+	//estimated delay between mixing a block and it starting to play (set by init()):
+	float output_latency = 0.0f;
+
+	//per-block mixer statistics (see Sound::stats()), kept in a ring of StatsHistory slots;
+	// each slot is written under its own sequence counter (like the clock), so readers can tell if it changed under them:
+	struct StatsSlot {
+		std::atomic< uint32_t > sequence{0};
+		std::atomic< uint64_t > block{0}; //index of the block recorded here
+		std::atomic< uint64_t > frame{0};
+		std::atomic< float > mix_time{0.0f};
+		std::atomic< float > load{0.0f};
+		std::atomic< float > interval{0.0f};
+		std::atomic< uint32_t > active_voices{0};
+		std::atomic< uint32_t > real_voices{0};
+		std::atomic< float > peak{0.0f};
+		std::atomic< float > rms{0.0f};
+	};
+	std::array< StatsSlot, Sound::StatsHistory > stats_slots;
+
+	//levels measured by the mixer in the most recent block (see Sound::Level), for the game thread to read:
+	// (rms and peak are stored separately, so a reader may see them from adjacent blocks -- fine for metering)
+	struct PublishedLevel {
+		std::atomic< float > rms{0.0f};
+		std::atomic< float > peak{0.0f};
+		void store(float rms_, float peak_) {
+			rms.store(rms_, std::memory_order_relaxed);
+			peak.store(peak_, std::memory_order_relaxed);
+		}
+		Sound::Level load() const {
+			Sound::Level level;
+			level.rms = rms.load(std::memory_order_relaxed);
+			level.peak = peak.load(std::memory_order_relaxed);
+			return level;
+		}
+	};
+	std::array< PublishedLevel, Sound::MaxVoices > voice_levels; //(zeroed when a voice is retired)
+	PublishedLevel output_level;
+	//totals (stats_blocks is bumped after its slot is written):
+	std::atomic< uint64_t > stats_blocks{0};
+	std::atomic< uint64_t > stats_overruns{0};
+	std::atomic< uint64_t > stats_late_blocks{0};
+	std::atomic< uint64_t > stats_clipped_blocks{0};
+	std::atomic< float > stats_max_load{0.0f};
+	//when the previous block started mixing (mixer only):
+	std::chrono::steady_clock::time_point last_mix_start;
+
+	//is some other thread calling the mixer? (if not, commands are applied immediately)
+	bool mixer_thread() {
+		return device != 0 || null_thread.joinable();
+	}
+
+	//Playback state for all voices, stored as a fixed-size pool in structure-of-arrays form.
+	// (only touched by the mixer, or directly by the game thread when there is no mixing thread)
+	struct Voices {
+		//sample (or stream) being played by each voice:
+		std::array< Sound::Sample const *, Sound::MaxVoices > sample;
+		std::array< Sound::Stream::Decoder *, Sound::MaxVoices > stream;
+		std::array< uint32_t, Sound::MaxVoices > stream_epoch; //epoch of stream this voice plays
+		std::array< bool, Sound::MaxVoices > stream_synced; //has the voice skipped to the start of its epoch yet?
+		std::array< uint32_t, Sound::MaxVoices > i; //next data value to read...
+		std::array< float, Sound::MaxVoices > frac; //...plus the fractional part of the read position (for pitched playback)
+		std::array< ADPCMDecoder, Sound::MaxVoices > adpcm; //decoder state (for ADPCM samples)
+		std::array< Sound::Ramp< float >, Sound::MaxVoices > rate; //data values to advance per output frame
+		std::array< float, Sound::MaxVoices > block_rate; //(average) rate over the current block (scratch, written by mix_block)
+		std::array< uint64_t, Sound::MaxVoices > start_frame; //audio frame playback starts on (voice waits silently until then)
+		std::array< uint32_t, Sound::MaxVoices > generation; //matches handle's generation while the voice is in use
+		std::array< bool, Sound::MaxVoices > playing; //is this slot in 'active'?
+		std::array< bool, Sound::MaxVoices > loop; //should playback loop after data runs out?
+		std::array< bool, Sound::MaxVoices > stopping; //is playback fading out due to stop()?
+		std::array< Sound::Bus, Sound::MaxVoices > bus; //submix bus the voice is mixed into
+
+		std::array< Sound::Ramp< float >, Sound::MaxVoices > volume;
+
+		//2D playback panning control: ('NaN' if sound played in 3D mode)
+		std::array< Sound::Ramp< float >, Sound::MaxVoices > pan;
+
+		//3D playback panning control: (ignored if sound played in 2D mode)
+		std::array< Sound::Ramp< glm::vec3 >, Sound::MaxVoices > position;
+		std::array< Sound::Ramp< float >, Sound::MaxVoices > half_volume_radius;
+
+		//voices are only mixed ("real") if they are audible and within the real voice budget;
+		// otherwise they are "virtual" and just advance their read position:
+		std::array< float, Sound::MaxVoices > priority; //higher priority voices are made real first
+		std::array< bool, Sound::MaxVoices > real; //was this voice mixed last block?
+		//pan weights (before volume is applied) for the panning inputs they were last computed with,
+		// so the trig only needs to be redone when a sample (or the listener) actually moves:
+		std::array< glm::vec2, Sound::MaxVoices > pan_weights;
+		std::array< bool, Sound::MaxVoices > pan_weights_valid;
+		std::array< float, Sound::MaxVoices > pan_weights_pan; //(2D)
+		std::array< glm::vec3, Sound::MaxVoices > pan_weights_position; //(3D)
+		std::array< float, Sound::MaxVoices > pan_weights_radius; //(3D)
+		std::array< uint32_t, Sound::MaxVoices > pan_weights_listener; //(3D) listener_version
+
+		//gains at the start and end of the current block (scratch, written by mix_block):
+		std::array< glm::vec2, Sound::MaxVoices > start_gain;
+		std::array< glm::vec2, Sound::MaxVoices > end_gain;
+
+		//slots of all currently playing voices (in no particular order):
+		std::array< uint32_t, Sound::MaxVoices > active;
+		uint32_t active_count = 0;
+	} voices;
+
+	//3D pan weights that need (re-)computing this block, gathered so they can be done in one pan_3D() call:
+	// (scratch, used by mix_block)
+	struct Pan3DBatch {
+		void add(uint32_t slot); //queue up the voice's current position/radius
+		void compute(glm::vec3 const &listener_position, glm::vec3 const &listener_right); //fill in left/right
+
+		uint32_t count = 0;
+		std::array< uint32_t, Sound::MaxVoices > slot;
+		std::array< float, Sound::MaxVoices > x, y, z, half_radius;
+		std::array< float, Sound::MaxVoices > left, right;
+	};
+	Pan3DBatch pan_batch_start, pan_batch_end;
+
+	//submix buses (see Sound::Bus); voices on the Master bus mix straight into the output buffer,
+	// the rest into per-bus buffers that are added into the output at the end of the block:
+	struct Buses {
+		std::vector< float > buffer; //one block of interleaved stereo per bus (set up by init(); Master's is unused)
+		std::array< Sound::Ramp< float >, Sound::BusCount > volume; //(Master's is unused; that's Sound::volume)
+		std::array< std::array< Sound::Effect *, Sound::MaxBusEffects >, Sound::BusCount > effects{};
+		std::array< uint32_t, Sound::BusCount > effect_count{};
+	} buses;
+
+	//A (non-streamed) voice's playback state for one block, copied out of 'voices' so that mix_voice can run on any thread
+	// without touching the voice pool (and so that mixing a voice a second time, as WorkerPool may, gives the same result):
+	struct VoiceMix {
+		Sound::Sample const *sample = nullptr;
+		uint64_t start_frame = 0;
+		glm::vec2 start_gain = glm::vec2(0.0f);
+		glm::vec2 end_gain = glm::vec2(0.0f);
+		float block_rate = 1.0f;
+		bool loop = false;
+		bool mix = false; //mix the voice, or (if it is virtual) just advance it?
+		Sound::Bus bus = Sound::Bus::SFX;
+		//read position at the start of the block:
+		uint32_t i = 0;
+		float frac = 0.0f;
+		ADPCMDecoder adpcm;
+	};
+	//...and what mixing it changed (copied back into 'voices' by the mixing thread):
+	struct VoiceMixed {
+		uint32_t i = 0;
+		float frac = 0.0f;
+		ADPCMDecoder adpcm;
+		bool finished = false;
+		Sound::Level level;
+	};
+
+	//optional worker threads for mixing large numbers of voices in parallel (see init() and mix_block()):
+	std::unique_ptr< WorkerPool > mix_pool;
+	//what a parallel mix reads (two of them, since a worker that fell behind may still be reading the last one; see WorkerPool):
+	struct ParallelMix {
+		uint64_t block = 0; //parallel mixes so far (so each thread knows when to clear its buffer)
+		uint64_t block_start = 0;
+		std::array< float *, Sound::BusCount > bus_buffer{}; //where the mixing thread mixes each bus
+		uint32_t count = 0;
+		std::array< uint32_t, Sound::MaxVoices > slot;
+		std::array< VoiceMix, Sound::MaxVoices > voice;
+	};
+	std::array< ParallelMix, 2 > parallel_mix;
+	uint64_t parallel_blocks = 0;
+	//per-thread outputs of parallel mixing (the mixing thread, thread 0, mixes straight into the bus buffers):
+	struct MixOutput {
+		uint64_t block = -1ULL; //parallel mix 'buffer' was last cleared for
+		std::vector< float > buffer; //(one block per bus, like Buses::buffer; summed into the bus buffers)
+		std::array< VoiceMixed, Sound::MaxVoices > mixed; //(indexed like ParallelMix::voice)
+	};
+	std::vector< std::unique_ptr< MixOutput > > mix_outputs;
+	//with fewer real voices than this, parallel mixing isn't worth the hand-off:
+	constexpr uint32_t const PARALLEL_MIN_REAL_VOICES = 32;
+	constexpr uint32_t const PARALLEL_CHUNK_VOICES = 4;
+
+	//bumped whenever the listener moves (checked by the 3D pan weight cache):
+	uint32_t listener_version = 0;
+
+	//maximum number of voices to actually mix per block:
+	uint32_t real_voice_budget = 64;
+
+	//slowest allowed playback rate (a rate of zero would never finish):
+	constexpr float const MIN_RATE = 1.0f / 64.0f;
+
+	//voices quieter than this (linear gain) are never mixed -- about -60dB:
+	constexpr float const AUDIBLE_GAIN = 1.0e-3f;
+
+	//slots that are free to be handed out by play(); filled by the mixer as voices finish, drained by the game thread:
+	// (capacity == MaxVoices, so the mixer can never fail to push)
+	RingBuffer< uint32_t > free_slots(Sound::MaxVoices);
+
+	//the game thread's view of each slot's generation; bumped every time a slot is handed out:
+	std::array< uint32_t, Sound::MaxVoices > slot_generations{};
+
+	//Capture of the final mix to a WAV file (see Sound::start_capture()):
+	// the mixer copies blocks into 'buffer', and a writer thread streams them to the file.
+	struct Capture {
+		Capture(std::string const &filename); //throws on error
+		~Capture(); //writes out whatever is left in 'buffer' and finishes the file
+		Capture(Capture const &) = delete;
+
+		void run(); //writer thread body
+
+		std::vector< char > file_buffer; //(large, so the file is written in big pieces; declared first so it outlives 'file')
+		std::ofstream file;
+		RingBuffer< float > buffer;
+		uint64_t written = 0; //values written to the file (writer thread only)
+
+		std::atomic< bool > quit{false};
+		std::thread thread;
+	};
+	constexpr uint32_t const CAPTURE_BUFFER_SAMPLES = 1 << 18; //~2.7 seconds of stereo
+	constexpr uint32_t const CAPTURE_WAV_HEADER_BYTES = 58;
+
+	Capture *capture = nullptr; //(mixer's copy)
+	std::unique_ptr< Capture > capture_owner; //(game thread's copy)
+	std::atomic< uint64_t > capture_dropped_blocks{0};
+
+	//changes requested by the game thread are passed to the mixer as commands:
+	struct Command {
+		enum Type : uint8_t {
+			Play,
+			SetVolume,
+			SetPan,
+			SetPosition,
+			SetHalfVolumeRadius,
+			SetRate,
+			SetPriority,
+			Stop,
+			StopAll,
+			SetListener,
+			SetGlobalVolume,
+			SetRealVoiceBudget,
+			SetBus,
+			SetBusVolume,
+			AddEffect,
+			RemoveEffect,
+			SetCapture,
+		} type = Play;
+		//target voice of the command (if any):
+		uint32_t slot = -1U;
+		uint32_t generation = 0;
+		//sample (or stream + epoch) to start playing (Play):
+		Sound::Sample const *sample = nullptr;
+		Sound::Stream::Decoder *stream = nullptr;
+		uint32_t stream_epoch = 0;
+		bool loop = false;
+		uint64_t start_frame = 0; //(Play) audio frame to start on; 0 (or any frame already mixed) means "as soon as possible"
+		float pan = 0.0f; //(Play; NaN for 3D samples)
+		float half_volume_radius = 0.0f; //(Play)
+		glm::vec3 vector = glm::vec3(0.0f); //position (Play, SetPosition, SetListener)
+		glm::vec3 right = glm::vec3(0.0f); //listener right vector (SetListener)
+		float value = 0.0f; //volume, pan, or radius
+		float ramp = 0.0f;
+		Sound::Bus bus = Sound::Bus::SFX; //(Play, SetBus, SetBusVolume, AddEffect, RemoveEffect)
+		Sound::Effect *effect = nullptr; //(AddEffect, RemoveEffect)
+		Capture *capture = nullptr; //(SetCapture; null to stop capturing)
+	};
+
+	//single-producer (game thread) / single-consumer (mix_block) queue of commands:
+	RingBuffer< Command > commands(1024);
+	//commands pushed to the queue (game thread only) and applied by the mixer, so the game thread can wait for the mixer to catch up:
+	uint64_t commands_sent = 0;
+	std::atomic< uint64_t > commands_applied{0};
 
 }
 
+//Streams are decoded into a ring buffer by a background thread:
+struct Sound::Stream::Decoder {
+	Decoder(std::string const &filename) : reader(filename), buffer(STREAM_BUFFER_SAMPLES) {
+		thread = std::thread(&Decoder::run, this);
+	}
+	~Decoder() {
+		quit.store(true);
+		thread.join();
+	}
+
+	//background thread body:
+	void run();
+
+	OpusReader reader; //(only used by the decoding thread)
+	RingBuffer< float > buffer; //decoded audio: produced by decoding thread, consumed by mixer
+
+	//Every play() of a stream starts a new "epoch" -- the decoder rewinds the file and
+	// records where in 'buffer' the new epoch's audio begins:
+	std::atomic< uint32_t > requested_epoch{0}; //set by game thread
+	std::atomic< bool > loop{false}; //set by game thread (before requesting an epoch)
+	std::atomic< uint32_t > start_position{0}; //set by decoding thread (before publishing ready_epoch)
+	std::atomic< uint32_t > ready_epoch{0}; //set by decoding thread
+	std::atomic< uint32_t > finished_epoch{0}; //set by decoding thread after the last audio of a non-looping epoch is in 'buffer'
+
+	std::atomic< bool > quit{false};
+	std::thread thread;
+};
+
 //public-facing data:
 
 //global volume control:
@@ -33,27 +362,246 @@ Sound::Ramp< float > Sound::volume = Sound::Ramp< float >(1.0f);
 //global listener information:
 Sound::Listener Sound::listener;
 
-//This audio-mixing callback is defined below:
+//This function mixes one block of mix_samples stereo frames, and is defined below:
+void mix_block(float *buffer);
+
+//These functions mix (or advance, if it is virtual) one voice into a block, and are defined below;
+// sample voices are mixed from a copy of their state (so can be mixed on any thread), streams in place:
+VoiceMix voice_mix(uint32_t slot, bool mix);
+void mix_voice(VoiceMix const &voice, uint64_t block_start, float *buffer, VoiceMixed *mixed);
+bool voice_mixed(uint32_t slot, VoiceMixed const &mixed); //(returns true if the voice has finished playing)
+bool mix_stream_voice(uint32_t slot, bool mix, uint64_t block_start, float *buffer);
+//...and this one hands parallel_mix voices to mix_voice on worker threads:
+void mix_voices_job(void *context, uint32_t begin, uint32_t end, uint32_t thread);
+
+//Helper for mix_voice that gets a sample's data as floats (decoding compressed formats into 'scratch'):
+float const *sample_span(Sound::Sample const &sample, ADPCMDecoder *adpcm, uint32_t from, uint32_t count, float *scratch);
+
+//This audio-mixing callback (for the SDL backend) is defined below:
 void mix_audio(void *, Uint8 *buffer_, int len);
 
+//Commands are executed (on the mixer thread) by this function, also defined below:
+void apply_command(Command &command);
+
+//helper: hand a command to the mixer.
+void send_command(Command &&command) {
+	if (!mixer_thread()) {
+		//no audio thread (offline rendering, or audio failed to start), so no need to queue:
+		apply_command(command);
+		return;
+	}
+	//the mixer drains the queue every block, so if it is full just wait for some room:
+	// (this only ever stalls the game thread, never the audio callback)
+	while (!commands.push(std::move(command))) {
+		std::this_thread::yield();
+	}
+	commands_sent += 1;
+}
+
+//helper: wait until the mixer has applied every command sent so far.
+void wait_for_commands() {
+	if (!mixer_thread()) return; //(commands were applied as they were sent)
+	while (commands_applied.load(std::memory_order_acquire) < commands_sent) {
+		std::this_thread::yield();
+	}
+}
+
 //------------------------ public-facing --------------------------------
 
-Sound::Sample::Sample(std::string const &filename) {
-	if (filename.size() >= 4 && filename.substr(filename.size()-4) == ".wav") {
-		load_wav(filename, &data);
-	} else if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".opus") {
-		load_opus(filename, &data);
-	} else {
+Sound::Sample::Sample(std::string const &filename, Format format_) : format(format_) {
+	bool wav = (filename.size() >= 4 && filename.substr(filename.size()-4) == ".wav");
+	bool opus = (filename.size() >= 5 && filename.substr(filename.size()-5) == ".opus");
+	if (!wav && !opus) {
 		throw std::runtime_error("Sample '" + filename + "' doesn't end in either \".png\" or \".opus\" -- unsure how to load.");
 	}
+
+	//decoded data is cached on disk, so (unless the file has changed) it can just be mapped:
+	// (entries are named by format and by the version of the loader that converted them)
+	static char const *Variants[3] = { "f32", "i16", "adpcm" };
+	std::string variant = Variants[int(format)];
+	if (wav) variant += "-wav" + std::to_string(LoadWavVersion);
+	else variant += "-opus" + std::to_string(LoadOpusVersion);
+	std::string entry = sample_cache_entry(filename, variant);
+	if (std::shared_ptr< MappedFile const > cached = sample_cache_open(entry)) {
+		size_t offset = 0;
+		void const *header = nullptr, *samples = nullptr;
+		uint32_t header_size = 0, samples_size = 0;
+		if (cached->chunk(&offset, "smp0", &header, &header_size) && header_size == sizeof(uint32_t)
+		 && cached->chunk(&offset, "dat0", &samples, &samples_size)) {
+			length = *static_cast< uint32_t const * >(header);
+			if (samples_size == bytes()) {
+				cached->touch(); //(the mixer shouldn't be the one to page in sample data)
+				mapped = cached;
+				mapped_data = samples;
+				return;
+			}
+		}
+		std::cerr << "WARNING: ignoring malformed sample cache entry '" << entry << "'." << std::endl;
+		length = 0;
+	}
+
+	if (format == Format::Float32) {
+		if (wav) load_wav(filename, &data);
+		else load_opus(filename, &data);
+		length = uint32_t(data.size());
+	} else {
+		//Int16 and ADPCM both load as 16-bit PCM (ADPCM then compresses that):
+		if (wav) load_wav(filename, &data_int16);
+		else load_opus(filename, &data_int16);
+		length = uint32_t(data_int16.size());
+		if (format == Format::ADPCM) {
+			adpcm_encode(data_int16.data(), length, &data_adpcm);
+			data_int16 = std::vector< int16_t >();
+		}
+	}
+
+	sample_cache_store(entry, [this](std::ostream &out) {
+		write_chunk("smp0", std::vector< uint32_t >{ length }, &out);
+		if (format == Format::Float32) write_chunk("dat0", data, &out);
+		else if (format == Format::Int16) write_chunk("dat0", data_int16, &out);
+		else write_chunk("dat0", data_adpcm, &out);
+	});
 }
 
-Sound::Sample::Sample(std::vector< float > const &data_) : data(data_) {
+Sound::Sample::Sample(std::vector< float > const &data_, Format format_) : format(format_), length(uint32_t(data_.size())) {
+	if (format == Format::Float32) {
+		data = data_;
+	} else {
+		std::vector< int16_t > pcm(data_.size());
+		for (size_t i = 0; i < data_.size(); ++i) {
+			pcm[i] = int16_t(std::lround(std::max(-1.0f, std::min(1.0f, data_[i])) * 32767.0f));
+		}
+		if (format == Format::Int16) {
+			data_int16 = std::move(pcm);
+		} else {
+			adpcm_encode(pcm.data(), length, &data_adpcm);
+		}
+	}
 }
 
+size_t Sound::Sample::bytes() const {
+	if (format == Format::Float32) return size_t(length) * sizeof(float);
+	else if (format == Format::Int16) return size_t(length) * sizeof(int16_t);
+	else return (size_t(length) + ADPCMBlockSamples - 1) / ADPCMBlockSamples * ADPCMBlockBytes;
+}
 
+Sound::Stream::Stream(std::string const &filename) {
+	if (!(filename.size() >= 5 && filename.substr(filename.size()-5) == ".opus")) {
+		throw std::runtime_error("Stream '" + filename + "' doesn't end in \".opus\" -- only opus files can be streamed.");
+	}
+	decoder = std::make_unique< Decoder >(filename);
+}
+
+Sound::Stream::~Stream() {
+}
+
+void Sound::Stream::Decoder::run() {
+	uint32_t epoch = 0;
+	bool decoding = false; //false until first play(), and after the end of a non-looping epoch
+	try {
+		while (!quit.load()) {
+			//restart if the stream has been played again:
+			uint32_t requested = requested_epoch.load(std::memory_order_acquire);
+			if (requested != epoch) {
+				epoch = requested;
+				reader.rewind();
+				//mixer will skip any audio from the old epoch:
+				start_position.store(buffer.write_position(), std::memory_order_relaxed);
+				ready_epoch.store(epoch, std::memory_order_release);
+				decoding = true;
+			}
+
+			float *span = nullptr;
+			uint32_t space = (decoding ? buffer.write_span(&span) : 0);
+			if (space == 0) {
+				//nothing to do for now; buffer holds enough audio that a short nap is fine:
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+				continue;
+			}
+
+			uint32_t decoded = reader.read(span, space);
+			if (decoded == 0) {
+				//end of file:
+				if (loop.load()) {
+					reader.rewind();
+				} else {
+					finished_epoch.store(epoch, std::memory_order_release);
+					decoding = false;
+				}
+				continue;
+			}
+			buffer.commit(decoded);
+		}
+	} catch (std::exception &e) {
+		std::cerr << "Error while streaming '" << reader.filename << "': " << e.what() << std::endl;
+		//mark stream as done, so any voice playing it will finish:
+		finished_epoch.store(epoch, std::memory_order_release);
+	}
+}
+
+
+
+void Sound::init(Backend backend_, uint32_t block_size, uint32_t mix_threads) {
+	backend = backend_;
+
+	//block size must be a power of two (for SDL) in [MinBlockSize, MaxBlockSize]:
+	mix_samples = MinBlockSize;
+	while (mix_samples < block_size && mix_samples < MaxBlockSize) mix_samples *= 2;
+	if (mix_samples != block_size) {
+		std::cerr << "WARNING: audio block size " << block_size << " is not a power of two in [" << MinBlockSize << ", " << MaxBlockSize << "]; using " << mix_samples << " instead." << std::endl;
+	}
+	mix_seconds = float(mix_samples) / float(AUDIO_RATE);
+
+	buses.buffer.assign(BusCount * mix_samples * 2, 0.0f);
+	buses.volume.fill(Ramp< float >(1.0f));
+
+	if (mix_threads > 0) {
+		mix_pool.reset(new WorkerPool(mix_threads, (MaxVoices + PARALLEL_CHUNK_VOICES - 1) / PARALLEL_CHUNK_VOICES, true));
+		mix_outputs.clear();
+		for (uint32_t t = 0; t <= mix_threads; ++t) {
+			mix_outputs.emplace_back(new MixOutput);
+			if (t != 0) mix_outputs.back()->buffer.assign(BusCount * mix_samples * 2, 0.0f);
+		}
+	}
+
+	//all voices start out free:
+	// (done before any mixing thread exists, so it's fine for this thread to act as the producer here)
+	for (uint32_t slot = 0; slot < MaxVoices; ++slot) {
+		bool pushed = free_slots.push(uint32_t(slot));
+		assert(pushed);
+		(void)pushed;
+	}
+
+	if (backend == Backend::Null) {
+		//mix on a timer thread, throwing away the output:
+		null_quit.store(false);
+		null_thread = std::thread([](){
+			std::vector< float > discard(mix_samples * 2);
+			auto const period = std::chrono::duration< double >(double(mix_samples) / double(AUDIO_RATE));
+			auto next = std::chrono::steady_clock::now();
+			while (!null_quit.load()) {
+				{
+					std::lock_guard< std::mutex > guard(null_mutex);
+					mix_block(discard.data());
+				}
+				next += std::chrono::duration_cast< std::chrono::steady_clock::duration >(period);
+				std::this_thread::sleep_until(next);
+			}
+		});
+		std::cout << "Audio output initialized (null backend; using " << mix_kernels_variant() << " mixing; " << mix_samples << "-frame blocks)." << std::endl;
+		return;
+	}
+
+	if (backend == Backend::Offline) {
+		//mixing happens in Sound::render():
+		offline_block.assign(mix_samples * 2, 0.0f);
+		offline_used = mix_samples;
+		std::cout << "Audio output initialized (offline backend; using " << mix_kernels_variant() << " mixing; " << mix_samples << "-frame blocks)." << std::endl;
+		return;
+	}
+
+	assert(backend == Backend::SDL);
 
-void Sound::init() {
 	if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
 		std::cerr << "Failed to initialize SDL audio subsytem:\n" << SDL_GetError() << std::endl;
 		std::cerr << "  (Will continue without audio.)\n" << std::endl;
@@ -66,7 +614,7 @@ void Sound::init() {
 	want.freq = AUDIO_RATE;
 	want.format = AUDIO_F32SYS;
 	want.channels = 2;
-	want.samples = MIX_SAMPLES;
+	want.samples = mix_samples;
 	want.callback = mix_audio;
 
 	device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
@@ -74,135 +622,747 @@ void Sound::init() {
 		std::cerr << "Failed to open audio device:\n" << SDL_GetError() << std::endl;
 		std::cerr << "  (Will continue without audio.)\n" << std::endl;
 	} else {
+		//a freshly mixed block plays after the one in the device's buffer:
+		output_latency = float(have.samples) / float(have.freq);
+
 		//start audio playback:
 		SDL_PauseAudioDevice(device, 0);
-		std::cout << "Audio output initialized." << std::endl;
+		std::cout << "Audio output initialized (using " << mix_kernels_variant() << " mixing; " << mix_samples << "-frame blocks)." << std::endl;
 	}
 }
 
 
 void Sound::shutdown() {
+	stop_capture();
 	if (device != 0) {
 		//stop audio playback:
 		SDL_PauseAudioDevice(device, 1);
 		SDL_CloseAudioDevice(device);
 		device = 0;
 	}
+	if (null_thread.joinable()) {
+		null_quit.store(true);
+		null_thread.join();
+	}
+	mix_pool.reset();
+	mix_outputs.clear();
+}
+
+void Sound::render(uint32_t frames, float *out) {
+	assert(backend == Backend::Offline && "Sound::render() only works with the offline backend");
+	assert(out || frames == 0);
+	assert(offline_block.size() == mix_samples * 2 && "call Sound::init(Sound::Backend::Offline) first");
+
+	//hand out frames from the current block, mixing a new one whenever it runs out:
+	while (frames > 0) {
+		if (offline_used == mix_samples) {
+			//n.b. streams are decoded on their own threads, so wait until each one has a full block
+			// ready (or has ended) -- otherwise the output would depend on thread timing:
+			for (uint32_t a = 0; a < voices.active_count; ++a) {
+				uint32_t slot = voices.active[a];
+				if (!voices.stream[slot]) continue;
+				Sound::Stream::Decoder &decoder = *voices.stream[slot];
+				uint32_t epoch = voices.stream_epoch[slot];
+				if (decoder.requested_epoch.load(std::memory_order_relaxed) != epoch) continue; //stream was played again by another voice
+				while (decoder.ready_epoch.load(std::memory_order_acquire) != epoch) {
+					std::this_thread::yield();
+				}
+				if (!voices.stream_synced[slot]) {
+					//(same as in mix_block; done early so old audio can't keep the decoder from writing)
+					decoder.buffer.skip_to(decoder.start_position.load(std::memory_order_relaxed));
+					voices.stream_synced[slot] = true;
+				}
+				while (decoder.finished_epoch.load(std::memory_order_acquire) != epoch
+				    && decoder.buffer.size() < mix_samples) {
+					std::this_thread::yield();
+				}
+			}
+			mix_block(offline_block.data());
+			offline_used = 0;
+		}
+		uint32_t count = std::min(frames, mix_samples - offline_used);
+		std::copy(offline_block.begin() + 2 * offline_used, offline_block.begin() + 2 * (offline_used + count), out);
+		out += 2 * count;
+		frames -= count;
+		offline_used += count;
+	}
 }
 
 
 void Sound::lock() {
 	if (device) SDL_LockAudioDevice(device);
+	if (null_thread.joinable()) null_mutex.lock();
 }
 
 void Sound::unlock() {
 	if (device) SDL_UnlockAudioDevice(device);
+	if (null_thread.joinable()) null_mutex.unlock();
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::play(Sample const &sample, float play_volume, float pan) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, pan, false);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
+//helper: start a voice playing (fills in the slot and generation of the Play command):
+Sound::PlayingSample start_voice(Command &&command) {
+	assert(command.type == Command::Play);
+
+	uint32_t slot;
+	if (!free_slots.pop(&slot)) {
+		//every voice is busy:
+		return Sound::PlayingSample();
+	}
+	assert(slot < Sound::MaxVoices);
+	slot_generations[slot] += 1;
+
+	command.slot = slot;
+	command.generation = slot_generations[slot];
+	send_command(std::move(command));
+
+	Sound::PlayingSample playing_sample;
+	playing_sample.slot = slot;
+	playing_sample.generation = slot_generations[slot];
 	return playing_sample;
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::play_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, position, half_volume_radius, false);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+//helper: start a sample playing.
+Sound::PlayingSample start_sample(Sound::Sample const &sample, float play_volume, float pan, glm::vec3 const &position, float half_volume_radius, bool loop, uint64_t start_frame = 0) {
+	if (sample.length == 0) {
+		//nothing to play:
+		return Sound::PlayingSample();
+	}
+
+	Command command;
+	command.type = Command::Play;
+	command.sample = &sample;
+	command.loop = loop;
+	command.start_frame = start_frame;
+	command.value = play_volume;
+	command.pan = pan;
+	command.vector = position;
+	command.half_volume_radius = half_volume_radius;
+	command.bus = sample.bus;
+	return start_voice(std::move(command));
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::loop(Sample const &sample, float play_volume, float pan) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, pan, true);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+//helper: start a stream playing.
+Sound::PlayingSample start_stream(Sound::Stream const &stream, float play_volume, float pan, bool loop) {
+	assert(stream.decoder);
+	Sound::Stream::Decoder &decoder = *stream.decoder;
+
+	//ask the decoding thread to (re-)start the stream:
+	decoder.loop.store(loop);
+	uint32_t epoch = decoder.requested_epoch.load(std::memory_order_relaxed) + 1;
+	decoder.requested_epoch.store(epoch, std::memory_order_release);
+
+	Command command;
+	command.type = Command::Play;
+	command.stream = &decoder;
+	command.stream_epoch = epoch;
+	command.loop = loop;
+	command.value = play_volume;
+	command.pan = pan;
+	command.bus = stream.bus;
+	return start_voice(std::move(command));
+}
+
+Sound::PlayingSample Sound::play(Sample const &sample, float play_volume, float pan) {
+	return start_sample(sample, play_volume, pan, glm::vec3(0.0f), 0.0f, false);
 }
 
+Sound::PlayingSample Sound::play_at(Sample const &sample, uint64_t frame, float play_volume, float pan) {
+	return start_sample(sample, play_volume, pan, glm::vec3(0.0f), 0.0f, false, frame);
+}
 
+Sound::PlayingSample Sound::play_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
+	return start_sample(sample, play_volume, std::numeric_limits< float >::quiet_NaN(), position, half_volume_radius, false);
+}
 
-std::shared_ptr< Sound::PlayingSample > Sound::loop_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, position, half_volume_radius, true);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+Sound::PlayingSample Sound::loop(Sample const &sample, float play_volume, float pan) {
+	return start_sample(sample, play_volume, pan, glm::vec3(0.0f), 0.0f, true);
 }
 
+Sound::PlayingSample Sound::loop_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
+	return start_sample(sample, play_volume, std::numeric_limits< float >::quiet_NaN(), position, half_volume_radius, true);
+}
 
-void Sound::stop_all_samples() {
-	lock();
-	for (auto &s : playing_samples) {
-		s->stop();
+Sound::PlayingSample Sound::play(Stream const &stream, float play_volume, float pan) {
+	return start_stream(stream, play_volume, pan, false);
+}
+
+Sound::PlayingSample Sound::loop(Stream const &stream, float play_volume, float pan) {
+	return start_stream(stream, play_volume, pan, true);
+}
+
+
+Sound::Clock Sound::now() {
+	//read the most recently published frame count and time:
+	uint64_t frame;
+	int64_t time;
+	while (true) {
+		uint32_t before = clock_sequence.load(std::memory_order_acquire);
+		frame = clock_frame.load(std::memory_order_relaxed);
+		time = clock_time.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint32_t after = clock_sequence.load(std::memory_order_relaxed);
+		if (before == after && (before & 1) == 0) break;
+		std::this_thread::yield(); //mixer is in the middle of publishing
+	}
+
+	Clock clock;
+	clock.frame = frame;
+	clock.latency = output_latency;
+
+	if (backend == Backend::Offline) {
+		//"heard" is just as far as render() has handed out:
+		clock.heard = double(frame) - double(mix_samples - offline_used);
+	} else if (time != 0) {
+		//the block ending at 'frame' was mixed at 'time', so started playing about 'latency' after that:
+		double since = std::chrono::duration< double >(std::chrono::steady_clock::now().time_since_epoch() - std::chrono::nanoseconds(time)).count();
+		clock.heard = double(frame) - double(mix_samples) + (since - double(output_latency)) * double(AUDIO_RATE);
+		clock.heard = std::max(0.0, std::min(clock.heard, double(frame)));
+	}
+	return clock;
+}
+
+
+//helper: read one block's stats from the ring; returns false if that block's slot has been (or is being) reused:
+bool read_block_stats(uint64_t block, Sound::BlockStats *out) {
+	StatsSlot const &slot = stats_slots[block % Sound::StatsHistory];
+	uint32_t before = slot.sequence.load(std::memory_order_acquire);
+	if (before & 1) return false; //mixer is writing it
+	if (slot.block.load(std::memory_order_relaxed) != block) return false;
+	out->frame = slot.frame.load(std::memory_order_relaxed);
+	out->mix_time = slot.mix_time.load(std::memory_order_relaxed);
+	out->load = slot.load.load(std::memory_order_relaxed);
+	out->interval = slot.interval.load(std::memory_order_relaxed);
+	out->active_voices = slot.active_voices.load(std::memory_order_relaxed);
+	out->real_voices = slot.real_voices.load(std::memory_order_relaxed);
+	out->peak = slot.peak.load(std::memory_order_relaxed);
+	out->rms = slot.rms.load(std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return slot.sequence.load(std::memory_order_relaxed) == before;
+}
+
+Sound::Stats Sound::stats() {
+	Stats stats;
+	stats.blocks = stats_blocks.load(std::memory_order_acquire);
+	stats.overruns = stats_overruns.load(std::memory_order_relaxed);
+	stats.late_blocks = stats_late_blocks.load(std::memory_order_relaxed);
+	stats.clipped_blocks = stats_clipped_blocks.load(std::memory_order_relaxed);
+	stats.max_load = stats_max_load.load(std::memory_order_relaxed);
+	stats.capture_dropped_blocks = capture_dropped_blocks.load(std::memory_order_relaxed);
+	if (stats.blocks > 0) read_block_stats(stats.blocks - 1, &stats.last);
+	return stats;
+}
+
+uint32_t Sound::stats_history(BlockStats *out, uint32_t count) {
+	assert(out || count == 0);
+	uint64_t end = stats_blocks.load(std::memory_order_acquire);
+	//(leave the oldest slot alone -- it's the next one the mixer will write)
+	uint64_t available = std::min< uint64_t >(end, StatsHistory - 1);
+	uint64_t begin = end - std::min< uint64_t >(available, count);
+	uint32_t copied = 0;
+	for (uint64_t block = begin; block < end; ++block) {
+		if (read_block_stats(block, out + copied)) copied += 1;
+	}
+	return copied;
+}
+
+void Sound::write_stats_csv(std::ostream &out) {
+	std::vector< BlockStats > history(StatsHistory);
+	history.resize(stats_history(history.data(), uint32_t(history.size())));
+	out << "frame,mix_time_us,load,interval_us,active_voices,real_voices,peak,rms\n";
+	for (auto const &block : history) {
+		out << block.frame
+			<< ',' << block.mix_time * 1.0e6f
+			<< ',' << block.load
+			<< ',' << block.interval * 1.0e6f
+			<< ',' << block.active_voices
+			<< ',' << block.real_voices
+			<< ',' << block.peak
+			<< ',' << block.rms
+			<< '\n';
+	}
+}
+
+//------------------
+
+Capture::Capture(std::string const &filename) : file_buffer(1 << 20), buffer(CAPTURE_BUFFER_SAMPLES) {
+	file.open(filename, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("Failed to open '" + filename + "' for writing.");
+	}
+	//(set after open() and before any write, since some implementations -- e.g., MSVC's -- ignore a buffer set on a closed file)
+	file.rdbuf()->pubsetbuf(file_buffer.data(), std::streamsize(file_buffer.size()));
+	//header with placeholder sizes (filled in by the destructor):
+	std::vector< char > header(CAPTURE_WAV_HEADER_BYTES, 0);
+	file.write(header.data(), header.size());
+	thread = std::thread(&Capture::run, this);
+}
+
+Capture::~Capture() {
+	quit.store(true);
+	thread.join();
+
+	//fill in the header now that the length is known:
+	uint32_t data_bytes = uint32_t(written * sizeof(float));
+	uint8_t header[CAPTURE_WAV_HEADER_BYTES];
+	uint32_t at = 0;
+	auto tag = [&](char const *fourcc) { std::memcpy(header + at, fourcc, 4); at += 4; };
+	auto u16 = [&](uint32_t v) { header[at++] = uint8_t(v); header[at++] = uint8_t(v >> 8); };
+	auto u32 = [&](uint32_t v) { u16(v & 0xffff); u16(v >> 16); };
+	tag("RIFF"); u32(CAPTURE_WAV_HEADER_BYTES - 8 + data_bytes); tag("WAVE");
+	tag("fmt "); u32(18);
+	u16(3); //WAVE_FORMAT_IEEE_FLOAT
+	u16(2); //channels
+	u32(AUDIO_RATE); u32(AUDIO_RATE * 2 * sizeof(float)); //frames / second, bytes / second
+	u16(2 * sizeof(float)); u16(32); //bytes / frame, bits / value
+	u16(0); //(no extension)
+	tag("fact"); u32(4); u32(uint32_t(written / 2)); //frames
+	tag("data"); u32(data_bytes);
+	assert(at == CAPTURE_WAV_HEADER_BYTES);
+
+	file.seekp(0);
+	file.write(reinterpret_cast< char const * >(header), sizeof(header));
+	file.close();
+	if (!file) {
+		std::cerr << "WARNING: failed to finish writing audio capture." << std::endl;
 	}
-	unlock();
+}
+
+void Capture::run() {
+	while (true) {
+		//(check before draining, so everything mixed before quit was set gets written)
+		bool quitting = quit.load();
+		float const *span;
+		while (uint32_t count = buffer.read_span(&span)) {
+			file.write(reinterpret_cast< char const * >(span), std::streamsize(count * sizeof(float)));
+			buffer.consume(count);
+			written += count;
+		}
+		if (quitting) break;
+		//the mixer doesn't signal (that could block it), so just check back regularly;
+		// the ring holds much longer than this:
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+}
+
+bool Sound::start_capture(std::string const &filename) {
+	stop_capture();
+	try {
+		capture_owner.reset(new Capture(filename));
+	} catch (std::exception &e) {
+		std::cerr << "WARNING: can't capture audio: " << e.what() << std::endl;
+		return false;
+	}
+	Command command;
+	command.type = Command::SetCapture;
+	command.capture = capture_owner.get();
+	send_command(std::move(command));
+	std::cout << "Capturing audio to '" << filename << "'." << std::endl;
+	return true;
+}
+
+void Sound::stop_capture() {
+	if (!capture_owner) return;
+	Command command;
+	command.type = Command::SetCapture;
+	command.capture = nullptr;
+	send_command(std::move(command));
+	//once the mixer has let go of the capture, it can finish up:
+	wait_for_commands();
+	capture_owner.reset();
+}
+
+void Sound::stop_all_samples() {
+	Command command;
+	command.type = Command::StopAll;
+	send_command(std::move(command));
 }
 
 void Sound::set_volume(float new_volume, float ramp) {
-	lock();
-	volume.set(new_volume, ramp);
-	unlock();
+	Command command;
+	command.type = Command::SetGlobalVolume;
+	command.value = new_volume;
+	command.ramp = ramp;
+	send_command(std::move(command));
+}
+
+Sound::Level Sound::master_level() {
+	return output_level.load();
+}
+
+void Sound::set_bus_volume(Bus bus, float new_volume, float ramp) {
+	if (bus == Bus::Master) {
+		set_volume(new_volume, ramp);
+		return;
+	}
+	Command command;
+	command.type = Command::SetBusVolume;
+	command.bus = bus;
+	command.value = new_volume;
+	command.ramp = ramp;
+	send_command(std::move(command));
+}
+
+void Sound::add_effect(Bus bus, Effect *effect) {
+	assert(effect);
+	Command command;
+	command.type = Command::AddEffect;
+	command.bus = bus;
+	command.effect = effect;
+	send_command(std::move(command));
+}
+
+void Sound::remove_effect(Bus bus, Effect *effect) {
+	assert(effect);
+	Command command;
+	command.type = Command::RemoveEffect;
+	command.bus = bus;
+	command.effect = effect;
+	send_command(std::move(command));
+	//(commands are applied between blocks, so once this one is, process() won't be called again)
+	wait_for_commands();
 }
 
 //------------------
 
-void Sound::PlayingSample::set_volume(float new_volume, float ramp) {
-	Sound::lock();
-	if (!stopping) {
-		volume.set(new_volume, ramp);
+Sound::Biquad::Biquad(Type type_, float frequency_, float q_, float gain_db_)
+	: type(type_), frequency(frequency_), q(q_), gain_db(gain_db_), coefficients(new ::BiquadCoefficients) {
+}
+
+Sound::Biquad::~Biquad() {
+}
+
+void Sound::Biquad::process(float *buffer, uint32_t frames) {
+	//redesign the filter if the parameters have changed:
+	Type new_type = type.load(std::memory_order_relaxed);
+	float new_frequency = std::max(10.0f, std::min(0.45f * float(AUDIO_RATE), frequency.load(std::memory_order_relaxed)));
+	float new_q = std::max(0.05f, q.load(std::memory_order_relaxed));
+	float new_gain_db = gain_db.load(std::memory_order_relaxed);
+	if (new_type != computed_type || new_frequency != computed_frequency || new_q != computed_q || new_gain_db != computed_gain_db) {
+		computed_type = new_type;
+		computed_frequency = new_frequency;
+		computed_q = new_q;
+		computed_gain_db = new_gain_db;
+
+		float w0 = 2.0f * 3.1415926f * new_frequency / float(AUDIO_RATE);
+		float cos_w0 = std::cos(w0);
+		float alpha = std::sin(w0) / (2.0f * new_q);
+		float b0, b1, b2, a0, a1, a2;
+		if (new_type == LowPass) {
+			b0 = 0.5f * (1.0f - cos_w0); b1 = 1.0f - cos_w0; b2 = 0.5f * (1.0f - cos_w0);
+			a0 = 1.0f + alpha; a1 = -2.0f * cos_w0; a2 = 1.0f - alpha;
+		} else if (new_type == HighPass) {
+			b0 = 0.5f * (1.0f + cos_w0); b1 = -(1.0f + cos_w0); b2 = 0.5f * (1.0f + cos_w0);
+			a0 = 1.0f + alpha; a1 = -2.0f * cos_w0; a2 = 1.0f - alpha;
+		} else {
+			assert(new_type == Peak);
+			float A = std::pow(10.0f, new_gain_db / 40.0f);
+			b0 = 1.0f + alpha * A; b1 = -2.0f * cos_w0; b2 = 1.0f - alpha * A;
+			a0 = 1.0f + alpha / A; a1 = -2.0f * cos_w0; a2 = 1.0f - alpha / A;
+		}
+		compute_biquad_coefficients(b0 / a0, b1 / a0, b2 / a0, a1 / a0, a2 / a0, coefficients.get());
+	}
+
+	biquad_stereo(buffer, frames, *coefficients, state);
+
+	//(a decaying filter would otherwise end up computing with denormals, which are very slow)
+	for (auto &s : state) {
+		if (std::abs(s) < 1.0e-20f) s = 0.0f;
+	}
+}
+
+void Sound::Biquad::reset() {
+	std::fill(std::begin(state), std::end(state), 0.0f);
+	computed_frequency = 0.0f; //(forces the coefficients to be recomputed)
+}
+
+//------------------
+
+Sound::Compressor::Compressor(float threshold_db_, float ratio_, float attack_, float release_, float makeup_db_)
+	: threshold_db(threshold_db_), ratio(ratio_), attack(attack_), release(release_), makeup_db(makeup_db_) {
+}
+
+void Sound::Compressor::process(float *buffer, uint32_t frames) {
+	//frames per gain update:
+	constexpr uint32_t const Step = 16;
+
+	float threshold = threshold_db.load(std::memory_order_relaxed);
+	float slope = 1.0f - 1.0f / std::max(1.0f, ratio.load(std::memory_order_relaxed)); //dB of reduction per dB over threshold
+	float makeup = makeup_db.load(std::memory_order_relaxed);
+	//envelope follows the peak level by this much per step:
+	float attack_coef = std::exp(-float(Step) / (std::max(1.0e-4f, attack.load(std::memory_order_relaxed)) * float(AUDIO_RATE)));
+	float release_coef = std::exp(-float(Step) / (std::max(1.0e-4f, release.load(std::memory_order_relaxed)) * float(AUDIO_RATE)));
+
+	for (uint32_t begin = 0; begin < frames; begin += Step) {
+		uint32_t count = std::min(Step, frames - begin);
+		float *at = buffer + 2 * begin;
+
+		float peak = peak_abs(at, 2 * count);
+		float coef = (peak > envelope ? attack_coef : release_coef);
+		envelope = peak + coef * (envelope - peak);
+
+		float level_db = 20.0f * std::log10(std::max(envelope, 1.0e-6f));
+		float reduction_db = std::max(0.0f, level_db - threshold) * slope;
+		float target = std::pow(10.0f, (makeup - reduction_db) / 20.0f);
+
+		scale_stereo(at, count, gain, (target - gain) / count);
+		gain = target;
+	}
+}
+
+void Sound::Compressor::reset() {
+	envelope = 0.0f;
+	gain = std::pow(10.0f, makeup_db.load(std::memory_order_relaxed) / 20.0f);
+}
+
+//------------------
+
+struct Sound::ConvolutionReverb::State {
+	State(std::vector< float > const &left, std::vector< float > const &right);
+
+	uint32_t partition; //frames per partition (== mixer block size)
+	uint32_t partitions; //number of impulse response partitions
+	uint32_t bins; //complex values per spectrum
+	RealFFT fft; //of size 2 * partition (for overlap-save)
+
+	//impulse response partition spectra, 'partitions' * 'bins' per channel (right channel's are empty if it uses left's):
+	std::array< std::vector< float >, 2 > response_re, response_im;
+
+	//per channel: the last two partitions of input, and spectra of recent input (one per impulse response partition):
+	std::array< std::vector< float >, 2 > input;
+	std::array< std::vector< float >, 2 > history_re, history_im;
+	uint32_t newest = 0; //spectrum of most recent input is at history[newest * bins]
+
+	std::vector< float > sum_re, sum_im; //(scratch) output spectrum
+	std::vector< float > output; //(scratch) 2 * partition output values, the second half of which are valid
+
+	uint32_t silent = 0; //partitions of silent input in a row (once the tail has passed, there's nothing to compute)
+	bool bypassed = false;
+};
+
+Sound::ConvolutionReverb::State::State(std::vector< float > const &left, std::vector< float > const &right)
+	: partition(mix_samples), partitions(0), bins(mix_samples + 1), fft(2 * mix_samples) {
+	uint32_t length = uint32_t(std::max(left.size(), right.size()));
+	partitions = std::max(1U, (length + partition - 1) / partition);
+
+	//transform each partition (zero-padded to twice its length, so the convolution doesn't wrap around):
+	std::vector< float > padded(2 * partition);
+	for (uint32_t c = 0; c < 2; ++c) {
+		std::vector< float > const &response = (c == 0 ? left : right);
+		if (c == 1 && right.empty()) break;
+		response_re[c].assign(size_t(partitions) * bins, 0.0f);
+		response_im[c].assign(size_t(partitions) * bins, 0.0f);
+		for (uint32_t p = 0; p < partitions; ++p) {
+			std::fill(padded.begin(), padded.end(), 0.0f);
+			for (uint32_t i = 0; i < partition && p * partition + i < response.size(); ++i) {
+				padded[i] = response[p * partition + i];
+			}
+			fft.forward(padded.data(), &response_re[c][p * bins], &response_im[c][p * bins]);
+		}
+	}
+
+	for (uint32_t c = 0; c < 2; ++c) {
+		input[c].assign(2 * partition, 0.0f);
+		history_re[c].assign(size_t(partitions) * bins, 0.0f);
+		history_im[c].assign(size_t(partitions) * bins, 0.0f);
+	}
+	sum_re.assign(bins, 0.0f);
+	sum_im.assign(bins, 0.0f);
+	output.assign(2 * partition, 0.0f);
+}
+
+Sound::ConvolutionReverb::ConvolutionReverb(std::vector< float > const &left, std::vector< float > const &right, float wet_, float dry_)
+	: wet(wet_), dry(dry_), bypass(false), state(new State(left, right)) {
+}
+
+Sound::ConvolutionReverb::~ConvolutionReverb() {
+}
+
+void Sound::ConvolutionReverb::process(float *buffer, uint32_t frames) {
+	State &st = *state;
+	if (bypass.load(std::memory_order_relaxed)) {
+		st.bypassed = true;
+		return;
+	}
+	if (st.bypassed) {
+		//(history from before the bypass would come back as a stale tail)
+		reset();
+		st.bypassed = false;
+	}
+
+	assert(frames % st.partition == 0 && "reverb partitions are the mixer's block size");
+	float wet_level = wet.load(std::memory_order_relaxed);
+	float dry_level = dry.load(std::memory_order_relaxed);
+	uint32_t const L = st.partition;
+
+	for (uint32_t begin = 0; begin < frames; begin += L) {
+		float *at = buffer + 2 * begin;
+
+		//once the input has been silent long enough for the whole history to be silent, so is the output:
+		if (peak_abs(at, 2 * L) == 0.0f) {
+			if (st.silent > st.partitions) continue;
+			st.silent += 1;
+		} else {
+			st.silent = 0;
+		}
+
+		st.newest = (st.newest + 1) % st.partitions;
+		for (uint32_t c = 0; c < 2; ++c) {
+			//slide the input along by a partition, and transform the last two partitions' worth:
+			float *input = st.input[c].data();
+			std::copy(input + L, input + 2 * L, input);
+			for (uint32_t i = 0; i < L; ++i) {
+				input[L + i] = at[2 * i + c];
+			}
+			float *newest_re = &st.history_re[c][st.newest * st.bins];
+			float *newest_im = &st.history_im[c][st.newest * st.bins];
+			st.fft.forward(input, newest_re, newest_im);
+
+			//input spectrum from p partitions ago times impulse response partition p:
+			uint32_t r = (st.response_re[c].empty() ? 0 : c);
+			std::fill(st.sum_re.begin(), st.sum_re.end(), 0.0f);
+			std::fill(st.sum_im.begin(), st.sum_im.end(), 0.0f);
+			for (uint32_t p = 0; p < st.partitions; ++p) {
+				uint32_t h = (st.newest + st.partitions - p) % st.partitions;
+				complex_multiply_add(st.sum_re.data(), st.sum_im.data(),
+					&st.history_re[c][h * st.bins], &st.history_im[c][h * st.bins],
+					&st.response_re[r][p * st.bins], &st.response_im[r][p * st.bins],
+					st.bins);
+			}
+
+			//(overlap-save: the first half of the result has wrapped around, the second half is this partition's output)
+			st.fft.inverse(st.sum_re.data(), st.sum_im.data(), st.output.data());
+			for (uint32_t i = 0; i < L; ++i) {
+				at[2 * i + c] = dry_level * input[L + i] + wet_level * st.output[L + i];
+			}
+		}
+	}
+}
+
+void Sound::ConvolutionReverb::reset() {
+	State &st = *state;
+	for (uint32_t c = 0; c < 2; ++c) {
+		std::fill(st.input[c].begin(), st.input[c].end(), 0.0f);
+		std::fill(st.history_re[c].begin(), st.history_re[c].end(), 0.0f);
+		std::fill(st.history_im[c].begin(), st.history_im[c].end(), 0.0f);
 	}
-	Sound::unlock();
+	st.silent = 0;
+}
+
+//------------------
+
+uint32_t Sound::block_size() {
+	return mix_samples;
+}
+
+void Sound::set_real_voice_budget(uint32_t budget) {
+	Command command;
+	command.type = Command::SetRealVoiceBudget;
+	command.slot = budget;
+	send_command(std::move(command));
+}
+
+//------------------
+
+void Sound::PlayingSample::set_volume(float new_volume, float ramp) {
+	if (slot == -1U) return; //empty handle
+	Command command;
+	command.type = Command::SetVolume;
+	command.slot = slot;
+	command.generation = generation;
+	command.value = new_volume;
+	command.ramp = ramp;
+	send_command(std::move(command));
 }
 
 void Sound::PlayingSample::set_pan(float new_pan, float ramp) {
-	if (!(pan.value == pan.value)) return; //ignore if not in '2D' mode
-	Sound::lock();
-	pan.set(new_pan, ramp);
-	Sound::unlock();
+	if (slot == -1U) return; //empty handle
+	Command command;
+	command.type = Command::SetPan;
+	command.slot = slot;
+	command.generation = generation;
+	command.value = new_pan;
+	command.ramp = ramp;
+	send_command(std::move(command));
 }
 
 void Sound::PlayingSample::set_position(glm::vec3 const &new_position, float ramp) {
-	if (pan.value == pan.value) return; //ignore if not in '3D' mode
-	Sound::lock();
-	position.set(new_position, ramp);
-	Sound::unlock();
+	if (slot == -1U) return; //empty handle
+	Command command;
+	command.type = Command::SetPosition;
+	command.slot = slot;
+	command.generation = generation;
+	command.vector = new_position;
+	command.ramp = ramp;
+	send_command(std::move(command));
 }
 
 void Sound::PlayingSample::set_half_volume_radius(float new_radius, float ramp) {
-	if (pan.value == pan.value) return; //ignore if not in '3D' mode
-	Sound::lock();
-	half_volume_radius.set(new_radius, ramp);
-	Sound::unlock();
+	if (slot == -1U) return; //empty handle
+	Command command;
+	command.type = Command::SetHalfVolumeRadius;
+	command.slot = slot;
+	command.generation = generation;
+	command.value = new_radius;
+	command.ramp = ramp;
+	send_command(std::move(command));
+}
+
+void Sound::PlayingSample::set_rate(float new_rate, float ramp) {
+	if (slot == -1U) return; //empty handle
+	Command command;
+	command.type = Command::SetRate;
+	command.slot = slot;
+	command.generation = generation;
+	command.value = new_rate;
+	command.ramp = ramp;
+	send_command(std::move(command));
+}
+
+void Sound::PlayingSample::set_priority(float new_priority) {
+	if (slot == -1U) return; //empty handle
+	Command command;
+	command.type = Command::SetPriority;
+	command.slot = slot;
+	command.generation = generation;
+	command.value = new_priority;
+	send_command(std::move(command));
+}
+
+void Sound::PlayingSample::set_bus(Bus new_bus) {
+	if (slot == -1U) return; //empty handle
+	Command command;
+	command.type = Command::SetBus;
+	command.slot = slot;
+	command.generation = generation;
+	command.bus = new_bus;
+	send_command(std::move(command));
+}
+
+Sound::Level Sound::PlayingSample::level() const {
+	if (slot == -1U) return Level(); //empty handle
+	if (slot_generations[slot] != generation) return Level(); //slot has since been reused
+	return voice_levels[slot].load();
 }
 
 void Sound::PlayingSample::stop(float ramp) {
-	Sound::lock();
-	if (!(stopping || stopped)) {
-		stopping = true;
-		volume.target = 0.0f;
-		volume.ramp = ramp;
-	} else {
-		volume.ramp = std::min(volume.ramp, ramp);
-	}
-	Sound::unlock();
+	if (slot == -1U) return; //empty handle
+	Command command;
+	command.type = Command::Stop;
+	command.slot = slot;
+	command.generation = generation;
+	command.ramp = ramp;
+	send_command(std::move(command));
 }
 
 //------------------
 
 void Sound::Listener::set_position_right(glm::vec3 const &new_position, glm::vec3 const &new_right, float ramp) {
-	Sound::lock();
-	position.set(new_position, ramp);
-	//some extra code to make sure right is always a unit vector:
-	if (new_right == glm::vec3(0.0f)) {
-		right.set(glm::vec3(1.0f, 0.0f, 0.0f), ramp);
-	} else {
-		right.set(glm::normalize(new_right), ramp);
-	}
-	Sound::unlock();
+	Command command;
+	command.type = Command::SetListener;
+	command.vector = new_position;
+	command.right = new_right;
+	command.ramp = ramp;
+	send_command(std::move(command));
 }
 
 //------------------------ internals --------------------------------
@@ -219,66 +1379,66 @@ inline void compute_pan_weights(float pan, float *left, float *right) {
 	*right = std::sin(ang);
 }
 
-//helper: 3D audio panning
-void compute_pan_from_listener_and_position(
-	glm::vec3 const &listener_position,
-	glm::vec3 const &listener_right,
-	glm::vec3 const &source_position,
-	float source_half_radius,
-	float *left, float *right
-	) {
-	glm::vec3 to = source_position - listener_position;
-	float distance = glm::length(to);
-	//start by panning based on direction.
-	//note that for a LR fade to sound uniform, sound power (squared magnitude) should remain constant.
-	if (distance == 0.0f) {
-		*left = *right = std::sqrt(2.0f);
-	} else {
-		//amt ranges from -1 (most left) to 1 (most right):
-		float amt = glm::dot(listener_right, to) / distance;
-		//turn into an angle from 0.0f (most left) to pi/2 (most right):
-		float ang = 0.5f * 3.1415926f * (0.5f * (amt + 1.0f));
-		*left = std::cos(ang);
-		*right = std::sin(ang);
-
-		//squared distance attenuation is realistic if there are no walls,
-		// but I'm going to use linear because it's sounds better to me.
-		// (feel free to change it, of course)
-		//want att = 0.5f at distance == half_volume_radius
-		float att = 1.0f / (1.0f + (distance / source_half_radius));
-		*left *= att;
-		*right *= att;
+//helper: 2D pan weights for a voice, reusing the last ones computed if the pan hasn't changed:
+glm::vec2 voice_pan_weights_2D(uint32_t slot) {
+	float pan = voices.pan[slot].value;
+	if (!(voices.pan_weights_valid[slot] && voices.pan_weights_pan[slot] == pan)) {
+		compute_pan_weights(pan, &voices.pan_weights[slot].x, &voices.pan_weights[slot].y);
+		voices.pan_weights_pan[slot] = pan;
+		voices.pan_weights_valid[slot] = true;
 	}
+	return voices.pan_weights[slot];
+}
+
+//helper: are a 3D voice's cached pan weights good for its current position and the listener 'version'?
+bool voice_pan_weights_3D_cached(uint32_t slot, uint32_t version) {
+	return voices.pan_weights_valid[slot]
+	    && voices.pan_weights_listener[slot] == version
+	    && voices.pan_weights_position[slot] == voices.position[slot].value
+	    && voices.pan_weights_radius[slot] == voices.half_volume_radius[slot].value;
+}
+
+//helper: add a 3D voice's current position to a batch of pan weights to compute:
+void Pan3DBatch::add(uint32_t slot_) {
+	slot[count] = slot_;
+	x[count] = voices.position[slot_].value.x;
+	y[count] = voices.position[slot_].value.y;
+	z[count] = voices.position[slot_].value.z;
+	half_radius[count] = voices.half_volume_radius[slot_].value;
+	count += 1;
+}
+
+void Pan3DBatch::compute(glm::vec3 const &listener_position, glm::vec3 const &listener_right) {
+	pan_3D(count, x.data(), y.data(), z.data(), half_radius.data(), listener_position, listener_right, left.data(), right.data());
 }
 
-//helper: ramp updates...
-constexpr float const RAMP_STEP = float(MIX_SAMPLES) / float(AUDIO_RATE);
+//helper: ramp updates (advance the ramp by 'dt' seconds; ramps move linearly in time, so the result doesn't depend on how time is split into steps)...
 
 //helper: ...for single values:
-void step_value_ramp(Sound::Ramp< float > &ramp) {
-	if (ramp.ramp < RAMP_STEP) {
+void step_value_ramp(Sound::Ramp< float > &ramp, float dt) {
+	if (ramp.ramp < dt) {
 		ramp.value = ramp.target;
 		ramp.ramp = 0.0f;
 	} else {
-		ramp.value += (RAMP_STEP / ramp.ramp) * (ramp.target - ramp.value);
-		ramp.ramp -= RAMP_STEP;
+		ramp.value += (dt / ramp.ramp) * (ramp.target - ramp.value);
+		ramp.ramp -= dt;
 	}
 }
 
 //helper: ...for 3D positions:
-void step_position_ramp(Sound::Ramp< glm::vec3 > &ramp) {
-	if (ramp.ramp < RAMP_STEP) {
+void step_position_ramp(Sound::Ramp< glm::vec3 > &ramp, float dt) {
+	if (ramp.ramp < dt) {
 		ramp.value = ramp.target;
 		ramp.ramp = 0.0f;
 	} else {
-		ramp.value = glm::mix(ramp.value, ramp.target, RAMP_STEP / ramp.ramp);
-		ramp.ramp -= RAMP_STEP;
+		ramp.value = glm::mix(ramp.value, ramp.target, dt / ramp.ramp);
+		ramp.ramp -= dt;
 	}
 }
 
 //helper: ...for 3D directions:
-void step_direction_ramp(Sound::Ramp< glm::vec3 > &ramp) {
-	if (ramp.ramp < RAMP_STEP) {
+void step_direction_ramp(Sound::Ramp< glm::vec3 > &ramp, float dt) {
+	if (ramp.ramp < dt) {
 		ramp.value = ramp.target;
 		ramp.ramp = 0.0f;
 	} else {
@@ -302,137 +1462,800 @@ void step_direction_ramp(Sound::Ramp< glm::vec3 > &ramp) {
 		float angle = std::acos(glm::clamp(glm::dot(ramp.value, ramp.target), -1.0f, 1.0f));
 
 		//figure out new target value by moving angle toward target:
-		angle *= (ramp.ramp - RAMP_STEP) / ramp.ramp;
+		angle *= (ramp.ramp - dt) / ramp.ramp;
 
 		ramp.value = ramp.target * std::cos(angle) + perp * std::sin(angle);
-		ramp.ramp -= RAMP_STEP;
+		ramp.ramp -= dt;
 	}
 }
 
 
+//Commands from the game thread are applied here (called from mix_block, or directly if there is no mixing thread):
+void apply_command(Command &command) {
+	//Play starts a (fresh) voice, everything else refers to an existing voice:
+	if (command.type == Command::Play) {
+		uint32_t slot = command.slot;
+		assert(slot < Sound::MaxVoices);
+		assert(!voices.playing[slot]);
+		assert((command.sample && command.sample->length != 0) || command.stream);
+		voices.sample[slot] = command.sample;
+		voices.stream[slot] = command.stream;
+		voices.stream_epoch[slot] = command.stream_epoch;
+		voices.stream_synced[slot] = false;
+		voices.i[slot] = 0;
+		voices.frac[slot] = 0.0f;
+		voices.adpcm[slot] = ADPCMDecoder();
+		voices.rate[slot] = Sound::Ramp< float >(1.0f);
+		voices.start_frame[slot] = std::max(command.start_frame, mixer_frame);
+		voices.generation[slot] = command.generation;
+		voices.loop[slot] = command.loop;
+		voices.stopping[slot] = false;
+		voices.bus[slot] = command.bus;
+		voices.volume[slot] = Sound::Ramp< float >(command.value);
+		voices.pan[slot] = Sound::Ramp< float >(command.pan);
+		voices.position[slot] = Sound::Ramp< glm::vec3 >(command.vector);
+		voices.half_volume_radius[slot] = Sound::Ramp< float >(command.half_volume_radius);
+		voices.priority[slot] = 0.0f;
+		voices.real[slot] = false;
+		voices.pan_weights_valid[slot] = false;
+
+		//a stream can only be played by one voice, so fade out any other voice playing it:
+		// (while fading, it only reads audio the decoder wrote before restarting -- see mix_stream_voice)
+		if (command.stream) {
+			for (uint32_t a = 0; a < voices.active_count; ++a) {
+				uint32_t s = voices.active[a];
+				if (voices.stream[s] == command.stream && !voices.stopping[s]) {
+					voices.stopping[s] = true;
+					voices.volume[s].target = 0.0f;
+					voices.volume[s].ramp = 1.0f / 60.0f;
+				}
+			}
+		}
+
+		voices.playing[slot] = true;
+		voices.active[voices.active_count] = slot;
+		voices.active_count += 1;
+		return;
+	}
+
+	//helper: is the command's target voice still the one it was sent to?
+	auto target_valid = [&command]() {
+		return command.slot < Sound::MaxVoices
+		    && voices.playing[command.slot]
+		    && voices.generation[command.slot] == command.generation;
+	};
+	uint32_t slot = command.slot;
+
+	if (command.type == Command::SetVolume) {
+		if (!target_valid()) return;
+		if (!voices.stopping[slot]) {
+			voices.volume[slot].set(command.value, command.ramp);
+		}
+	} else if (command.type == Command::SetPan) {
+		if (!target_valid()) return;
+		if (voices.pan[slot].value == voices.pan[slot].value) { //ignore if not in '2D' mode
+			voices.pan[slot].set(command.value, command.ramp);
+		}
+	} else if (command.type == Command::SetPosition) {
+		if (!target_valid()) return;
+		if (!(voices.pan[slot].value == voices.pan[slot].value)) { //ignore if not in '3D' mode
+			voices.position[slot].set(command.vector, command.ramp);
+		}
+	} else if (command.type == Command::SetHalfVolumeRadius) {
+		if (!target_valid()) return;
+		if (!(voices.pan[slot].value == voices.pan[slot].value)) { //ignore if not in '3D' mode
+			voices.half_volume_radius[slot].set(command.value, command.ramp);
+		}
+	} else if (command.type == Command::SetRate) {
+		if (!target_valid()) return;
+		if (!voices.stream[slot]) { //ignore for streams
+			voices.rate[slot].set(std::max(MIN_RATE, command.value), command.ramp);
+		}
+	} else if (command.type == Command::SetPriority) {
+		if (!target_valid()) return;
+		voices.priority[slot] = command.value;
+	} else if (command.type == Command::SetBus) {
+		if (!target_valid()) return;
+		voices.bus[slot] = command.bus;
+	} else if (command.type == Command::Stop) {
+		if (!target_valid()) return;
+		if (!voices.stopping[slot]) {
+			voices.stopping[slot] = true;
+			voices.volume[slot].target = 0.0f;
+			voices.volume[slot].ramp = command.ramp;
+		} else {
+			voices.volume[slot].ramp = std::min(voices.volume[slot].ramp, command.ramp);
+		}
+	} else if (command.type == Command::StopAll) {
+		for (uint32_t a = 0; a < voices.active_count; ++a) {
+			uint32_t s = voices.active[a];
+			if (!voices.stopping[s]) {
+				voices.stopping[s] = true;
+				voices.volume[s].target = 0.0f;
+				voices.volume[s].ramp = 1.0f / 60.0f;
+			}
+		}
+	} else if (command.type == Command::SetListener) {
+		listener_version += 1;
+		Sound::listener.position.set(command.vector, command.ramp);
+		//some extra code to make sure right is always a unit vector:
+		if (command.right == glm::vec3(0.0f)) {
+			Sound::listener.right.set(glm::vec3(1.0f, 0.0f, 0.0f), command.ramp);
+		} else {
+			Sound::listener.right.set(glm::normalize(command.right), command.ramp);
+		}
+	} else if (command.type == Command::SetGlobalVolume) {
+		Sound::volume.set(command.value, command.ramp);
+	} else if (command.type == Command::SetRealVoiceBudget) {
+		real_voice_budget = command.slot;
+	} else if (command.type == Command::SetBusVolume) {
+		buses.volume[uint32_t(command.bus)].set(command.value, command.ramp);
+	} else if (command.type == Command::AddEffect) {
+		uint32_t b = uint32_t(command.bus);
+		if (buses.effect_count[b] == Sound::MaxBusEffects) {
+			assert(0 && "too many effects on one bus");
+			return;
+		}
+		command.effect->reset();
+		buses.effects[b][buses.effect_count[b]] = command.effect;
+		buses.effect_count[b] += 1;
+	} else if (command.type == Command::SetCapture) {
+		capture = command.capture;
+	} else if (command.type == Command::RemoveEffect) {
+		uint32_t b = uint32_t(command.bus);
+		auto begin = buses.effects[b].begin();
+		auto end = std::remove(begin, begin + buses.effect_count[b], command.effect);
+		buses.effect_count[b] = uint32_t(end - begin);
+	} else {
+		assert(0 && "unknown command type");
+	}
+}
+
 //The audio callback -- invoked by SDL when it needs more sound to play:
 void mix_audio(void *, Uint8 *buffer_, int len) {
 	assert(buffer_); //should always have some audio buffer
+	assert(uint32_t(len) == mix_samples * 2 * sizeof(float)); //should always have the expected number of samples
+	mix_block(reinterpret_cast< float * >(buffer_));
+}
+
+//Mix the next block of audio (for whichever backend is in use):
+void mix_block(float *buffer_) {
+	assert(buffer_);
+
+	auto mix_start = std::chrono::steady_clock::now();
 
 	struct LR {
 		float l;
 		float r;
 	};
 	static_assert(sizeof(LR) == 8, "Sample is packed");
-	assert(len == MIX_SAMPLES * sizeof(LR)); //should always have the expected number of samples
 	LR *buffer = reinterpret_cast< LR * >(buffer_);
 
 	//zero the output buffer:
-	for (uint32_t s = 0; s < MIX_SAMPLES; ++s) {
+	for (uint32_t s = 0; s < mix_samples; ++s) {
 		buffer[s].l = 0.0f;
 		buffer[s].r = 0.0f;
 	}
 
+	//apply any changes requested by the game thread since the last block:
+	// (at most one queue's worth, so a busy game thread can't keep the mixer here forever)
+	{
+		Command command;
+		for (uint32_t c = 0; c < commands.capacity() && commands.pop(&command); ++c) {
+			apply_command(command);
+			commands_applied.fetch_add(1, std::memory_order_release);
+		}
+	}
+
+	//this block covers audio frames [block_start, block_end):
+	uint64_t block_start = mixer_frame;
+	uint64_t block_end = mixer_frame + mix_samples;
+
 	//update global values:
+	// (the master volume is applied to the final mix, after the master bus's effects)
 	float start_volume = Sound::volume.value;
 	glm::vec3 start_position =  Sound::listener.position.value;
 	glm::vec3 start_right =  Sound::listener.right.value;
 
-	step_value_ramp(Sound::volume);
-	step_position_ramp( Sound::listener.position);
-	step_direction_ramp( Sound::listener.right);
+	step_value_ramp(Sound::volume, mix_seconds);
+	step_position_ramp( Sound::listener.position, mix_seconds);
+	step_direction_ramp( Sound::listener.right, mix_seconds);
 
 	float end_volume = Sound::volume.value;
 	glm::vec3 end_position =  Sound::listener.position.value;
 	glm::vec3 end_right =  Sound::listener.right.value;
 
-	//add audio from each playing sample into the buffer:
-	for (auto si = playing_samples.begin(); si != playing_samples.end(); /* later */) {
-		Sound::PlayingSample &playing_sample = **si; //much more convenient than writing ** everywhere.
+	//bus volumes (applied as each bus is added to the master mix):
+	std::array< float, Sound::BusCount > bus_start_volume, bus_end_volume;
+	//largest gain the bus and master volumes apply this block (for deciding which voices are audible):
+	std::array< float, Sound::BusCount > bus_level;
+	for (uint32_t b = 0; b < Sound::BusCount; ++b) {
+		if (b == uint32_t(Sound::Bus::Master)) {
+			bus_start_volume[b] = bus_end_volume[b] = 1.0f;
+		} else {
+			bus_start_volume[b] = buses.volume[b].value;
+			step_value_ramp(buses.volume[b], mix_seconds);
+			bus_end_volume[b] = buses.volume[b].value;
+		}
+		bus_level[b] = std::max(bus_start_volume[b], bus_end_volume[b]) * std::max(start_volume, end_volume);
+	}
+
+	//(3D pan weights computed with the start listener can't be reused with the end listener if it moved:)
+	uint32_t start_listener_version = listener_version;
+	if (end_position != start_position || end_right != start_right) listener_version += 1;
+	uint32_t end_listener_version = listener_version;
+
+	//figure out the gain of every playing sample at the start and end of this block:
+	// pan weights come from the per-voice cache when nothing has moved; 3D weights that do need computing
+	// are batched up and done all at once (by listener, start and end) with pan_3D().
+	std::array< float, Sound::MaxVoices > start_scale, end_scale; //volume applied to the pan weights
+	pan_batch_start.count = 0;
+	pan_batch_end.count = 0;
+
+	for (uint32_t a = 0; a < voices.active_count; ++a) {
+		uint32_t slot = voices.active[a];
+		assert(voices.playing[slot]);
+
+		//voices scheduled for a later block stay silent (with ramps on hold) until then:
+		if (voices.start_frame[slot] >= block_end) {
+			voices.start_gain[slot] = voices.end_gain[slot] = glm::vec2(0.0f);
+			start_scale[slot] = end_scale[slot] = 0.0f;
+			continue;
+		}
+
+		bool is_3D = !(voices.pan[slot].value == voices.pan[slot].value);
 
 		//Figure out sample panning/volume at start...
-		LR start_pan;
-		if (!(playing_sample.pan.value == playing_sample.pan.value)) {
-			//3D panning
-			compute_pan_from_listener_and_position(
-				start_position, start_right,
-				playing_sample.position.value,
-				playing_sample.half_volume_radius.value,
-				&start_pan.l, &start_pan.r);
-
-			step_position_ramp(playing_sample.position);
-			step_value_ramp(playing_sample.half_volume_radius);
+		if (!is_3D) {
+			voices.start_gain[slot] = voice_pan_weights_2D(slot);
+		} else if (voice_pan_weights_3D_cached(slot, start_listener_version)) {
+			voices.start_gain[slot] = voices.pan_weights[slot];
 		} else {
-			//2D panning
-			compute_pan_weights(playing_sample.pan.value, &start_pan.l, &start_pan.r);
-
-			step_value_ramp(playing_sample.pan);
+			pan_batch_start.add(slot);
 		}
-		start_pan.l *= start_volume * playing_sample.volume.value;
-		start_pan.r *= start_volume * playing_sample.volume.value;
+		start_scale[slot] = voices.volume[slot].value;
+		float start_rate = voices.rate[slot].value;
+
+		step_position_ramp(voices.position[slot], mix_seconds);
+		step_value_ramp(voices.half_volume_radius[slot], mix_seconds);
+		step_value_ramp(voices.pan[slot], mix_seconds);
+		step_value_ramp(voices.volume[slot], mix_seconds);
+		step_value_ramp(voices.rate[slot], mix_seconds);
 
-		step_value_ramp(playing_sample.volume);
+		//(a rate ramping linearly over the block covers the same ground as its average)
+		voices.block_rate[slot] = 0.5f * (start_rate + voices.rate[slot].value);
 
 		//..and end of the mix period:
-		LR end_pan;
-		if (!(playing_sample.pan.value == playing_sample.pan.value)) {
-			//3D panning
-			compute_pan_from_listener_and_position(
-				end_position, end_right,
-				playing_sample.position.value,
-				playing_sample.half_volume_radius.value,
-				&end_pan.l, &end_pan.r);
+		if (!is_3D) {
+			voices.end_gain[slot] = voice_pan_weights_2D(slot);
+		} else if (voice_pan_weights_3D_cached(slot, end_listener_version)) {
+			voices.end_gain[slot] = voices.pan_weights[slot];
 		} else {
-			//2D panning
-			compute_pan_weights(playing_sample.pan.value, &end_pan.l, &end_pan.r);
+			pan_batch_end.add(slot);
+			//(end weights become the cached weights once computed, below)
+			voices.pan_weights_valid[slot] = true;
+			voices.pan_weights_listener[slot] = end_listener_version;
+			voices.pan_weights_position[slot] = voices.position[slot].value;
+			voices.pan_weights_radius[slot] = voices.half_volume_radius[slot].value;
 		}
+		end_scale[slot] = voices.volume[slot].value;
+	}
 
-		end_pan.l *= end_volume * playing_sample.volume.value;
-		end_pan.r *= end_volume * playing_sample.volume.value;
+	pan_batch_start.compute(start_position, start_right);
+	for (uint32_t b = 0; b < pan_batch_start.count; ++b) {
+		voices.start_gain[pan_batch_start.slot[b]] = glm::vec2(pan_batch_start.left[b], pan_batch_start.right[b]);
+	}
+	pan_batch_end.compute(end_position, end_right);
+	for (uint32_t b = 0; b < pan_batch_end.count; ++b) {
+		uint32_t slot = pan_batch_end.slot[b];
+		voices.end_gain[slot] = voices.pan_weights[slot] = glm::vec2(pan_batch_end.left[b], pan_batch_end.right[b]);
+	}
 
-		//figure out a step to add at each sample so that pan will move smoothly from start to end:
-		LR pan = start_pan;
-		LR pan_step;
-		pan_step.l = (end_pan.l - start_pan.l) / MIX_SAMPLES;
-		pan_step.r = (end_pan.r - start_pan.r) / MIX_SAMPLES;
+	//apply volume, and collect the audible voices as candidates for mixing:
+	std::array< uint32_t, Sound::MaxVoices > candidates;
+	uint32_t candidate_count = 0;
+
+	for (uint32_t a = 0; a < voices.active_count; ++a) {
+		uint32_t slot = voices.active[a];
+		voices.start_gain[slot] *= start_scale[slot];
+		voices.end_gain[slot] *= end_scale[slot];
+
+		glm::vec2 const &start_gain = voices.start_gain[slot];
+		glm::vec2 const &end_gain = voices.end_gain[slot];
+		float loudest = std::max(std::max(start_gain.x, start_gain.y), std::max(end_gain.x, end_gain.y));
+		if (loudest * bus_level[uint32_t(voices.bus[slot])] >= AUDIBLE_GAIN) {
+			candidates[candidate_count] = slot;
+			candidate_count += 1;
+		}
+	}
 
-		assert(playing_sample.i < playing_sample.data.size());
+	//if there are too many audible voices, keep the highest-priority (then loudest) ones:
+	if (candidate_count > real_voice_budget) {
+		auto louder = [&bus_level](uint32_t a, uint32_t b) {
+			if (voices.priority[a] != voices.priority[b]) return voices.priority[a] > voices.priority[b];
+			float la = std::max(voices.end_gain[a].x, voices.end_gain[a].y) * bus_level[uint32_t(voices.bus[a])];
+			float lb = std::max(voices.end_gain[b].x, voices.end_gain[b].y) * bus_level[uint32_t(voices.bus[b])];
+			return la > lb;
+		};
+		std::nth_element(candidates.begin(), candidates.begin() + real_voice_budget, candidates.begin() + candidate_count, louder);
+		candidate_count = real_voice_budget;
+	}
 
-		for (uint32_t i = 0; i < MIX_SAMPLES; ++i) {
-			//mix one sample based on current pan values:
-			buffer[i].l += pan.l * playing_sample.data[playing_sample.i];
-			buffer[i].r += pan.r * playing_sample.data[playing_sample.i];
+	//mark the voices that will be mixed this block:
+	// (voices switching between real and virtual are faded in/out over the block to avoid clicks;
+	//  voices that only start playing this block begin at their first frame, so don't need the fade in)
+	std::array< bool, Sound::MaxVoices > mix_now{};
+	for (uint32_t c = 0; c < candidate_count; ++c) {
+		uint32_t slot = candidates[c];
+		mix_now[slot] = true;
+		if (!voices.real[slot] && voices.start_frame[slot] < block_start) voices.start_gain[slot] = glm::vec2(0.0f);
+	}
+	for (uint32_t a = 0; a < voices.active_count; ++a) {
+		uint32_t slot = voices.active[a];
+		if (voices.real[slot] && !mix_now[slot]) {
+			mix_now[slot] = true;
+			voices.end_gain[slot] = glm::vec2(0.0f);
+			voices.real[slot] = false;
+		} else {
+			voices.real[slot] = mix_now[slot];
+		}
+	}
 
-			//update position in sample:
-			playing_sample.i += 1;
-			if (playing_sample.i == playing_sample.data.size()) {
-				if (playing_sample.loop) {
-					playing_sample.i = 0;
-				} else {
-					break;
+	//figure out which buses have anything to do this block (voices to mix, or effects to run -- which may have tails):
+	uint32_t real_count = 0;
+	std::array< bool, Sound::BusCount > bus_used{};
+	for (uint32_t a = 0; a < voices.active_count; ++a) {
+		uint32_t slot = voices.active[a];
+		if (!mix_now[slot]) continue;
+		real_count += 1;
+		bus_used[uint32_t(voices.bus[slot])] = true;
+	}
+
+	//where each bus is mixed (voices on the Master bus go straight to the output):
+	uint32_t const bus_stride = 2 * mix_samples;
+	std::array< float *, Sound::BusCount > bus_buffer;
+	for (uint32_t b = 0; b < Sound::BusCount; ++b) {
+		if (b == uint32_t(Sound::Bus::Master)) {
+			bus_buffer[b] = buffer_;
+			continue;
+		}
+		bus_buffer[b] = buses.buffer.data() + b * bus_stride;
+		if (buses.effect_count[b] != 0) bus_used[b] = true;
+		if (bus_used[b]) std::fill(bus_buffer[b], bus_buffer[b] + bus_stride, 0.0f);
+	}
+
+	//add audio from each playing sample into its bus (or just advance virtual voices):
+	// (with lots of real voices, and worker threads available, the sample voices are split up between threads;
+	//  streams are always mixed here, since mixing them consumes the stream's buffer)
+	std::array< bool, Sound::MaxVoices > finished;
+	uint32_t input = (mix_pool && real_count >= PARALLEL_MIN_REAL_VOICES ? mix_pool->next_input() : -1U);
+	if (input != -1U) {
+		ParallelMix &job = parallel_mix[input];
+		parallel_blocks += 1;
+		job.block = parallel_blocks;
+		job.block_start = block_start;
+		job.bus_buffer = bus_buffer;
+		job.count = 0;
+		for (uint32_t a = 0; a < voices.active_count; ++a) {
+			uint32_t slot = voices.active[a];
+			if (voices.stream[slot]) {
+				finished[slot] = mix_stream_voice(slot, mix_now[slot], block_start, bus_buffer[uint32_t(voices.bus[slot])]);
+			} else {
+				job.slot[job.count] = slot;
+				job.voice[job.count] = voice_mix(slot, mix_now[slot]);
+				job.count += 1;
+			}
+		}
+
+		mix_pool->run(job.count, PARALLEL_CHUNK_VOICES, mix_voices_job, &job);
+
+		//take each voice's results from whichever thread finished it, and add in the audio that workers mixed:
+		for (uint32_t v = 0; v < job.count; ++v) {
+			MixOutput const &output = *mix_outputs[mix_pool->finished_by(v / PARALLEL_CHUNK_VOICES)];
+			finished[job.slot[v]] = voice_mixed(job.slot[v], output.mixed[v]);
+		}
+		for (uint32_t t = 1; t <= mix_pool->threads(); ++t) {
+			if (!mix_pool->contributed(t)) continue;
+			MixOutput const &output = *mix_outputs[t];
+			for (uint32_t b = 0; b < Sound::BusCount; ++b) {
+				if (!bus_used[b]) continue;
+				float const *from = output.buffer.data() + b * bus_stride;
+				for (uint32_t i = 0; i < bus_stride; ++i) {
+					bus_buffer[b][i] += from[i];
 				}
 			}
+		}
+	} else {
+		for (uint32_t a = 0; a < voices.active_count; ++a) {
+			uint32_t slot = voices.active[a];
+			float *target = bus_buffer[uint32_t(voices.bus[slot])];
+			if (voices.stream[slot]) {
+				finished[slot] = mix_stream_voice(slot, mix_now[slot], block_start, target);
+			} else {
+				VoiceMixed mixed;
+				mix_voice(voice_mix(slot, mix_now[slot]), block_start, target, &mixed);
+				finished[slot] = voice_mixed(slot, mixed);
+			}
+		}
+	}
 
-			//update pan values:
-			pan.l += pan_step.l;
-			pan.r += pan_step.r;
+	//run each bus's effects, then add it into the master mix at the bus's volume:
+	for (uint32_t b = 0; b < Sound::BusCount; ++b) {
+		if (b == uint32_t(Sound::Bus::Master) || !bus_used[b]) continue;
+		for (uint32_t e = 0; e < buses.effect_count[b]; ++e) {
+			buses.effects[b][e]->process(bus_buffer[b], mix_samples);
 		}
+		if (bus_start_volume[b] != 0.0f || bus_end_volume[b] != 0.0f) {
+			mix_stereo(buffer_, bus_buffer[b], mix_samples, bus_start_volume[b], (bus_end_volume[b] - bus_start_volume[b]) / mix_samples);
+		}
+	}
 
-		if (playing_sample.i >= playing_sample.data.size()
-		 || (playing_sample.stopping && playing_sample.volume.value == 0.0f)) { //sample has finished
-		 	playing_sample.stopped = true;
-			//erase from list:
-			auto old = si;
-			++si;
-			playing_samples.erase(old);
+	//...then the master bus's effects and volume:
+	uint32_t master = uint32_t(Sound::Bus::Master);
+	for (uint32_t e = 0; e < buses.effect_count[master]; ++e) {
+		buses.effects[master][e]->process(buffer_, mix_samples);
+	}
+	//(always run, even at unit volume, since it also meters the final output -- instead of a separate pass over it)
+	MixLevel mixed_level;
+	scale_stereo(buffer_, mix_samples, start_volume, (end_volume - start_volume) / mix_samples, &mixed_level);
+	float peak = mixed_level.peak;
+	float rms = std::sqrt(mixed_level.sum_squares / float(2 * mix_samples));
+	output_level.store(rms, peak);
+
+	uint32_t mixed_active_count = voices.active_count; //(for stats)
+
+	//retire voices that are done:
+	for (uint32_t a = 0; a < voices.active_count; /* later */) {
+		uint32_t slot = voices.active[a];
+		if (finished[slot]
+		 || (voices.stopping[slot] && voices.volume[slot].value == 0.0f) //sample has faded out
+		 || (voices.stopping[slot] && !mix_now[slot])) { //sample is fading out and already inaudible (or out of budget)
+			//remove from active list (by swapping in the last active voice, which is checked next):
+			voices.playing[slot] = false;
+			voice_levels[slot].store(0.0f, 0.0f);
+			voices.active_count -= 1;
+			voices.active[a] = voices.active[voices.active_count];
+			//return the slot to the game thread:
+			// (no heap traffic here -- just an index on a queue that can hold every slot)
+			bool pushed = free_slots.push(uint32_t(slot));
+			assert(pushed);
+			(void)pushed;
 		} else {
-			++si;
+			++a;
 		}
 	}
 
-	/*//DEBUG: report output power:
-	float max_power = 0.0f;
-	for (uint32_t s = 0; s < MIX_SAMPLES; ++s) {
-		max_power = std::max(max_power, (buffer[s].l * buffer[s].l + buffer[s].r * buffer[s].r));
+	//hand the block to the capture writer (if capturing):
+	if (capture) {
+		uint32_t count = 2 * mix_samples;
+		float *span;
+		if (capture->buffer.capacity() - capture->buffer.size() < count) {
+			capture_dropped_blocks.fetch_add(1, std::memory_order_relaxed);
+		} else {
+			//(at most two spans, if the block wraps around the end of the ring)
+			for (uint32_t done = 0; done < count; ) {
+				uint32_t n = std::min(capture->buffer.write_span(&span), count - done);
+				std::copy(buffer_ + done, buffer_ + done + n, span);
+				capture->buffer.commit(n);
+				done += n;
+			}
+		}
 	}
-	std::cout << "Max Power: " << std::sqrt(max_power) << "; playing samples: " << playing_samples.size() << std::endl; //DEBUG
-	*/
 
+	auto mix_end = std::chrono::steady_clock::now();
+
+	//advance the audio clock, and publish it for Sound::now():
+	mixer_frame = block_end;
+	{
+		uint32_t sequence = clock_sequence.load(std::memory_order_relaxed);
+		clock_sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		clock_frame.store(mixer_frame, std::memory_order_relaxed);
+		clock_time.store(std::chrono::duration_cast< std::chrono::nanoseconds >(mix_end.time_since_epoch()).count(), std::memory_order_relaxed);
+		clock_sequence.store(sequence + 2, std::memory_order_release);
+	}
+
+	//record statistics:
+	{
+		uint64_t block = stats_blocks.load(std::memory_order_relaxed);
+		float mix_time = std::chrono::duration< float >(mix_end - mix_start).count();
+		float load = mix_time / mix_seconds;
+		float interval = (block == 0 ? 0.0f : std::chrono::duration< float >(mix_start - last_mix_start).count());
+		last_mix_start = mix_start;
+
+		StatsSlot &slot = stats_slots[block % Sound::StatsHistory];
+		uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+		slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		slot.block.store(block, std::memory_order_relaxed);
+		slot.frame.store(block_start, std::memory_order_relaxed);
+		slot.mix_time.store(mix_time, std::memory_order_relaxed);
+		slot.load.store(load, std::memory_order_relaxed);
+		slot.interval.store(interval, std::memory_order_relaxed);
+		slot.active_voices.store(mixed_active_count, std::memory_order_relaxed);
+		slot.real_voices.store(real_count, std::memory_order_relaxed);
+		slot.peak.store(peak, std::memory_order_relaxed);
+		slot.rms.store(rms, std::memory_order_relaxed);
+		slot.sequence.store(sequence + 2, std::memory_order_release);
+
+		if (load >= 1.0f) stats_overruns.fetch_add(1, std::memory_order_relaxed);
+		if (backend != Sound::Backend::Offline && interval > 1.5f * mix_seconds) stats_late_blocks.fetch_add(1, std::memory_order_relaxed);
+		if (peak > 1.0f) stats_clipped_blocks.fetch_add(1, std::memory_order_relaxed);
+		if (load > stats_max_load.load(std::memory_order_relaxed)) stats_max_load.store(load, std::memory_order_relaxed);
+		stats_blocks.store(block + 1, std::memory_order_release);
+	}
+}
+
+
+//Get values [from, from + count) of a sample; returns a pointer into the sample itself for Float32 data,
+// or converts/decodes into 'scratch' (which must hold 'count' floats) for other formats:
+float const *sample_span(Sound::Sample const &sample, ADPCMDecoder *adpcm, uint32_t from, uint32_t count, float *scratch) {
+	assert(uint64_t(from) + count <= sample.length);
+	if (sample.format == Sound::Sample::Format::Float32) {
+		return sample.float_data() + from;
+	} else if (sample.format == Sound::Sample::Format::Int16) {
+		int16_to_float(scratch, sample.int16_data() + from, count);
+		return scratch;
+	} else {
+		//(the voice's decoder state lets consecutive spans continue rather than starting over at a block header)
+		adpcm_decode(sample.adpcm_data(), from, count, scratch, adpcm);
+		return scratch;
+	}
+}
+
+//Level of what a voice added to the mix, given the level of its mono data and its gains over the block:
+Sound::Level voice_level(glm::vec2 const &start_gain, glm::vec2 const &end_gain, MixLevel const &level) {
+	//mean square of a gain ramping linearly from a to b is (a^2 + ab + b^2) / 3, so (averaged over both channels):
+	auto mean_square = [](float a, float b) { return (a * a + a * b + b * b) / 3.0f; };
+	float gain_squared = 0.5f * (mean_square(start_gain.x, end_gain.x) + mean_square(start_gain.y, end_gain.y));
+	float max_gain = std::max({std::abs(start_gain.x), std::abs(start_gain.y), std::abs(end_gain.x), std::abs(end_gain.y)});
+	Sound::Level out;
+	out.rms = std::sqrt(gain_squared * level.sum_squares / float(mix_samples));
+	out.peak = max_gain * level.peak;
+	return out;
 }
 
+//Copy a (non-streamed) voice's playback state for mix_voice:
+VoiceMix voice_mix(uint32_t slot, bool mix) {
+	assert(!voices.stream[slot]);
+	VoiceMix voice;
+	voice.sample = voices.sample[slot];
+	voice.start_frame = voices.start_frame[slot];
+	voice.start_gain = voices.start_gain[slot];
+	voice.end_gain = voices.end_gain[slot];
+	voice.block_rate = voices.block_rate[slot];
+	voice.loop = voices.loop[slot];
+	voice.mix = mix;
+	voice.bus = voices.bus[slot];
+	voice.i = voices.i[slot];
+	voice.frac = voices.frac[slot];
+	voice.adpcm = voices.adpcm[slot];
+	return voice;
+}
 
+//Copy what mix_voice did back into the voice pool; returns true if the voice has finished playing:
+bool voice_mixed(uint32_t slot, VoiceMixed const &mixed) {
+	voices.i[slot] = mixed.i;
+	voices.frac[slot] = mixed.frac;
+	voices.adpcm[slot] = mixed.adpcm;
+	voice_levels[slot].store(mixed.level.rms, mixed.level.peak);
+	return mixed.finished;
+}
+
+//Mix one (non-streamed) voice into a block (called from mix_block, possibly on a worker thread):
+void mix_voice(VoiceMix const &voice, uint64_t block_start, float *buffer, VoiceMixed *mixed_) {
+	assert(mixed_);
+	VoiceMixed &mixed = *mixed_;
+	mixed.i = voice.i;
+	mixed.frac = voice.frac;
+	mixed.adpcm = voice.adpcm;
+
+	struct LR {
+		float l;
+		float r;
+	};
+
+	LR start_pan;
+	start_pan.l = voice.start_gain.x;
+	start_pan.r = voice.start_gain.y;
+
+	//figure out a step to add at each sample so that pan will move smoothly from start to end:
+	LR pan_step;
+	pan_step.l = (voice.end_gain.x - start_pan.l) / mix_samples;
+	pan_step.r = (voice.end_gain.y - start_pan.r) / mix_samples;
+
+	bool finished = false;
+	MixLevel level; //(of the mono data that gets mixed, before panning; the kernels measure it as they go)
+
+	//first frame of the block that the voice plays (only non-zero in the block a scheduled voice starts in):
+	uint32_t begin = 0;
+	if (voice.start_frame > block_start) {
+		begin = uint32_t(std::min< uint64_t >(voice.start_frame - block_start, mix_samples));
+	}
+
+	Sound::Sample const &sample = *voice.sample;
+	uint32_t length = sample.length;
+
+	if (begin == mix_samples) {
+		//scheduled for a later block; nothing to do yet
+	} else if (voice.block_rate == 1.0f && voice.frac == 0.0f) {
+		assert(mixed.i < length);
+
+		if (voice.mix) {
+			float scratch[DECODE_SAMPLES];
+			//mix runs of frames between loop points / the end of the sample:
+			for (uint32_t i = begin; i < mix_samples; /* later */) {
+				uint32_t count = std::min(mix_samples - i, length - mixed.i);
+				float const *data = sample_span(sample, &mixed.adpcm, mixed.i, count, scratch);
+				mix_mono_to_stereo(buffer + 2 * i, data, count,
+					start_pan.l + float(i) * pan_step.l, start_pan.r + float(i) * pan_step.r,
+					pan_step.l, pan_step.r, &level);
+
+				//update position in sample:
+				i += count;
+				mixed.i += count;
+				if (mixed.i == length) {
+					if (voice.loop) {
+						mixed.i = 0;
+					} else {
+						break;
+					}
+				}
+			}
+		} else {
+			//virtual voice: O(1) advance of the read position.
+			uint64_t next = uint64_t(mixed.i) + (mix_samples - begin);
+			if (voice.loop) {
+				mixed.i = uint32_t(next % length);
+			} else {
+				mixed.i = uint32_t(std::min< uint64_t >(next, length));
+			}
+		}
+		finished = (mixed.i >= length);
+	} else {
+		//pitched playback: read 'rate' data values per output frame, interpolating between them:
+		assert(mixed.i < length);
+		double size = double(length);
+		double rate = double(voice.block_rate);
+		double position = double(mixed.i) + double(mixed.frac);
+
+		if (voice.mix) {
+			float scratch[DECODE_SAMPLES];
+			//most frames the run below can read (including the slack value) fit in scratch:
+			double max_count = std::floor(double(DECODE_SAMPLES - 4) / rate) + 1.0;
+			for (uint32_t i = begin; i < mix_samples; /* later */) {
+				//run of frames that only read well inside the data (one value of slack, for rounding in the kernel):
+				uint32_t count = 0;
+				if (position + 3.0 <= size) {
+					count = uint32_t(std::min({double(mix_samples - i), std::floor((size - 3.0 - position) / rate) + 1.0, max_count}));
+				}
+				if (count > 0) {
+					uint32_t base = uint32_t(position);
+					double offset = position - double(base);
+					uint32_t span = uint32_t(std::min(size - double(base), std::floor(offset + double(count - 1) * rate) + 3.0));
+					float const *data = sample_span(sample, &mixed.adpcm, base, span, scratch);
+					mix_mono_to_stereo_resampled(buffer + 2 * i, data, count, float(offset), float(rate),
+						start_pan.l + float(i) * pan_step.l, start_pan.r + float(i) * pan_step.r,
+						pan_step.l, pan_step.r, &level);
+					position += double(count) * rate;
+					i += count;
+				} else {
+					//frames near the end interpolate toward the start of the sample (if looping) or silence:
+					uint32_t j = uint32_t(position);
+					float t = float(position - double(j));
+					float const *data = sample_span(sample, &mixed.adpcm, j, std::min(2U, length - j), scratch);
+					float at = data[0];
+					float next = (j + 1 < length ? data[1] : (voice.loop ? sample_span(sample, &mixed.adpcm, 0, 1, scratch)[0] : 0.0f));
+					float value = at + t * (next - at);
+					buffer[2 * i + 0] += (start_pan.l + float(i) * pan_step.l) * value;
+					buffer[2 * i + 1] += (start_pan.r + float(i) * pan_step.r) * value;
+					level.sum_squares += value * value;
+					level.peak = std::max(level.peak, std::abs(value));
+					position += rate;
+					i += 1;
+				}
+				if (position >= size) {
+					if (voice.loop) {
+						position = std::fmod(position, size);
+					} else {
+						break;
+					}
+				}
+			}
+		} else {
+			//virtual voice: O(1) advance of the read position.
+			position += rate * double(mix_samples - begin);
+			if (voice.loop && position >= size) {
+				position = std::fmod(position, size);
+			}
+		}
+
+		finished = (position >= size);
+		if (finished) {
+			mixed.i = length;
+			mixed.frac = 0.0f;
+		} else {
+			mixed.i = uint32_t(position);
+			mixed.frac = float(position - double(mixed.i));
+		}
+	}
+
+	mixed.finished = finished;
+	mixed.level = voice_level(voice.start_gain, voice.end_gain, level);
+}
+
+//Mix one streamed voice into a block (always on the mixing thread, since it consumes the stream's buffer):
+bool mix_stream_voice(uint32_t slot, bool mix, uint64_t block_start, float *buffer) {
+	glm::vec2 start_gain = voices.start_gain[slot];
+	glm::vec2 pan_step = (voices.end_gain[slot] - start_gain) / float(mix_samples);
+
+	bool finished = false;
+	MixLevel level;
+
+	//first frame of the block that the voice plays (only non-zero in the block a scheduled voice starts in):
+	uint32_t begin = 0;
+	if (voices.start_frame[slot] > block_start) {
+		begin = uint32_t(std::min< uint64_t >(voices.start_frame[slot] - block_start, mix_samples));
+	}
+
+	//read whatever the decoding thread has made available.
+	// (virtual voices read too, but don't mix, so the stream keeps its place)
+	Sound::Stream::Decoder &decoder = *voices.stream[slot];
+	uint32_t epoch = voices.stream_epoch[slot];
+	//If the stream has been played again, this voice is fading out (see apply_command), and only the audio before
+	// the decoder's restart point (start_position) is its own; the newer voice skips to that point, so reading past it
+	// would move the buffer's read position backwards. Once the decoder has restarted more than once, nothing is left:
+	uint32_t ready = decoder.ready_epoch.load(std::memory_order_acquire);
+	bool replaced = (decoder.requested_epoch.load(std::memory_order_acquire) != epoch);
+	bool readable = (ready == epoch || (ready == epoch + 1 && voices.stream_synced[slot]));
+	if (replaced && !voices.stream_synced[slot]) readable = false; //(never started; nothing of its own to play)
+	if (begin < mix_samples && readable) {
+		if (!voices.stream_synced[slot]) {
+			//skip any audio left over from a previous play of the stream:
+			decoder.buffer.skip_to(decoder.start_position.load(std::memory_order_relaxed));
+			voices.stream_synced[slot] = true;
+		}
+		//n.b. check for the end before reading, so the check can't miss audio committed in between:
+		bool at_end = (decoder.finished_epoch.load(std::memory_order_acquire) == epoch);
+		for (uint32_t i = begin; i < mix_samples; /* later */) {
+			float const *span = nullptr;
+			uint32_t count = std::min(mix_samples - i, decoder.buffer.read_span(&span));
+			//has the decoder restarted? (n.b. checked after read_span, so any audio it wrote after restarting is caught)
+			uint32_t now_ready = decoder.ready_epoch.load(std::memory_order_acquire);
+			if (now_ready != epoch) {
+				uint32_t left = decoder.start_position.load(std::memory_order_relaxed) - decoder.buffer.read_position();
+				count = (now_ready == epoch + 1 ? std::min(count, left) : 0);
+			}
+			if (count == 0) break; //decoder has fallen behind (or the stream ended); rest of block is silent
+			if (mix) {
+				mix_mono_to_stereo(buffer + 2 * i, span, count,
+					start_gain.x + float(i) * pan_step.x, start_gain.y + float(i) * pan_step.y,
+					pan_step.x, pan_step.y, &level);
+			}
+			decoder.buffer.consume(count);
+			i += count;
+		}
+		finished = (at_end && decoder.buffer.size() == 0);
+	}
+
+	Sound::Level mixed = voice_level(start_gain, voices.end_gain[slot], level);
+	voice_levels[slot].store(mixed.rms, mixed.peak);
+	return finished;
+}
+
+//WorkerPool job for parallel mixing: mixes voices [begin,end) of a ParallelMix into the thread's own outputs.
+// (per WorkerPool's rules, it only reads the ParallelMix, and writes only to mix_outputs[thread] -- or, on the mixing thread, the bus buffers)
+void mix_voices_job(void *context, uint32_t begin, uint32_t end, uint32_t thread) {
+	ParallelMix const &job = *static_cast< ParallelMix const * >(context);
+	MixOutput &output = *mix_outputs[thread];
+	if (thread != 0 && output.block != job.block) {
+		std::fill(output.buffer.begin(), output.buffer.end(), 0.0f);
+		output.block = job.block;
+	}
+	for (uint32_t v = begin; v < end; ++v) {
+		VoiceMix const &voice = job.voice[v];
+		uint32_t b = uint32_t(voice.bus);
+		float *target = (thread == 0 ? job.bus_buffer[b] : output.buffer.data() + b * 2 * mix_samples);
+		mix_voice(voice, job.block_start, target, &output.mixed[v]);
+	}
+}
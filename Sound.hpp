@@ -6,23 +6,84 @@
 #include <vector>
 #include <string>
 #include <cmath>
+#include <cstdint>
+#include <atomic>
+#include <iosfwd>
+
+struct MappedFile; //from sample_cache.hpp
+struct BiquadCoefficients; //from mix_kernels.hpp
 
 //Game audio system. Simplified from f18-base3.
 //Uses 48kHz sampling rate.
 
 namespace Sound {
 
+//Every voice plays on a submix bus; each bus's voices are mixed together, run through the bus's effects (see Effect, below),
+// and added into the master mix at the bus's volume -- so, e.g., all the music can be faded or filtered at once:
+enum class Bus : uint8_t {
+	Music,
+	SFX,
+	Choir,
+	UI,
+	Master, //the master mix itself (its effects and volume apply to everything)
+};
+constexpr uint32_t BusCount = 5;
+
 //Sample objects hold mono (one-channel) audio.
 struct Sample {
+	//How sample data is kept in memory; the mixer decodes as it plays, so smaller formats just cost a bit of mixing time:
+	enum class Format : uint8_t {
+		Float32, //4 bytes / sample
+		Int16, //2 bytes / sample (16-bit PCM)
+		ADPCM, //~0.5 bytes / sample (IMA-ADPCM; lossy, but fine for most effects)
+	};
+
 	//Load from a '.wav' or '.opus' file.
 	//  will warn and convert if sound is not already 48kHz mono:
-	Sample(std::string const &filename);
+	Sample(std::string const &filename, Format format = Format::Float32);
 	
 	//Directly supply an audio buffer:
-	Sample(std::vector< float > const &data);
+	Sample(std::vector< float > const &data, Format format = Format::Float32);
+
+	//sample data is stored as 48kHz, mono, in one of these (depending on format):
+	Format format = Format::Float32;
+	uint32_t length = 0; //in samples
+	std::vector< float > data; //Float32
+	std::vector< int16_t > data_int16; //Int16
+	std::vector< uint8_t > data_adpcm; //ADPCM (blocks as per adpcm.hpp)
+	//...or, for samples loaded from the on-disk cache (see sample_cache.hpp), in a memory-mapped file:
+	std::shared_ptr< MappedFile const > mapped;
+	void const *mapped_data = nullptr;
 
-	//sample data is stored as 48kHz, mono, floating-point:
-	std::vector< float > data;
+	//sample data, wherever it is stored:
+	float const *float_data() const { return mapped ? static_cast< float const * >(mapped_data) : data.data(); }
+	int16_t const *int16_data() const { return mapped ? static_cast< int16_t const * >(mapped_data) : data_int16.data(); }
+	uint8_t const *adpcm_data() const { return mapped ? static_cast< uint8_t const * >(mapped_data) : data_adpcm.data(); }
+
+	//memory used by sample data:
+	size_t bytes() const;
+
+	//bus that voices playing this sample start on (see PlayingSample::set_bus to move one later):
+	Bus bus = Bus::SFX;
+};
+
+//Stream objects play long (e.g., music) '.opus' files without decoding them into memory first:
+//  audio is decoded incrementally by a background thread into a small buffer that the mixer consumes,
+//  so load time and memory use don't depend on the length of the file.
+//  A stream can only be played by one voice at a time (playing it again restarts it).
+//  NOTE: don't destroy a stream while it is playing.
+struct Stream {
+	//Open a '.opus' file (throws on error):
+	Stream(std::string const &filename);
+	~Stream();
+	Stream(Stream const &) = delete;
+
+	//bus that voices playing this stream start on:
+	Bus bus = Bus::Music;
+
+	//internals:
+	struct Decoder; //background decoding state (defined in Sound.cpp)
+	std::unique_ptr< Decoder > decoder;
 };
 
 //Ramp<> manages values that should be smoothly interpolated
@@ -48,10 +109,20 @@ struct Ramp {
 	float ramp = 0.0f;
 };
 
-// 'PlayingSample' objects book-keep samples that are currently playing:
+//Level of a signal over one mixed block:
+struct Level {
+	float rms = 0.0f; //root-mean-square of the left and right values
+	float peak = 0.0f; //largest absolute value
+};
+
+// 'PlayingSample' objects are handles to samples that are currently playing:
+//  they are small values that can be freely copied (or dropped; the sample keeps playing).
+//  once the sample finishes (or if the handle is default-constructed) the functions below are ignored.
 struct PlayingSample {
-	//change the panning or volume of a playing sample (and do proper locking);
-	// value will change over 'ramp' seconds to avoid creating audible artifacts:
+	//change the panning or volume of a playing sample;
+	// value will change over 'ramp' seconds to avoid creating audible artifacts.
+	//these (and the other functions below) queue a command that the mixer applies at the start of its next block,
+	// so they never wait for the audio callback. Only call them from one thread (the game thread):
 	void set_volume(float new_volume, float ramp = 1.0f / 60.0f);
 	//set the panning of a sample (use only on samples in "2D" mode; no effect on "3D" samples):
 	void set_pan(float new_pan, float ramp = 1.0f / 60.0f);
@@ -60,48 +131,84 @@ struct PlayingSample {
 	//set the half-volume radius (use only on "3D" playing sounds):
 	void set_half_volume_radius(float new_radius, float ramp = 1.0f / 60.0f);
 
+	//set the playback rate of a sample (1.0 is normal speed; 2.0 plays twice as fast, so an octave higher);
+	// samples are resampled with linear interpolation. To start a sample at a different pitch, call this with ramp 0
+	// right after play() -- both are applied before the sample's first block is mixed. (no effect on streams):
+	void set_rate(float new_rate, float ramp = 1.0f / 60.0f);
+
+	//set the priority of a sample: when more samples are audible than the real voice budget allows,
+	// the highest-priority (and then loudest) ones are mixed; the rest are "virtual" (silent, but keep their place):
+	void set_priority(float new_priority);
+
+	//move a sample to a different bus (samples start on their Sample's bus):
+	void set_bus(Bus new_bus);
+
 	//'stop' will fade sample out over 'ramp' seconds and then remove it from the active samples:
 	void stop(float ramp = 1.0f / 60.0f);
 
+	//level of what this sample added to the mix in the most recent block -- after its volume and panning, but before
+	// its bus's volume and effects. Zero if it has finished or is virtual. (cheap: the mixer measures every voice as it mixes it)
+	// While the volume or pan is ramping, rms assumes the sample's loudness is steady over the block, and peak is an upper bound:
+	Level level() const;
+
+	//does this handle refer to a voice at all? (it may have finished playing since)
+	explicit operator bool() const { return slot != -1U; }
+
 	//internals:
-	//NOTE: PlayingSample is used in a separate thread; so setting these values directly
-	// may result in bad results. Instead, use the functions above, which perform locking!
-	std::vector< float > const &data; //reference to sample data being played
-	uint32_t i = 0; //next data value to read
-	bool loop = false; //should playback loop after data runs out?
-	bool stopping = false; //is playing stopping?
-	bool stopped = false; //was playback stopped (either by running out of sample, or by stop())?
-
-	Ramp< float > volume = Ramp< float >(1.0f);
-
-	//2D playback panning control: ('NaN' if sound played in 3D mode)
-	Ramp< float > pan = Ramp< float >(std::numeric_limits< float >::quiet_NaN());
-
-	//3D playback panning control: ('NaN' if sound played in 2D mode)
-	Ramp< glm::vec3 > position = Ramp< glm::vec3 >(std::numeric_limits< float >::quiet_NaN());
-	Ramp< float > half_volume_radius = std::numeric_limits< float >::quiet_NaN();
-
-	PlayingSample(Sample const &sample_, float volume_, float pan_, bool loop_)
-		: data(sample_.data), loop(loop_), volume(volume_), pan(pan_) { }
-	PlayingSample(Sample const &sample_, float volume_, glm::vec3 const &position_, float half_volume_radius_, bool loop_)
-		: data(sample_.data), loop(loop_), volume(volume_), position(position_), half_volume_radius(half_volume_radius_) { }
+	//NOTE: the playback state itself lives in a fixed-size voice pool owned by the mixer (see Sound.cpp);
+	// a handle names a pool slot, and the generation is used to detect that the slot has since been reused.
+	uint32_t slot = -1U;
+	uint32_t generation = 0;
 };
 
 // ------- global functions -------
 
-void init(); //call Sound::init() from main.cpp before using any member functions
+//sampling rate of all audio (and rate of the audio clock):
+constexpr uint32_t AudioRate = 48000;
+
+//size of the voice pool (maximum number of simultaneously playing samples);
+// how many of them are actually mixed each block is up to the real voice budget (see set_real_voice_budget, below):
+constexpr uint32_t MaxVoices = 4096;
+
+//Where mixed audio goes:
+enum class Backend {
+	SDL, //an SDL audio device (the usual choice)
+	Null, //a timer thread that mixes in real time and discards the output (e.g., for headless machines)
+	Offline, //no thread at all; audio is mixed only when Sound::render() is called (e.g., for tests and benchmarks)
+};
+
+//Audio is mixed in blocks of a fixed number of frames (a power of two in [MinBlockSize, MaxBlockSize]);
+// smaller blocks mean lower latency (1024 frames is ~21ms), at the cost of more mixer overhead per second:
+constexpr uint32_t MinBlockSize = 128;
+constexpr uint32_t MaxBlockSize = 1024;
+uint32_t block_size(); //block size in use (set by init())
+
+//With 'mix_threads' > 0, that many (core-pinned) worker threads help mix blocks with lots of real voices;
+// blocks with only a few voices are still mixed on one thread. The mixer never waits for a worker:
+// voices a worker hasn't finished by the time the mixer runs out of others to mix are mixed again by the mixer.
+void init(Backend backend = Backend::SDL, uint32_t block_size = 1024, uint32_t mix_threads = 0); //call Sound::init() from main.cpp before using any member functions
 
 void shutdown(); //call Sound::shutdown() from main.cpp to gracefully(-ish) exit
 
 //Call 'Sound::play' to play a sample once.
 //  if you hang on to the return value, you can change the panning, volume, or stop playback early.
-std::shared_ptr< PlayingSample > play(
+//  (the sample must outlive its playback)
+//  if all MaxVoices voices are busy, the sample is not played and the returned handle is empty.
+PlayingSample play(
+	Sample const &sample,
+	float volume = 1.0f,
+	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
+);
+//The play_at version will start the sample on exactly audio frame 'frame' (see Sound::now(), below).
+//  if that frame has already been mixed by the time the mixer sees the request, the sample starts as soon as it can:
+PlayingSample play_at(
 	Sample const &sample,
+	uint64_t frame,
 	float volume = 1.0f,
 	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
 );
 //The play_3D version will play a sample in '3D' mode (that is, panning determined by listener position):
-std::shared_ptr< PlayingSample > play_3D(
+PlayingSample play_3D(
 	Sample const &sample,
 	float volume,
 	glm::vec3 const &position,
@@ -110,19 +217,31 @@ std::shared_ptr< PlayingSample > play_3D(
 
 //Call 'Sound::loop' to play a sample ~forever~.
 //  if you hang on to the return value, you can change the panning, volume, or stop playback.
-std::shared_ptr< PlayingSample > loop(
+PlayingSample loop(
 	Sample const &sample,
 	float volume = 1.0f,
 	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
 );
 //The loop_3D version will loop a sample in '3D' mode (that is, panning determined by listener position):
-std::shared_ptr< PlayingSample > loop_3D(
+PlayingSample loop_3D(
 	Sample const &sample,
 	float volume,
 	glm::vec3 const &position,
 	float half_volume_radius = std::numeric_limits< float >::infinity()
 );
 
+//Streams can be played or looped as well (only in 2D mode):
+PlayingSample play(
+	Stream const &stream,
+	float volume = 1.0f,
+	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
+);
+PlayingSample loop(
+	Stream const &stream,
+	float volume = 1.0f,
+	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
+);
+
 //Listener controls the panning of "3D" samples (ones played using the "position" version of the play functions):
 struct Listener {
 	void set_position_right(glm::vec3 const &new_position, glm::vec3 const &new_right, float ramp = 1.0f / 60.0f);
@@ -133,16 +252,168 @@ struct Listener {
 };
 extern struct Listener listener;
 
+//The audio clock counts frames (at AudioRate) mixed since Sound::init().
+//  'frame' advances a mix block at a time; schedule play_at() calls at or after it (plus some margin for a slow game frame).
+//  'heard' smoothly estimates the frame coming out of the speakers right now; judge player timing against it.
+struct Clock {
+	uint64_t frame = 0; //first frame of the next block the mixer will produce
+	double heard = 0.0; //estimated frame currently being heard
+	float latency = 0.0f; //estimated seconds between a block being mixed and it starting to play
+};
+Clock now();
+
+//Mixer statistics, for catching audio glitches (and seeing what caused them); cheap enough to leave on in release builds.
+// The mixer records every block, and any thread may read the records without ever making the mixer wait:
+struct BlockStats {
+	uint64_t frame = 0; //audio frame the block starts at
+	float mix_time = 0.0f; //seconds spent mixing the block
+	float load = 0.0f; //mix_time as a fraction of the block's duration (at 1.0, the mixer can't keep up)
+	float interval = 0.0f; //seconds since the previous block started mixing (far over the block's duration: the device likely ran dry)
+	uint32_t active_voices = 0; //voices playing (real + virtual)
+	uint32_t real_voices = 0; //voices actually mixed
+	float peak = 0.0f; //largest absolute output value (over 1.0 clips)
+	float rms = 0.0f; //root-mean-square output value
+};
+struct Stats {
+	uint64_t blocks = 0; //blocks mixed since init()
+	uint64_t overruns = 0; //blocks that took longer to mix than they take to play
+	uint64_t late_blocks = 0; //blocks started over 1.5 block durations after the previous one (SDL and Null backends only)
+	uint64_t clipped_blocks = 0; //blocks with a peak over 1.0
+	uint64_t capture_dropped_blocks = 0; //blocks left out of captures (see start_capture()) because the writer fell behind
+	float max_load = 0.0f; //highest load of any block
+	BlockStats last; //most recent block
+};
+Stats stats();
+
+//number of blocks of history kept (~5 seconds, with 256-frame blocks):
+constexpr uint32_t StatsHistory = 1024;
+//copy stats for (up to) the 'count' most recent blocks into 'out', oldest first; returns the number copied:
+uint32_t stats_history(BlockStats *out, uint32_t count);
+//write the stats history as CSV (a header line, then a line per block):
+void write_stats_csv(std::ostream &out);
+
+//(offline backend only) mix the next 'frames' stereo frames into 'out' (interleaved left,right 48kHz float);
+// this runs the mixer synchronously, so the results are deterministic:
+void render(uint32_t frames, float *out);
+
 //"panic button" to shut off all currently playing sounds:
 void stop_all_samples();
 
+//limit the number of samples that are actually mixed each block (default: 64);
+// inaudible samples and samples beyond this budget are "virtual": they only advance their play position
+// (cheaply), and are mixed again once they are audible and within budget:
+void set_real_voice_budget(uint32_t budget);
+
 //set global volume:
 void set_volume(float new_volume, float ramp = 1.0f / 60.0f);
 extern Ramp< float > volume;
 
+//Record the final mix to a '.wav' file (48kHz stereo float), e.g. for QA repro or for measuring latency.
+// The mixer only copies each block into a ring buffer; a background thread does all the file writing.
+// If the writer ever falls behind, blocks are dropped (and counted in Stats::capture_dropped_blocks) rather than stalling the mixer.
+//returns false (with a warning) if the file can't be opened; stops any capture already running:
+bool start_capture(std::string const &filename);
+//finish writing the capture file (also done by shutdown()):
+void stop_capture();
+
+//level of the final output (after the master bus's effects and volume) in the most recent block:
+Level master_level();
+
+//set the volume of a bus (applied after the bus's effects); the Master bus volume is the global volume (as set_volume):
+void set_bus_volume(Bus bus, float new_volume, float ramp = 1.0f / 60.0f);
+
+//Effects process a bus's mix in place once per block, after all the bus's voices are mixed --
+// so an effect costs the same however many voices are playing on the bus.
+//process() runs on the mixer thread; subclasses take parameter changes through atomics (as Biquad and Compressor do)
+// so that the game thread never waits for the mixer to change a setting.
+struct Effect {
+	virtual ~Effect() { }
+	//process 'frames' frames of interleaved stereo (left,right) audio in place:
+	virtual void process(float *buffer, uint32_t frames) = 0;
+	//forget any filter/envelope state (called by the mixer when the effect is added to a bus):
+	virtual void reset() { }
+};
+
+//add an effect to the end of a bus's effect chain (at most MaxBusEffects per bus; an effect may only be on one bus);
+// the effect must stay alive until remove_effect() returns:
+constexpr uint32_t MaxBusEffects = 4;
+void add_effect(Bus bus, Effect *effect);
+//take an effect off a bus; waits until the mixer is done with it (so don't call between lock() and unlock()):
+void remove_effect(Bus bus, Effect *effect);
+
+//Biquad filter (designs from the "Audio EQ Cookbook"):
+struct Biquad : Effect {
+	enum Type : uint8_t {
+		LowPass,
+		HighPass,
+		Peak, //boost or cut by 'gain_db' around 'frequency'
+	};
+	Biquad(Type type = LowPass, float frequency = 1000.0f, float q = 0.7071f, float gain_db = 0.0f);
+	~Biquad();
+
+	//parameters (may be changed at any time; filter coefficients are recomputed at the start of the next block):
+	std::atomic< Type > type;
+	std::atomic< float > frequency; //Hz
+	std::atomic< float > q; //resonance (0.7071 is no resonance)
+	std::atomic< float > gain_db; //(Peak only)
+
+	void process(float *buffer, uint32_t frames) override;
+	void reset() override;
+
+	//internals (mixer thread only):
+	Type computed_type = LowPass; //parameters 'coefficients' were computed for
+	float computed_frequency = 0.0f, computed_q = 0.0f, computed_gain_db = 0.0f;
+	std::unique_ptr< ::BiquadCoefficients > coefficients;
+	float state[8] = {}; //(see biquad_stereo in mix_kernels.hpp)
+};
+
+//Simple feed-forward compressor: reduces the level of audio above 'threshold_db' by 'ratio' (e.g., 4 == 4dB in, 1dB out).
+// The level is tracked with a peak envelope that rises over 'attack' seconds and falls over 'release' seconds;
+// the gain follows it once every 16 frames (and is ramped in between).
+struct Compressor : Effect {
+	Compressor(float threshold_db = -12.0f, float ratio = 4.0f, float attack = 0.005f, float release = 0.1f, float makeup_db = 0.0f);
+
+	//parameters (may be changed at any time):
+	std::atomic< float > threshold_db;
+	std::atomic< float > ratio;
+	std::atomic< float > attack; //seconds
+	std::atomic< float > release; //seconds
+	std::atomic< float > makeup_db; //gain added after compression
+
+	void process(float *buffer, uint32_t frames) override;
+	void reset() override;
+
+	//internals (mixer thread only):
+	float envelope = 0.0f;
+	float gain = 1.0f;
+};
+
+//Convolution reverb: convolves audio with an impulse response (a recording of a space, or something synthesized).
+// Uses uniformly partitioned FFT convolution (see fft.hpp): the impulse response is cut into block-sized partitions,
+// and each block of output sums the products of their spectra with the spectra of recent blocks of input --
+// so the cost per block grows with (impulse response length / block size), and no latency is added.
+//Construct after Sound::init() (partitions are the mixer's block size); impulse responses of a few seconds are fine.
+struct ConvolutionReverb : Effect {
+	//impulse responses for the left and right channels (48kHz; leave 'right' empty to use 'left' for both):
+	ConvolutionReverb(std::vector< float > const &left, std::vector< float > const &right = std::vector< float >(), float wet = 0.3f, float dry = 1.0f);
+	~ConvolutionReverb();
+
+	std::atomic< float > wet; //level of the reverberated signal
+	std::atomic< float > dry; //level of the original signal
+	//while bypassed the audio passes through untouched, with no processing at all (the tail is cut off):
+	std::atomic< bool > bypass;
+
+	void process(float *buffer, uint32_t frames) override;
+	void reset() override;
+
+	//internals:
+	struct State; //partitioned impulse response and input history (defined in Sound.cpp)
+	std::unique_ptr< State > state;
+};
+
 //the audio callback doesn't run between Sound::lock() and Sound::unlock()
-// the set_*/stop/play/... functions already use these helpers, so you shouldn't need
-// to call them unless your code is modifying values directly:
+// the set_*/stop/play/... functions do *not* use these (they go through a lock-free command queue),
+// so you shouldn't need to call them unless your code is modifying values directly:
 void lock();
 void unlock();
 
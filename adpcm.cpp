@@ -0,0 +1,154 @@
+#include "adpcm.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace {
+	//standard IMA-ADPCM tables:
+	int32_t const StepTable[89] = {
+		7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+		19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+		50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+		130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+		337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+		876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+		2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+		5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+		15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+	};
+	int32_t const IndexTable[16] = {
+		-1, -1, -1, -1, 2, 4, 6, 8,
+		-1, -1, -1, -1, 2, 4, 6, 8
+	};
+
+	//shared by encoder and decoder so they stay in step:
+	inline void apply_code(uint8_t code, int32_t *predictor, int32_t *step_index) {
+		int32_t step = StepTable[*step_index];
+		//(selects rather than ifs, so this compiles without branches -- the decoder runs in the mixer)
+		int32_t diff = (step >> 3) + ((code & 4) ? step : 0) + ((code & 2) ? (step >> 1) : 0) + ((code & 1) ? (step >> 2) : 0);
+		*predictor += (code & 8) ? -diff : diff;
+		*predictor = std::max(-32768, std::min(32767, *predictor));
+		*step_index = std::max(0, std::min(88, *step_index + IndexTable[code]));
+	}
+
+	//code for sample 'k' (1 .. ADPCMBlockSamples-1) of a block:
+	inline uint8_t block_code(uint8_t const *block, uint32_t k) {
+		uint8_t byte = block[4 + (k - 1) / 2];
+		return ((k - 1) & 1) ? (byte >> 4) : (byte & 0xf);
+	}
+
+	//how far ahead of the decoder state a decode may start before it's cheaper to use the block header:
+	constexpr uint32_t const MAX_SKIP = 64;
+	//how far before the end of a decode to leave the state:
+	constexpr uint32_t const OVERLAP = 4;
+	//how many samples to compare when picking a block's starting step index:
+	constexpr uint32_t const TRIAL_SAMPLES = 64;
+
+	//encode (up to) the first 'limit' samples of one block (samples past 'count' are treated as silence);
+	// returns the squared error:
+	uint64_t encode_block(int16_t const *samples, uint32_t count, uint32_t limit, int32_t step_index, uint8_t *block, int32_t *final_step_index) {
+		int32_t predictor = samples[0];
+		uint64_t error = 0;
+		for (uint32_t k = 1; k < std::min(limit, ADPCMBlockSamples); ++k) {
+			int32_t sample = (k < count ? samples[k] : 0);
+			int32_t diff = sample - predictor;
+			uint8_t code = 0;
+			if (diff < 0) {
+				code = 8;
+				diff = -diff;
+			}
+			int32_t step = StepTable[step_index];
+			if (diff >= step) { code |= 4; diff -= step; }
+			step >>= 1;
+			if (diff >= step) { code |= 2; diff -= step; }
+			step >>= 1;
+			if (diff >= step) { code |= 1; }
+
+			apply_code(code, &predictor, &step_index);
+			error += uint64_t(int64_t(sample - predictor) * int64_t(sample - predictor));
+
+			if (block) block[4 + (k - 1) / 2] |= ((k - 1) & 1) ? uint8_t(code << 4) : code;
+		}
+		if (final_step_index) *final_step_index = step_index;
+		return error;
+	}
+}
+
+void adpcm_encode(int16_t const *samples, uint32_t count, std::vector< uint8_t > *blocks_) {
+	assert(samples || count == 0);
+	assert(blocks_);
+	auto &blocks = *blocks_;
+
+	int32_t step_index = 0;
+	for (uint32_t begin = 0; begin < count; begin += ADPCMBlockSamples) {
+		size_t at = blocks.size();
+		blocks.resize(at + ADPCMBlockBytes, 0);
+		uint8_t *block = blocks.data() + at;
+
+		//the step index carried over from the previous block adapts slowly to sudden changes in level (or to the
+		// start of the sample), so also try every step index and keep whichever starts the block best:
+		uint64_t best = encode_block(samples + begin, count - begin, TRIAL_SAMPLES, step_index, nullptr, nullptr);
+		for (int32_t candidate = 0; candidate < 89; ++candidate) {
+			uint64_t error = encode_block(samples + begin, count - begin, TRIAL_SAMPLES, candidate, nullptr, nullptr);
+			if (error < best) {
+				best = error;
+				step_index = candidate;
+			}
+		}
+
+		//header: first sample is stored exactly, then the starting step index:
+		block[0] = uint8_t(uint16_t(samples[begin]) & 0xff);
+		block[1] = uint8_t(uint16_t(samples[begin]) >> 8);
+		block[2] = uint8_t(step_index);
+		block[3] = 0;
+
+		encode_block(samples + begin, count - begin, ADPCMBlockSamples, step_index, block, &step_index);
+	}
+}
+
+void adpcm_decode(uint8_t const *blocks, uint32_t from, uint32_t count, float *out, ADPCMDecoder *state_) {
+	assert(blocks || count == 0);
+	assert(out || count == 0);
+	assert(state_);
+	auto &state = *state_;
+	if (count == 0) return;
+
+	//start from the state if it's close enough (and in the same block, or about to start the next one):
+	uint32_t position = state.position;
+	int32_t predictor = state.predictor;
+	int32_t step_index = state.step_index;
+	if (!(position != -1U && position <= from && from - position <= MAX_SKIP)) {
+		position = (from / ADPCMBlockSamples) * ADPCMBlockSamples;
+	}
+
+	//decode up to 'target', writing samples to 'dest' (if not null):
+	auto decode_to = [&](uint32_t target, float *dest) {
+		while (position < target) {
+			uint8_t const *block = blocks + size_t(position / ADPCMBlockSamples) * ADPCMBlockBytes;
+			uint32_t k = position % ADPCMBlockSamples;
+			if (k == 0) {
+				predictor = int16_t(uint16_t(block[0]) | (uint16_t(block[1]) << 8));
+				step_index = std::min< int32_t >(88, block[2]);
+				if (dest) *(dest++) = float(predictor) * (1.0f / 32768.0f);
+				position += 1;
+				k = 1;
+			}
+			//rest of this block (or up to target):
+			uint32_t stop = std::min(target - position, ADPCMBlockSamples - k);
+			for (uint32_t n = 0; n < stop; ++n) {
+				apply_code(block_code(block, k + n), &predictor, &step_index);
+				if (dest) *(dest++) = float(predictor) * (1.0f / 32768.0f);
+			}
+			position += stop;
+		}
+	};
+
+	uint32_t end = from + count;
+	uint32_t save_at = std::max(from, end - std::min(count, OVERLAP));
+	decode_to(from, nullptr);
+	decode_to(save_at, out);
+	state.position = position;
+	state.predictor = predictor;
+	state.step_index = step_index;
+	decode_to(end, out + (save_at - from));
+}
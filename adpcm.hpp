@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+//IMA-ADPCM (4 bits per sample) in fixed-size blocks; used for compressed Sound::Sample storage.
+// Each block starts with a 4-byte header (the block's first sample as int16, then the step index, then a spare byte)
+// followed by (ADPCMBlockSamples - 1) 4-bit codes, low nibble first. Blocks can be decoded independently,
+// which is what lets the mixer start playback (or seek) anywhere without decoding from the start of the sample.
+
+constexpr uint32_t ADPCMBlockBytes = 256;
+constexpr uint32_t ADPCMBlockSamples = 1 + (ADPCMBlockBytes - 4) * 2; //505
+
+//encode 'count' samples, appending whole blocks to 'blocks' (the last one is padded with silence):
+void adpcm_encode(int16_t const *samples, uint32_t count, std::vector< uint8_t > *blocks);
+
+//decoder state, so that each decode can pick up where the last one left off:
+struct ADPCMDecoder {
+	uint32_t position = -1U; //index of the next sample to decode (-1U: no state yet)
+	int32_t predictor = 0; //value of sample (position - 1)
+	int32_t step_index = 0;
+};
+
+//decode samples [from, from + count) as floats (scaled to [-1,1)) into 'out'.
+// Continues from 'state' when it is at or a little before 'from'; otherwise starts over at the header of from's block.
+// (afterward, the state is left a few samples before the end, so a following decode that overlaps slightly
+//  -- as interpolating playback does -- doesn't have to start over)
+void adpcm_decode(uint8_t const *blocks, uint32_t from, uint32_t count, float *out, ADPCMDecoder *state);
@@ -0,0 +1,287 @@
+#include "audio_convert.hpp"
+
+#include <SDL.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AUDIO_CONVERT_X86 1
+#include <immintrin.h>
+#endif
+
+//gcc and clang need to be told that a function may use AVX2 instructions; MSVC doesn't:
+#if defined(AUDIO_CONVERT_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+namespace {
+
+//read one value as a float in [-1,1):
+inline float pcm_value(PCMFormat format, uint8_t const *at) {
+	if (format == PCMFormat::U8) {
+		return (float(at[0]) - 128.0f) * (1.0f / 128.0f);
+	} else if (format == PCMFormat::S16) {
+		int16_t v;
+		std::memcpy(&v, at, 2);
+		return float(v) * (1.0f / 32768.0f);
+	} else if (format == PCMFormat::S24) {
+		//(put the three bytes at the top of an int32, so the sign comes along)
+		int32_t v = int32_t(uint32_t(at[0]) << 8 | uint32_t(at[1]) << 16 | uint32_t(at[2]) << 24);
+		return float(v) * (1.0f / 2147483648.0f);
+	} else if (format == PCMFormat::S32) {
+		int32_t v;
+		std::memcpy(&v, at, 4);
+		return float(v) * (1.0f / 2147483648.0f);
+	} else if (format == PCMFormat::F32) {
+		float v;
+		std::memcpy(&v, at, 4);
+		return v;
+	} else { assert(format == PCMFormat::F64);
+		double v;
+		std::memcpy(&v, at, 8);
+		return float(v);
+	}
+}
+
+//reference version; also used for the tail of the vectorized versions:
+void pcm_to_mono_scalar(PCMFormat format, uint32_t channels, uint8_t const *data, size_t frames, float *out) {
+	uint32_t bytes = pcm_format_bytes(format);
+	float scale = 1.0f / float(channels);
+	for (size_t f = 0; f < frames; ++f) {
+		float sum = 0.0f;
+		for (uint32_t c = 0; c < channels; ++c) {
+			sum += pcm_value(format, data + (f * channels + c) * bytes);
+		}
+		out[f] = sum * scale;
+	}
+}
+
+//zeroth-order modified Bessel function of the first kind (for the Kaiser window):
+double bessel_i0(double x) {
+	double sum = 1.0, term = 1.0;
+	for (uint32_t k = 1; k < 50; ++k) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < sum * 1e-12) break;
+	}
+	return sum;
+}
+
+//Resampler::process for each instruction set; STEP moves the position on to the next output:
+#define RESAMPLE_SETUP \
+	uint64_t position = uint64_t(begin) * r.from_rate; \
+	uint64_t i = position / r.to_rate; /* position of output 'begin' is i + frac / to_rate */ \
+	uint64_t frac = position % r.to_rate; \
+	uint64_t const step_i = r.from_rate / r.to_rate; \
+	uint64_t const step_frac = r.from_rate % r.to_rate;
+#define RESAMPLE_INPUTS \
+	float const *x = input + i + 1 - r.padding; \
+	float const *h = r.filter.data() + size_t((frac * r.phase_scale + (uint64_t(1) << 31)) >> 32) * r.taps; /* nearest phase */
+#define RESAMPLE_STEP \
+	i += step_i; \
+	frac += step_frac; \
+	if (frac >= r.to_rate) { \
+		frac -= r.to_rate; \
+		i += 1; \
+	}
+
+#ifndef AUDIO_CONVERT_X86
+void resample_scalar(Resampler const &r, float const *input, size_t begin, size_t end, float *out) {
+	RESAMPLE_SETUP
+	for (size_t k = begin; k < end; ++k) {
+		RESAMPLE_INPUTS
+		float acc = 0.0f;
+		for (uint32_t t = 0; t < r.taps; ++t) {
+			acc += x[t] * h[t];
+		}
+		out[k - begin] = acc;
+		RESAMPLE_STEP
+	}
+}
+#endif
+
+#ifdef AUDIO_CONVERT_X86
+void resample_sse2(Resampler const &r, float const *input, size_t begin, size_t end, float *out) {
+	RESAMPLE_SETUP
+	for (size_t k = begin; k < end; ++k) {
+		RESAMPLE_INPUTS
+		__m128 acc0 = _mm_setzero_ps();
+		__m128 acc1 = _mm_setzero_ps();
+		for (uint32_t t = 0; t < r.taps; t += 8) {
+			acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + t), _mm_loadu_ps(h + t)));
+			acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + t + 4), _mm_loadu_ps(h + t + 4)));
+		}
+		__m128 acc = _mm_add_ps(acc0, acc1);
+		acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+		acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(1, 1, 1, 1)));
+		out[k - begin] = _mm_cvtss_f32(acc);
+		RESAMPLE_STEP
+	}
+}
+
+TARGET_AVX2
+void resample_avx2(Resampler const &r, float const *input, size_t begin, size_t end, float *out) {
+	RESAMPLE_SETUP
+	for (size_t k = begin; k < end; ++k) {
+		RESAMPLE_INPUTS
+		__m256 acc0 = _mm256_setzero_ps();
+		__m256 acc1 = _mm256_setzero_ps();
+		for (uint32_t t = 0; t < r.taps; t += 16) {
+			acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(x + t), _mm256_loadu_ps(h + t)));
+			acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(x + t + 8), _mm256_loadu_ps(h + t + 8)));
+		}
+		__m256 sum = _mm256_add_ps(acc0, acc1);
+		__m128 acc = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+		acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+		acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(1, 1, 1, 1)));
+		out[k - begin] = _mm_cvtss_f32(acc);
+		RESAMPLE_STEP
+	}
+}
+#endif
+
+#undef RESAMPLE_SETUP
+#undef RESAMPLE_INPUTS
+#undef RESAMPLE_STEP
+
+}
+
+uint32_t pcm_format_bytes(PCMFormat format) {
+	switch (format) {
+		case PCMFormat::U8: return 1;
+		case PCMFormat::S16: return 2;
+		case PCMFormat::S24: return 3;
+		case PCMFormat::S32: return 4;
+		case PCMFormat::F32: return 4;
+		case PCMFormat::F64: return 8;
+	}
+	assert(0 && "unknown format");
+	return 0;
+}
+
+void pcm_to_mono(PCMFormat format, uint32_t channels, void const *data_, size_t frames, float *out) {
+	assert(channels > 0);
+	uint8_t const *data = reinterpret_cast< uint8_t const * >(data_);
+	size_t f = 0;
+	#ifdef AUDIO_CONVERT_X86
+	//the common cases, four frames at a time:
+	if (format == PCMFormat::S16 && channels == 2) {
+		__m128i ones = _mm_set1_epi16(1);
+		__m128 scale = _mm_set1_ps(0.5f / 32768.0f);
+		for (; f + 4 <= frames; f += 4) {
+			__m128i lr = _mm_loadu_si128(reinterpret_cast< __m128i const * >(data + f * 4));
+			//(multiply-add of adjacent pairs by one: left + right, as int32s)
+			__m128i sum = _mm_madd_epi16(lr, ones);
+			_mm_storeu_ps(out + f, _mm_mul_ps(_mm_cvtepi32_ps(sum), scale));
+		}
+	} else if (format == PCMFormat::S16 && channels == 1) {
+		__m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+		for (; f + 8 <= frames; f += 8) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast< __m128i const * >(data + f * 2));
+			//(sign-extend by putting each value in the top half of an int32 and shifting down)
+			__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+			__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+			_mm_storeu_ps(out + f + 0, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+			_mm_storeu_ps(out + f + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+		}
+	} else if (format == PCMFormat::F32 && channels == 2) {
+		__m128 half = _mm_set1_ps(0.5f);
+		for (; f + 4 <= frames; f += 4) {
+			__m128 a = _mm_loadu_ps(reinterpret_cast< float const * >(data + f * 8));
+			__m128 b = _mm_loadu_ps(reinterpret_cast< float const * >(data + f * 8 + 16));
+			__m128 l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+			__m128 r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+			_mm_storeu_ps(out + f, _mm_mul_ps(_mm_add_ps(l, r), half));
+		}
+	}
+	#endif
+	if (format == PCMFormat::F32 && channels == 1) {
+		std::memcpy(out + f, data + f * 4, (frames - f) * 4);
+		return;
+	}
+	pcm_to_mono_scalar(format, channels, data + f * channels * pcm_format_bytes(format), frames - f, out + f);
+}
+
+Resampler::Resampler(uint32_t from_rate_, uint32_t to_rate_) : from_rate(from_rate_), to_rate(to_rate_) {
+	assert(from_rate > 0 && to_rate > 0);
+
+	//output k is at input position k * from_rate / to_rate, so the fractional parts repeat every to_rate / gcd outputs:
+	phases = std::min(to_rate / std::gcd(from_rate, to_rate), MaxPhases);
+	//phase = frac * phases / to_rate (rounded to the nearest phase), as a multiply and shift:
+	// (phase_scale is rounded up, so the phase is exact when frac * phases / to_rate is a whole number)
+	phase_scale = ((uint64_t(phases) << 32) + to_rate - 1) / to_rate;
+
+	//when downsampling, the filter has to cut off below the *output's* Nyquist frequency,
+	// which stretches it over proportionally more inputs:
+	double bandwidth = std::min(1.0, double(to_rate) / double(from_rate));
+	double cutoff = 0.45 * bandwidth; //(in cycles per input sample)
+	uint32_t half = uint32_t(std::ceil(24.0 / bandwidth / 8.0)) * 8; //(so taps is a multiple of 16)
+	taps = 2 * half;
+	padding = half;
+
+	//Kaiser window with beta = 8 gives about 80dB of stopband attenuation:
+	double const beta = 8.0;
+	double const i0_beta = bessel_i0(beta);
+	double const pi = 3.14159265358979323846;
+
+	//(phase 'phases' is for outputs that round up to the next input; it is phase 0 moved over one tap)
+	filter.assign(size_t(phases + 1) * taps, 0.0f);
+	std::vector< double > weights(taps);
+	for (uint32_t p = 0; p <= phases; ++p) {
+		//tap t multiplies the input (t - half + 1) samples after the one at or just before the output position:
+		double sum = 0.0;
+		for (uint32_t t = 0; t < taps; ++t) {
+			double d = double(t) - double(half - 1) - double(p) / double(phases);
+			double x = d / double(half);
+			double window = (std::abs(x) < 1.0 ? bessel_i0(beta * std::sqrt(1.0 - x * x)) / i0_beta : 0.0);
+			double a = 2.0 * pi * cutoff * d;
+			double sinc = (std::abs(a) < 1e-9 ? 1.0 : std::sin(a) / a);
+			weights[t] = 2.0 * cutoff * sinc * window;
+			sum += weights[t];
+		}
+		//normalize so a constant signal stays exactly constant:
+		for (uint32_t t = 0; t < taps; ++t) {
+			filter[size_t(p) * taps + t] = float(weights[t] / sum);
+		}
+	}
+}
+
+size_t Resampler::output_frames(size_t frames) const {
+	return size_t((uint64_t(frames) * to_rate + from_rate - 1) / from_rate);
+}
+
+void Resampler::process(float const *input, size_t begin, size_t end, float *out) const {
+	#ifdef AUDIO_CONVERT_X86
+	static bool const avx2 = SDL_HasAVX2();
+	if (avx2) {
+		resample_avx2(*this, input, begin, end, out);
+	} else {
+		resample_sse2(*this, input, begin, end, out);
+	}
+	#else
+	resample_scalar(*this, input, begin, end, out);
+	#endif
+}
+
+void float_to_int16(float const *data, size_t count, int16_t *out) {
+	size_t k = 0;
+	#ifdef AUDIO_CONVERT_X86
+	//(cvtps rounds to nearest; packs saturates to the int16 range)
+	__m128 scale = _mm_set1_ps(32768.0f);
+	for (; k + 8 <= count; k += 8) {
+		__m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(data + k + 0), scale));
+		__m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(data + k + 4), scale));
+		_mm_storeu_si128(reinterpret_cast< __m128i * >(out + k), _mm_packs_epi32(lo, hi));
+	}
+	#endif
+	for (; k < count; ++k) {
+		float v = std::nearbyint(data[k] * 32768.0f);
+		out[k] = int16_t(std::max(-32768.0f, std::min(32767.0f, v)));
+	}
+}
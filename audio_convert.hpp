@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//Conversion of decoded audio into the mixer's format (48kHz float mono) -- used by load_wav.cpp.
+// In-house rather than SDL_AudioCVT, so resampling can use a proper windowed-sinc filter.
+// Every function works on a caller-chosen range, so long files can be split into chunks converted in parallel.
+// Inner loops are vectorized (SSE2 baseline, AVX2 for resampling if the CPU supports it), with a plain C++ fallback.
+
+//Sample formats found in WAV files (all little-endian; U8 is unsigned, the rest signed):
+enum class PCMFormat : uint8_t { U8, S16, S24, S32, F32, F64 };
+
+//bytes used by one value of 'format':
+uint32_t pcm_format_bytes(PCMFormat format);
+
+//Decode 'frames' frames of interleaved 'channels'-channel audio at 'data' (which need not be aligned),
+// averaging the channels into 'frames' mono floats in 'out':
+void pcm_to_mono(PCMFormat format, uint32_t channels, void const *data, size_t frames, float *out);
+
+//Resampling between two fixed rates with a polyphase windowed-sinc (Kaiser) filter:
+// flat (within 0.1dB) up to ~0.4 * the lower rate, and ~80dB down by the point where aliases/images would land in that band.
+//Filter phases are exact for rates with a small ratio (e.g., 44100 -> 48000 is 160 phases);
+// other ratios use the nearest of MaxPhases phases.
+struct Resampler {
+	Resampler(uint32_t from_rate, uint32_t to_rate);
+
+	uint32_t from_rate, to_rate;
+
+	//number of output frames for 'frames' input frames:
+	size_t output_frames(size_t frames) const;
+
+	//Compute output frames [begin,end) into 'out' (i.e., out[0] is output frame 'begin').
+	// 'input' is the whole input, which must have 'padding' zeros before its first and after its last frame:
+	void process(float const *input, size_t begin, size_t end, float *out) const;
+	uint32_t padding;
+
+	//internals:
+	static constexpr uint32_t MaxPhases = 1024;
+	uint32_t phases; //filter phase k is for outputs that land k / phases of the way between two inputs
+	uint64_t phase_scale; //(phases / to_rate, in 32.32 fixed point)
+	uint32_t taps; //taps per phase (a multiple of 16)
+	std::vector< float > filter; //(phases + 1) * taps weights (the extra phase is a whole input on from phase 0)
+};
+
+//Convert 'count' floats to 16-bit PCM (scaled by 32768, rounded, and clamped):
+void float_to_int16(float const *data, size_t count, int16_t *out);
@@ -0,0 +1,113 @@
+//Benchmark for capturing the mix to a file (Sound::start_capture):
+// compares the mixer's per-block times (from Sound::stats_history) without and with a capture running,
+// checks that the captured file holds exactly what was rendered, renders far faster than real time to
+// show that a writer that falls behind costs dropped blocks rather than a stalled mixer,
+// and times the copy into the capture ring that the mixer does each block.
+
+#include "Sound.hpp"
+#include "ring_buffer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main(int argc, char **argv) {
+	std::string filename = (argc > 1 ? argv[1] : "bench-capture.wav");
+	uint32_t const block = 256;
+	uint32_t const blocks = 1000; //per phase (fits in the stats history)
+	uint32_t const chunk = 10 * block; //frames rendered at a time
+
+	Sound::init(Sound::Backend::Offline, block);
+	std::vector< float > data(Sound::AudioRate);
+	for (uint32_t i = 0; i < data.size(); ++i) {
+		data[i] = 0.8f * std::sin(0.05f * float(i));
+	}
+	Sound::Sample sample(data);
+	for (uint32_t v = 0; v < 40; ++v) {
+		Sound::loop(sample, 0.02f, float(v) / 40.0f - 0.5f);
+	}
+
+	//render a phase's worth of blocks (paced a bit slower than real time, unless 'unpaced'), and summarize the mix times (if 'name' is set):
+	std::vector< float > rendered;
+	auto phase = [&](char const *name, bool keep, bool unpaced) {
+		std::vector< float > out(2 * chunk);
+		for (uint32_t b = 0; b < blocks; b += chunk / block) {
+			Sound::render(chunk, out.data());
+			if (keep) rendered.insert(rendered.end(), out.begin(), out.end());
+			if (!unpaced) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		if (!name) return;
+		std::vector< Sound::BlockStats > history(blocks);
+		history.resize(Sound::stats_history(history.data(), blocks));
+		std::vector< float > times;
+		for (auto const &h : history) times.emplace_back(h.mix_time);
+		std::sort(times.begin(), times.end());
+		double mean = 0.0;
+		for (float t : times) mean += t;
+		mean /= double(times.size());
+		std::cout << "  " << name << ": mix time mean " << mean * 1.0e6 << "us, median " << times[times.size() / 2] * 1.0e6
+			<< "us, 99% " << times[times.size() * 99 / 100] * 1.0e6 << "us; " << Sound::stats().capture_dropped_blocks << " blocks dropped so far" << std::endl;
+	};
+
+	std::cout << "40 voices, " << block << "-frame blocks, " << blocks << " blocks per run:" << std::endl;
+	phase("no capture", false, false);
+	if (!Sound::start_capture(filename)) return 1;
+	phase("capturing", true, false);
+	Sound::stop_capture();
+
+	{ //the file should hold exactly the rendered audio:
+		uint32_t const header = 58; //(see CAPTURE_WAV_HEADER_BYTES in Sound.cpp)
+		std::ifstream file(filename, std::ios::binary);
+		std::vector< char > bytes((std::istreambuf_iterator< char >(file)), std::istreambuf_iterator< char >());
+		uint32_t data_size = 0;
+		if (bytes.size() >= header) std::memcpy(&data_size, bytes.data() + header - 4, 4);
+		bool same = (bytes.size() == header + size_t(data_size)
+			&& data_size == rendered.size() * sizeof(float)
+			&& std::memcmp(bytes.data() + header, rendered.data(), data_size) == 0);
+		std::cout << "  captured " << data_size / 8 << " frames; " << (same ? "identical to" : "DIFFERENT from") << " the rendered output" << std::endl;
+	}
+
+	//rendering far faster than real time, the writer can't keep up:
+	if (!Sound::start_capture(filename)) return 1;
+	for (uint32_t run = 0; run < 20; ++run) {
+		phase(run == 0 || run == 19 ? "capturing, unpaced" : nullptr, false, true);
+	}
+	Sound::stop_capture();
+
+	Sound::shutdown();
+
+	{ //cost of the copy into the capture ring (as mix_block does it):
+		RingBuffer< float > ring(1 << 18);
+		std::vector< float > mixed(2 * block, 0.25f);
+		uint32_t const copies = 1000000;
+		auto before = std::chrono::steady_clock::now();
+		for (uint32_t c = 0; c < copies; ++c) {
+			uint32_t count = 2 * block;
+			if (ring.capacity() - ring.size() >= count) {
+				for (uint32_t done = 0; done < count; ) {
+					float *span;
+					uint32_t n = std::min(ring.write_span(&span), count - done);
+					std::copy(mixed.data() + done, mixed.data() + done + n, span);
+					ring.commit(n);
+					done += n;
+				}
+			}
+			//(drain now and then, like the writer thread)
+			if (c % 64 == 63) {
+				float const *span;
+				while (uint32_t n = ring.read_span(&span)) ring.consume(n);
+			}
+		}
+		auto after = std::chrono::steady_clock::now();
+		std::cout << "  copying a block into the capture ring: " << std::chrono::duration< double >(after - before).count() / copies * 1.0e9 << "ns" << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,229 @@
+//Benchmark for the OpenGL calls Scene::draw makes (as counted in its DrawStats) and their CPU cost, drawing each
+// drawable's matrices three ways: as per-drawable uniforms (ShowSceneProgram), read from the Pipeline::Objects texture
+// buffer (LitColorTextureProgram), and as instances (LitColorTextureProgram's Instanced variant).
+//Draws a scene file's drawables from its first camera -- first one drawable per Scene::draw (so no state is shared between
+// drawables, as when every draw set up all of its own state), then all at once -- and then a grid of 10000 copies of one mesh.
+//Run with the path of a scene and mesh file without their extensions (e.g., 'bench-draw-calls dist/final'), or with none for dist/hexapod.
+
+#include "Scene.hpp"
+#include "Mesh.hpp"
+#include "Load.hpp"
+#include "GL.hpp"
+#include "gl_errors.hpp"
+#include "data_path.hpp"
+#include "LitColorTextureProgram.hpp"
+#include "ShowSceneProgram.hpp"
+
+#include <SDL.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//vertex arrays that link a mesh buffer to each of the programs:
+struct Vaos {
+	GLuint uniforms = 0;
+	GLuint objects = 0;
+	GLuint instanced = 0;
+};
+
+enum Way { Uniforms, Objects, Instanced };
+static char const *way_names[3] = { "uniforms", "objects buffer", "instanced" };
+
+//point every drawable in 'scene' at the program that gets its matrices 'way' (keeping the mesh it draws):
+static void set_way(Scene &scene, Way way, Vaos const &vaos) {
+	for (auto &drawable : scene.drawables) {
+		Scene::Drawable::Pipeline mesh = drawable.pipeline;
+		drawable.pipeline = (way == Uniforms ? show_scene_program_pipeline : lit_color_texture_program_pipeline);
+		drawable.pipeline.vao = (way == Uniforms ? vaos.uniforms : vaos.objects);
+		//(the same texture every way, so the ways differ only in how matrices get to the program)
+		drawable.pipeline.textures[0] = lit_color_texture_program_pipeline.textures[0];
+		if (way == Instanced) drawable.pipeline.instanced.vao = vaos.instanced;
+		drawable.pipeline.type = mesh.type;
+		drawable.pipeline.start = mesh.start;
+		drawable.pipeline.count = mesh.count;
+		drawable.pipeline.min = mesh.min;
+		drawable.pipeline.max = mesh.max;
+	}
+}
+
+//draw 'scene' a few times; report the counts from the last draw and the least CPU time taken by a draw:
+// (if 'alone' is set, each draw is one Scene::draw per drawable, with the counts summed)
+static void bench(std::string const &name, Scene &scene, Scene::Camera const &camera, bool alone) {
+	uint32_t frames = 20;
+
+	//drawables hidden by giving them no program (draw() skips them):
+	std::vector< GLuint > programs;
+	for (auto const &drawable : scene.drawables) programs.emplace_back(drawable.pipeline.program);
+
+	Scene::DrawStats stats;
+	double best = 1e30;
+	for (uint32_t f = 0; f <= frames; ++f) {
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glFinish(); //(so the time below is just this draw's)
+
+		auto before = std::chrono::high_resolution_clock::now();
+		if (alone) {
+			stats = Scene::DrawStats();
+			for (auto &drawable : scene.drawables) drawable.pipeline.program = 0;
+			uint32_t i = 0;
+			for (auto &drawable : scene.drawables) {
+				drawable.pipeline.program = programs[i++];
+				Scene::DrawStats one = scene.draw(camera);
+				drawable.pipeline.program = 0;
+				stats.drawn += one.drawn;
+				stats.culled += one.culled;
+				stats.draw_calls += one.draw_calls;
+				stats.gl_calls += one.gl_calls;
+			}
+			uint32_t j = 0;
+			for (auto &drawable : scene.drawables) drawable.pipeline.program = programs[j++];
+		} else {
+			stats = scene.draw(camera);
+		}
+		auto after = std::chrono::high_resolution_clock::now();
+
+		if (f > 0) best = std::min(best, std::chrono::duration< double >(after - before).count()); //(first frame is a warm-up)
+	}
+	GL_ERRORS();
+
+	std::cout << "  " << name << ": " << stats.drawn << " drawn (" << stats.culled << " culled), " << stats.draw_calls << " draw calls, "
+		<< stats.gl_calls << " GL calls; " << best * 1000.0 << " ms CPU" << std::endl;
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	//when compiled on windows, unhandled exceptions don't have their message printed, which can make debugging simple issues difficult.
+	try {
+#endif
+	std::string base = (argc > 1 ? argv[1] : data_path("../dist/hexapod"));
+
+	//------------  initialization ------------
+	//(like main.cpp, but with a hidden window and no vsync, since nothing is shown)
+
+	SDL_Init(SDL_INIT_VIDEO);
+
+	SDL_GL_ResetAttributes();
+	SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
+	SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
+	SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
+	SDL_GL_SetAttribute(SDL_GL_ALPHA_SIZE, 8);
+	SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
+	SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+
+	SDL_Window *window = SDL_CreateWindow(
+		"bench-draw-calls",
+		SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+		512, 512,
+		SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN
+	);
+	if (!window) {
+		std::cerr << "Error creating SDL window: " << SDL_GetError() << std::endl;
+		return 1;
+	}
+
+	SDL_GLContext context = SDL_GL_CreateContext(window);
+	if (!context) {
+		SDL_DestroyWindow(window);
+		std::cerr << "Error creating OpenGL context: " << SDL_GetError() << std::endl;
+		return 1;
+	}
+
+	init_GL();
+	SDL_GL_SetSwapInterval(0);
+
+	call_load_functions();
+
+	glViewport(0, 0, 512, 512);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LESS);
+
+	//------------ benchmark --------------
+
+	MeshBuffer meshes(base + ".pnct");
+	Vaos vaos;
+	vaos.uniforms = meshes.make_vao_for_program(show_scene_program->program);
+	vaos.objects = meshes.make_vao_for_program(lit_color_texture_program->program);
+	vaos.instanced = meshes.make_vao_for_program(lit_color_texture_instanced_program->program, lit_color_texture_instanced_program->instance_buffer);
+
+	{ //the scene file's drawables:
+		Scene scene(base + ".scene", [&](Scene &scene, Scene::Transform *transform, std::string const &mesh_name){
+			Mesh const &mesh = meshes.lookup(mesh_name);
+			scene.drawables.emplace_back(transform);
+			Scene::Drawable &drawable = scene.drawables.back();
+			drawable.pipeline.type = mesh.type;
+			drawable.pipeline.start = mesh.start;
+			drawable.pipeline.count = mesh.count;
+			drawable.pipeline.min = mesh.min;
+			drawable.pipeline.max = mesh.max;
+		});
+		if (scene.cameras.empty()) {
+			std::cerr << "Scene '" << base << ".scene' has no camera to draw from." << std::endl;
+			return 1;
+		}
+		Scene::Camera const &camera = scene.cameras.front();
+
+		std::cout << base << ".scene (" << scene.drawables.size() << " drawables), best of 20 draws:" << std::endl;
+		for (Way way : { Uniforms, Objects, Instanced }) {
+			set_way(scene, way, vaos);
+			bench(std::string(way_names[way]) + ", one drawable per draw", scene, camera, true);
+			bench(way_names[way], scene, camera, false);
+		}
+	}
+
+	{ //many copies of one mesh (the first in the buffer), in a grid, all in view:
+		Mesh const &mesh = meshes.meshes.begin()->second;
+		glm::vec3 size = glm::max(mesh.max - mesh.min, glm::vec3(0.1f));
+		float spacing = 1.5f * std::max(size.x, size.y);
+		uint32_t const side = 100;
+
+		Scene scene;
+		for (uint32_t i = 0; i < side * side; ++i) {
+			scene.transforms.emplace_back();
+			Scene::Transform *transform = &scene.transforms.back();
+			transform->position = spacing * glm::vec3(float(i % side), float(i / side), 0.0f);
+			scene.drawables.emplace_back(transform);
+			Scene::Drawable &drawable = scene.drawables.back();
+			drawable.pipeline.type = mesh.type;
+			drawable.pipeline.start = mesh.start;
+			drawable.pipeline.count = mesh.count;
+			drawable.pipeline.min = mesh.min;
+			drawable.pipeline.max = mesh.max;
+		}
+		//looking straight down (along -z) from high enough to see the whole grid:
+		scene.transforms.emplace_back();
+		Scene::Transform *eye = &scene.transforms.back();
+		eye->position = glm::vec3(0.5f * spacing * float(side), 0.5f * spacing * float(side), 1.2f * spacing * float(side) + size.z);
+		Scene::Camera camera(eye);
+
+		std::cout << side * side << " copies of '" << meshes.meshes.begin()->first << "', best of 20 draws:" << std::endl;
+		for (Way way : { Uniforms, Objects, Instanced }) {
+			set_way(scene, way, vaos);
+			bench(way_names[way], scene, camera, false);
+		}
+	}
+
+	//------------  teardown ------------
+	SDL_GL_DeleteContext(context);
+	context = 0;
+
+	SDL_DestroyWindow(window);
+	window = NULL;
+
+	return 0;
+
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}
@@ -0,0 +1,116 @@
+//Benchmark for the voice mixing kernel (see mix_kernels.hpp):
+// mixes a block of many looping voices the way Sound.cpp's mixer originally did -- one frame at a time,
+// stepping the pan ramp and checking for the loop point on every frame -- and then with mix_mono_to_stereo
+// called on the runs of frames between loop points, and checks that the two mixes agree.
+
+#include "mix_kernels.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <vector>
+
+struct Voice {
+	std::vector< float > data;
+	uint32_t i = 0;
+	float start_l = 0.0f, start_r = 0.0f; //gains at the start of the block...
+	float end_l = 0.0f, end_r = 0.0f; //...and at its end
+};
+
+int main(int argc, char **argv) {
+	uint32_t voice_count = (argc > 1 ? uint32_t(std::atoi(argv[1])) : 256);
+	uint32_t const block = 1024;
+	uint32_t const blocks = 50;
+
+	std::mt19937 mt(0xb10cf00d);
+	std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+	std::vector< Voice > voices(voice_count);
+	for (auto &voice : voices) {
+		//short samples, so the loop point is crossed often:
+		voice.data.resize(300 + mt() % 3000);
+		float f = 0.01f + 0.1f * unit(mt);
+		for (uint32_t i = 0; i < voice.data.size(); ++i) {
+			voice.data[i] = std::sin(f * float(i));
+		}
+		voice.start_l = unit(mt) / voice_count;
+		voice.start_r = unit(mt) / voice_count;
+		voice.end_l = unit(mt) / voice_count;
+		voice.end_r = unit(mt) / voice_count;
+	}
+
+	//the original per-frame loop:
+	auto mix_scalar = [&](float *out) {
+		for (auto &voice : voices) {
+			float pan_l = voice.start_l, pan_r = voice.start_r;
+			float step_l = (voice.end_l - voice.start_l) / block;
+			float step_r = (voice.end_r - voice.start_r) / block;
+			for (uint32_t f = 0; f < block; ++f) {
+				out[2*f+0] += pan_l * voice.data[voice.i];
+				out[2*f+1] += pan_r * voice.data[voice.i];
+				voice.i += 1;
+				if (voice.i == voice.data.size()) voice.i = 0;
+				pan_l += step_l;
+				pan_r += step_r;
+			}
+		}
+	};
+
+	//the kernel, called once per run of frames between loop points:
+	auto mix_kernel = [&](float *out) {
+		for (auto &voice : voices) {
+			float step_l = (voice.end_l - voice.start_l) / block;
+			float step_r = (voice.end_r - voice.start_r) / block;
+			MixLevel level;
+			uint32_t f = 0;
+			while (f < block) {
+				uint32_t run = std::min(block - f, uint32_t(voice.data.size()) - voice.i);
+				mix_mono_to_stereo(out + 2*f, voice.data.data() + voice.i, run,
+					voice.start_l + f * step_l, voice.start_r + f * step_r, step_l, step_r, &level);
+				f += run;
+				voice.i += run;
+				if (voice.i == voice.data.size()) voice.i = 0;
+			}
+		}
+	};
+
+	std::vector< float > out(2 * block);
+	auto time = [&](std::string const &name, std::function< void(float *) > const &mix) {
+		for (auto &voice : voices) voice.i = 0;
+		std::fill(out.begin(), out.end(), 0.0f);
+		mix(out.data()); //(warm up)
+		double best = 1e30;
+		for (uint32_t b = 0; b < blocks; ++b) {
+			std::fill(out.begin(), out.end(), 0.0f);
+			auto before = std::chrono::high_resolution_clock::now();
+			mix(out.data());
+			auto after = std::chrono::high_resolution_clock::now();
+			best = std::min(best, std::chrono::duration< double >(after - before).count());
+		}
+		double block_seconds = double(block) / 48000.0;
+		std::cout << "  " << name << ": " << best * 1.0e6 << " us/block (" << 100.0 * best / block_seconds << "% of a core)" << std::endl;
+		return best;
+	};
+
+	std::cout << voice_count << " looping voices, " << block << "-frame blocks, best of " << blocks << " blocks:" << std::endl;
+	double scalar = time("per-frame loop", mix_scalar);
+	double kernel = time(std::string("mix_mono_to_stereo (") + mix_kernels_variant() + ")", mix_kernel);
+	std::cout << "  (kernel is " << scalar / kernel << "x faster)" << std::endl;
+
+	//check that both mix the same block:
+	std::vector< float > expected(2 * block, 0.0f), got(2 * block, 0.0f);
+	for (auto &voice : voices) voice.i = 0;
+	mix_scalar(expected.data());
+	for (auto &voice : voices) voice.i = 0;
+	mix_kernel(got.data());
+	float max_error = 0.0f;
+	for (uint32_t i = 0; i < 2 * block; ++i) {
+		max_error = std::max(max_error, std::abs(expected[i] - got[i]));
+	}
+	std::cout << "  max difference between the mixes: " << max_error << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,84 @@
+//Benchmark for Sound::ConvolutionReverb: CPU cost per block against impulse-response length.
+// Also checks the reverb's output against direct (time-domain) convolution with a short impulse response.
+
+#include "Sound.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+int main(int argc, char **argv) {
+	uint32_t block = (argc > 1 ? uint32_t(std::atoi(argv[1])) : 1024);
+	Sound::init(Sound::Backend::Offline, block);
+	block = Sound::block_size();
+
+	std::mt19937 mt(0x0e7e4b);
+	std::uniform_real_distribution< float > unit(-0.5f, 0.5f);
+
+	{ //check against direct convolution:
+		std::vector< float > left(3000), right(2500);
+		for (auto &v : left) v = unit(mt);
+		for (auto &v : right) v = unit(mt);
+		float const wet = 0.5f, dry = 0.7f;
+		Sound::ConvolutionReverb reverb(left, right, wet, dry);
+
+		uint32_t frames = 12 * block;
+		std::vector< float > input(2 * frames);
+		for (uint32_t i = 0; i < frames; ++i) {
+			input[2*i+0] = unit(mt);
+			input[2*i+1] = std::sin(0.01f * float(i));
+		}
+		std::vector< float > output = input;
+		for (uint32_t b = 0; b < frames; b += block) {
+			reverb.process(output.data() + 2 * b, block);
+		}
+
+		double max_error = 0.0, peak = 0.0;
+		for (uint32_t c = 0; c < 2; ++c) {
+			std::vector< float > const &ir = (c == 0 ? left : right);
+			for (uint32_t n = 0; n < frames; ++n) {
+				double y = 0.0;
+				for (uint32_t k = 0; k < ir.size() && k <= n; ++k) {
+					y += double(ir[k]) * double(input[2*(n-k)+c]);
+				}
+				double expected = dry * input[2*n+c] + wet * y;
+				max_error = std::max(max_error, std::abs(expected - output[2*n+c]));
+				peak = std::max(peak, std::abs(expected));
+			}
+		}
+		std::cout << "vs. direct convolution: max error " << max_error << " (output peak " << peak << ")" << std::endl;
+	}
+
+	//cost per block, for impulse responses of increasing length:
+	double block_seconds = double(block) / Sound::AudioRate;
+	std::cout << block << "-frame blocks (" << block_seconds * 1.0e3 << "ms), stereo impulse responses:" << std::endl;
+	for (float seconds : { 0.25f, 0.5f, 1.0f, 2.0f, 4.0f, 8.0f }) {
+		std::vector< float > left(uint32_t(seconds * Sound::AudioRate)), right(left.size());
+		for (uint32_t i = 0; i < left.size(); ++i) {
+			float decay = std::exp(-6.0f * float(i) / float(left.size()));
+			left[i] = unit(mt) * decay;
+			right[i] = unit(mt) * decay;
+		}
+		Sound::ConvolutionReverb reverb(left, right);
+
+		std::vector< float > buffer(2 * block);
+		uint32_t blocks = uint32_t(4.0 / block_seconds);
+		double best = 1e30;
+		for (uint32_t b = 0; b < blocks; ++b) {
+			for (auto &v : buffer) v = unit(mt);
+			auto before = std::chrono::high_resolution_clock::now();
+			reverb.process(buffer.data(), block);
+			auto after = std::chrono::high_resolution_clock::now();
+			best = std::min(best, std::chrono::duration< double >(after - before).count());
+		}
+		std::cout << "  " << seconds << "s (" << (left.size() + block - 1) / block << " partitions): "
+			<< best * 1.0e6 << " us/block (" << 100.0 * best / block_seconds << "% of a block's time)" << std::endl;
+	}
+
+	Sound::shutdown();
+	return 0;
+}
@@ -0,0 +1,107 @@
+//Stress test for the game thread -> mixer command queue:
+// the null backend's timer thread mixes small blocks in real time while this (game) thread calls the
+// PlayingSample / Listener setters as fast as it can (and keeps starting and stopping voices).
+//Every block's mix time is recorded by the mixer (see Sound::stats_history), so comparing a quiet run
+// with a hammered one shows whether the mixer ever waits on the game thread.
+
+#include "Sound.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+int main(int argc, char **argv) {
+	float seconds = (argc > 1 ? float(std::atof(argv[1])) : 2.0f);
+	uint32_t voice_count = 64;
+
+	Sound::init(Sound::Backend::Null, Sound::MinBlockSize);
+
+	std::vector< float > data(Sound::AudioRate);
+	for (uint32_t i = 0; i < data.size(); ++i) {
+		data[i] = 0.1f * std::sin(float(i) * 0.05f);
+	}
+	Sound::Sample sample(data);
+
+	std::vector< Sound::PlayingSample > playing;
+	for (uint32_t v = 0; v < voice_count; ++v) {
+		playing.emplace_back(Sound::loop_3D(sample, 0.5f, glm::vec3(float(v), 0.0f, 0.0f), 4.0f));
+	}
+
+	//run 'game' for a while, then summarize the mix times of the blocks mixed meanwhile:
+	auto run = [&](char const *name, std::function< uint64_t() > const &game) {
+		uint64_t blocks_before = Sound::stats().blocks;
+		uint64_t calls = 0;
+		auto start = std::chrono::steady_clock::now();
+		auto end = start + std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< float >(seconds));
+		while (std::chrono::steady_clock::now() < end) {
+			calls += game();
+		}
+		float elapsed = std::chrono::duration< float >(std::chrono::steady_clock::now() - start).count();
+
+		Sound::Stats stats = Sound::stats();
+		std::vector< Sound::BlockStats > history(Sound::StatsHistory);
+		uint32_t count = uint32_t(std::min< uint64_t >(stats.blocks - blocks_before, Sound::StatsHistory));
+		count = Sound::stats_history(history.data(), count);
+		history.resize(count);
+
+		std::vector< float > mix_times;
+		float max_interval = 0.0f;
+		for (auto const &block : history) {
+			mix_times.emplace_back(block.mix_time);
+			max_interval = std::max(max_interval, block.interval);
+		}
+		std::sort(mix_times.begin(), mix_times.end());
+		auto percentile = [&](float p) {
+			if (mix_times.empty()) return 0.0f;
+			return mix_times[std::min(size_t(p * mix_times.size()), mix_times.size() - 1)];
+		};
+
+		float block_us = 1.0e6f * float(Sound::block_size()) / float(Sound::AudioRate);
+		std::cout << name << ": " << calls / elapsed * 1.0e-6f << "M setter calls/s, " << count << " blocks of " << block_us << "us;\n"
+			<< "  mix time median " << percentile(0.5f) * 1.0e6f << "us, 99% " << percentile(0.99f) * 1.0e6f << "us, max " << percentile(1.0f) * 1.0e6f << "us;"
+			<< " longest interval " << max_interval * 1.0e6f << "us" << std::endl;
+	};
+
+	std::cout << voice_count << " looping 3D voices; " << seconds << " seconds per run:" << std::endl;
+
+	run("quiet", [&]() -> uint64_t {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		return 0;
+	});
+
+	uint32_t step = 0;
+	run("hammered", [&]() -> uint64_t {
+		uint64_t calls = 0;
+		step += 1;
+		float t = float(step) * 0.001f;
+		for (auto &p : playing) {
+			p.set_volume(0.25f + 0.25f * std::sin(t), 0.01f);
+			p.set_position(glm::vec3(std::cos(t), std::sin(t), 0.0f), 0.01f);
+			p.set_half_volume_radius(2.0f + std::sin(t));
+			p.set_rate(1.0f + 0.1f * std::sin(t));
+			p.set_priority(t);
+			calls += 5;
+		}
+		Sound::listener.set_position_right(glm::vec3(0.0f, std::sin(t), 0.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+		calls += 1;
+		//replace a voice now and then, so play/stop go through the queue too:
+		if (step % 16 == 0) {
+			uint32_t v = step / 16 % voice_count;
+			playing[v].stop();
+			playing[v] = Sound::loop_3D(sample, 0.5f, glm::vec3(float(v), 0.0f, 0.0f), 4.0f);
+			calls += 2;
+		}
+		return calls;
+	});
+
+	Sound::Stats stats = Sound::stats();
+	std::cout << "overall: " << stats.blocks << " blocks, " << stats.overruns << " overruns, " << stats.late_blocks << " late, max load " << stats.max_load << std::endl;
+
+	Sound::shutdown();
+	return 0;
+}
@@ -0,0 +1,68 @@
+//Benchmark for mixing thousands of voices, optionally on worker threads:
+// plays many looping samples (a mix of formats and pitches) on the offline backend, with the real voice budget
+// raised so every one of them is mixed, and reports the mixing time per block.
+//Run it with different thread counts to compare (e.g., 'bench-sound-voices 4000 0' vs 'bench-sound-voices 4000 3');
+// the output level it prints should agree between runs, up to rounding.
+
+#include "Sound.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+
+int main(int argc, char **argv) {
+	uint32_t voice_count = (argc > 1 ? uint32_t(std::atoi(argv[1])) : 4000);
+	uint32_t threads = (argc > 2 ? uint32_t(std::atoi(argv[2])) : 0);
+	uint32_t const block = 512;
+	uint32_t const seconds = 5;
+	voice_count = std::min(voice_count, Sound::MaxVoices);
+
+	Sound::init(Sound::Backend::Offline, block, threads);
+	Sound::set_real_voice_budget(voice_count);
+
+	//a few samples of different lengths and formats:
+	std::mt19937 mt(0x5eed5);
+	std::vector< std::unique_ptr< Sound::Sample > > samples;
+	Sound::Sample::Format const formats[3] = { Sound::Sample::Format::Float32, Sound::Sample::Format::Int16, Sound::Sample::Format::ADPCM };
+	for (uint32_t s = 0; s < 12; ++s) {
+		std::vector< float > data(Sound::AudioRate / 4 + mt() % Sound::AudioRate);
+		float f = 0.01f + 0.002f * float(s);
+		for (uint32_t i = 0; i < data.size(); ++i) {
+			data[i] = 0.5f * std::sin(f * float(i));
+		}
+		samples.emplace_back(new Sound::Sample(data, formats[s % 3]));
+	}
+
+	//every voice loops (so the count stays put), a quarter of them pitched:
+	std::uniform_real_distribution< float > unit(-1.0f, 1.0f);
+	for (uint32_t v = 0; v < voice_count; ++v) {
+		Sound::PlayingSample playing = Sound::loop(*samples[v % samples.size()], 1.0f / std::sqrt(float(voice_count)), unit(mt));
+		if (v % 4 == 0) playing.set_rate(1.0f + 0.25f * unit(mt), 0.0f);
+	}
+
+	std::vector< float > out(2 * block);
+	Sound::render(block, out.data()); //(starts every voice)
+
+	double sum_squares = 0.0;
+	auto before = std::chrono::steady_clock::now();
+	uint32_t blocks = seconds * Sound::AudioRate / block;
+	for (uint32_t b = 0; b < blocks; ++b) {
+		Sound::render(block, out.data());
+		for (float v : out) sum_squares += double(v) * double(v);
+	}
+	auto after = std::chrono::steady_clock::now();
+
+	double per_block = std::chrono::duration< double >(after - before).count() / blocks;
+	Sound::Stats stats = Sound::stats();
+	std::cout << stats.last.real_voices << " of " << stats.last.active_voices << " voices mixed, " << threads << " worker threads:\n"
+		<< "  " << per_block * 1.0e6 << " us per " << block << "-frame block (load " << per_block / (double(block) / Sound::AudioRate) << ", max " << stats.max_load << ")\n"
+		<< "  output rms " << std::sqrt(sum_squares / (2.0 * block * blocks)) << std::endl;
+
+	Sound::shutdown();
+	return 0;
+}
@@ -0,0 +1,129 @@
+//Benchmark for computing world matrices of many transforms:
+// compares computing each transform's matrix by recursing up its parent chain (the way Scene::Transform used to)
+// with Scene::update_world_matrices(), which brings all of them up to date in one pass over flat, depth-sorted arrays,
+// followed by make_local_to_world() on every transform twice (as ShowSceneMode::draw does), which then checks the transform's parent
+// chain for changes and reads the cache.
+//Each is timed with every rig moving, with a tenth of them moving, and with nothing moving.
+//Run with a transform count (e.g., 'bench-transforms 100000'), or with none for 6200 (200 hexapod-like rigs) and 100000.
+
+#include "Scene.hpp"
+
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+//the recursive, pointer-chasing way to compute a world matrix:
+static glm::mat4x3 recursive_local_to_world(Scene::Transform const &transform) {
+	if (!transform.parent) {
+		return transform.make_local_to_parent();
+	} else {
+		return recursive_local_to_world(*transform.parent) * glm::mat4(transform.make_local_to_parent());
+	}
+}
+
+static void bench(uint32_t count) {
+	uint32_t frames = 20;
+
+	//build a forest of small rigs (each a root with six chains of five transforms, like a hexapod):
+	Scene scene;
+	std::mt19937 mt(0x15e7f00d);
+	std::uniform_real_distribution< float > unit(-1.0f, 1.0f);
+	std::vector< Scene::Transform * > roots;
+	while (scene.transforms.size() < count) {
+		scene.transforms.emplace_back();
+		Scene::Transform *root = &scene.transforms.back();
+		root->position = glm::vec3(100.0f * unit(mt), 100.0f * unit(mt), 0.0f);
+		roots.emplace_back(root);
+		for (uint32_t leg = 0; leg < 6 && scene.transforms.size() < count; ++leg) {
+			Scene::Transform *parent = root;
+			for (uint32_t joint = 0; joint < 5 && scene.transforms.size() < count; ++joint) {
+				scene.transforms.emplace_back();
+				Scene::Transform *t = &scene.transforms.back();
+				t->parent = parent;
+				t->position = glm::vec3(unit(mt), unit(mt), unit(mt));
+				t->rotation = glm::normalize(glm::quat(unit(mt), unit(mt), unit(mt), unit(mt)));
+				t->scale = glm::vec3(1.0f + 0.1f * unit(mt));
+				parent = t;
+			}
+		}
+	}
+
+	//every frame, the first 'moving' rigs turn:
+	uint32_t frame = 0;
+	uint32_t moving = 0;
+	auto animate = [&]() {
+		++frame;
+		for (uint32_t r = 0; r < moving; ++r) {
+			roots[r]->rotation = glm::angleAxis(0.01f * float(frame), glm::vec3(0.0f, 0.0f, 1.0f));
+		}
+	};
+
+	using Clock = std::chrono::high_resolution_clock;
+	auto time = [&](std::function< void() > const &compute) {
+		compute(); //(warm up)
+		double best = 1e30;
+		for (uint32_t f = 0; f < frames; ++f) {
+			animate();
+			auto before = Clock::now();
+			compute();
+			auto after = Clock::now();
+			best = std::min(best, std::chrono::duration< double >(after - before).count());
+		}
+		return best;
+	};
+
+	std::cout << scene.transforms.size() << " transforms (" << roots.size() << " rigs, depth 6), best of " << frames << " frames:" << std::endl;
+
+	float sink = 0.0f;
+	for (uint32_t m : { uint32_t(roots.size()), uint32_t(roots.size() / 10), 0U }) {
+		moving = m;
+		double recursive = time([&]() {
+			for (auto const &t : scene.transforms) {
+				sink += recursive_local_to_world(t)[3].x;
+				sink += recursive_local_to_world(t)[3].y;
+			}
+		});
+		double update = time([&]() {
+			scene.update_world_matrices();
+		});
+		double cached = time([&]() {
+			scene.update_world_matrices();
+			for (auto const &t : scene.transforms) {
+				sink += t.make_local_to_world()[3].x;
+				sink += t.make_local_to_world()[3].y;
+			}
+		});
+		std::cout << "  " << m << " rigs moving: recursive " << recursive * 1000.0 << " ms; update_world_matrices " << update * 1000.0
+			<< " ms, then cached " << cached * 1000.0 << " ms (" << recursive / cached << "x faster)" << std::endl;
+	}
+
+	//check that the cached matrices match the recursive ones (after moving everything once more):
+	moving = uint32_t(roots.size());
+	animate();
+	scene.update_world_matrices();
+	float max_error = 0.0f;
+	for (auto const &t : scene.transforms) {
+		glm::mat4x3 a = recursive_local_to_world(t);
+		glm::mat4x3 b = t.make_local_to_world();
+		for (uint32_t c = 0; c < 4; ++c) {
+			for (uint32_t r = 0; r < 3; ++r) {
+				max_error = std::max(max_error, std::abs(a[c][r] - b[c][r]));
+			}
+		}
+	}
+	std::cout << "  largest difference between methods: " << max_error << (sink == 0.1234f ? " " : "") << std::endl;
+}
+
+int main(int argc, char **argv) {
+	if (argc > 1) {
+		bench(uint32_t(std::atoi(argv[1])));
+	} else {
+		bench(6200);
+		bench(100000);
+	}
+	return 0;
+}
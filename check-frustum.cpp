@@ -0,0 +1,85 @@
+//Check for the view-frustum culling test Scene::draw uses (Frustum::outside):
+// for random boxes seen from a few random cameras, compares it with a brute-force version (a box is outside when all
+// eight of its corners are outside the same plane), makes sure no box with a visible point is ever culled,
+// and times the test. Exits with a non-zero status if anything disagrees.
+
+#include "Frustum.hpp"
+#include "Scene.hpp"
+
+#include <glm/gtc/quaternion.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+int main() {
+	uint32_t const boxes = 200000;
+	uint32_t const cameras = 4;
+
+	std::mt19937 mt(0xf055e7);
+	std::uniform_real_distribution< float > unit(-1.0f, 1.0f);
+
+	uint32_t culled = 0, recounted = 0, mismatches = 0, culled_visible = 0, kept_invisible = 0;
+	double seconds = 0.0;
+	for (uint32_t c = 0; c < cameras; ++c) {
+		Scene::Transform transform;
+		transform.position = glm::vec3(10.0f * unit(mt), 10.0f * unit(mt), 10.0f * unit(mt));
+		transform.rotation = glm::normalize(glm::quat(unit(mt), unit(mt), unit(mt), unit(mt)));
+		Scene::Camera camera(&transform);
+		camera.aspect = 1.0f + std::abs(unit(mt));
+		camera.near = 0.1f;
+		glm::mat4 world_to_clip = camera.make_projection() * glm::mat4(transform.make_world_to_local());
+		Frustum frustum(world_to_clip);
+
+		std::vector< glm::vec3 > centers(boxes), extents(boxes);
+		for (uint32_t i = 0; i < boxes; ++i) {
+			centers[i] = transform.position + 50.0f * glm::vec3(unit(mt), unit(mt), unit(mt));
+			extents[i] = 3.0f * glm::abs(glm::vec3(unit(mt), unit(mt), unit(mt)));
+		}
+
+		for (uint32_t i = 0; i < boxes; ++i) {
+			glm::vec3 const &center = centers[i];
+			glm::vec3 const &extent = extents[i];
+			bool outside = frustum.outside(center, extent);
+			culled += outside;
+
+			//brute force: are all eight corners outside one of the planes?
+			bool brute = false;
+			for (uint32_t p = 0; p < 6 && !brute; ++p) {
+				bool all = true;
+				for (uint32_t k = 0; k < 8 && all; ++k) {
+					glm::vec3 corner = center + glm::vec3((k & 1 ? 1 : -1) * extent.x, (k & 2 ? 1 : -1) * extent.y, (k & 4 ? 1 : -1) * extent.z);
+					if (frustum.d[p] + frustum.nx[p] * corner.x + frustum.ny[p] * corner.y + frustum.nz[p] * corner.z >= 0.0f) all = false;
+				}
+				brute = all;
+			}
+			if (outside != brute) mismatches += 1;
+
+			//is any of a grid of points on the box in view?
+			bool visible = false;
+			for (uint32_t k = 0; k < 27 && !visible; ++k) {
+				glm::vec3 point = center + glm::vec3(float(k % 3) - 1.0f, float(k / 3 % 3) - 1.0f, float(k / 9) - 1.0f) * extent;
+				glm::vec4 clip = world_to_clip * glm::vec4(point, 1.0f);
+				visible = (clip.w > 0.0f && std::abs(clip.x) <= clip.w && std::abs(clip.y) <= clip.w && std::abs(clip.z) <= clip.w);
+			}
+			if (outside && visible) culled_visible += 1;
+			if (!outside && !visible) kept_invisible += 1;
+		}
+
+		auto before = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < boxes; ++i) {
+			recounted += frustum.outside(centers[i], extents[i]);
+		}
+		auto after = std::chrono::steady_clock::now();
+		seconds += std::chrono::duration< double >(after - before).count();
+	}
+
+	uint32_t tests = boxes * cameras;
+	std::cout << tests << " boxes from " << cameras << " cameras: " << culled << " culled\n"
+		<< "  " << mismatches << " disagree with brute force, " << culled_visible << " culled with a point in view\n"
+		<< "  " << kept_invisible << " kept without a sampled point in view (near the frustum's edges and corners; drawn to be safe)\n"
+		<< "  " << seconds / tests * 1.0e9 << " ns per test" << std::endl;
+
+	return (mismatches == 0 && culled_visible == 0 && recounted == culled ? 0 : 1);
+}
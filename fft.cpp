@@ -0,0 +1,288 @@
+#include "fft.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FFT_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+//Arithmetic used by the butterflies, for single values and (on x86) four values at once,
+// so that the same butterfly code serves both:
+inline float add(float a, float b) { return a + b; }
+inline float sub(float a, float b) { return a - b; }
+inline float mul(float a, float b) { return a * b; }
+inline float neg(float a) { return -a; }
+#ifdef FFT_X86
+inline __m128 add(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+inline __m128 sub(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+inline __m128 mul(__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+inline __m128 neg(__m128 a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+#endif
+
+//(tr + i ti) * w, or * conj(w) for the inverse transform:
+template< bool Inverse, typename V >
+inline void twiddle(V tr, V ti, V wr, V wi, V *out_r, V *out_i) {
+	if (Inverse) {
+		*out_r = add(mul(tr, wr), mul(ti, wi));
+		*out_i = sub(mul(ti, wr), mul(tr, wi));
+	} else {
+		*out_r = sub(mul(tr, wr), mul(ti, wi));
+		*out_i = add(mul(tr, wi), mul(ti, wr));
+	}
+}
+
+//radix-4 decimation-in-frequency butterfly: inputs a,b,c,d are a quarter of the sub-transform apart;
+// outputs are the four interleaved results (the first needs no twiddle):
+template< bool Inverse, typename V >
+inline void butterfly4(V ar, V ai, V br, V bi, V cr, V ci, V dr, V di,
+	V w1r, V w1i, V w2r, V w2i, V w3r, V w3i, V yr[4], V yi[4]) {
+	V apc_r = add(ar, cr), apc_i = add(ai, ci);
+	V amc_r = sub(ar, cr), amc_i = sub(ai, ci);
+	V bpd_r = add(br, dr), bpd_i = add(bi, di);
+	V bmd_r = sub(br, dr), bmd_i = sub(bi, di);
+	//(b - d) rotated a quarter turn (by i for the forward transform, -i for the inverse):
+	V jr = (Inverse ? bmd_i : neg(bmd_i));
+	V ji = (Inverse ? neg(bmd_r) : bmd_r);
+
+	yr[0] = add(apc_r, bpd_r);
+	yi[0] = add(apc_i, bpd_i);
+	twiddle< Inverse >(sub(amc_r, jr), sub(amc_i, ji), w1r, w1i, &yr[1], &yi[1]);
+	twiddle< Inverse >(sub(apc_r, bpd_r), sub(apc_i, bpd_i), w2r, w2i, &yr[2], &yi[2]);
+	twiddle< Inverse >(add(amc_r, jr), add(amc_i, ji), w3r, w3i, &yr[3], &yi[3]);
+}
+
+//One Stockham radix-4 stage: x[q + s*(p + k*m)] (k = 0..3) -> y[q + s*(4*p + k)], where s is the stride and m a quarter of the length:
+template< bool Inverse >
+void radix4_stage(RealFFT::Stage const &stage, float const *xr, float const *xi, float *yr, float *yi) {
+	uint32_t const s = stage.stride;
+	uint32_t const m = stage.length / 4;
+	uint32_t p = 0;
+	uint32_t q = 0;
+
+	#ifdef FFT_X86
+	if (s == 1) {
+		//first stage: four values of p at a time, transposing the results so each p's outputs are stored together:
+		for (; p + 4 <= m; p += 4) {
+			__m128 yr4[4], yi4[4];
+			butterfly4< Inverse >(
+				_mm_loadu_ps(xr + p), _mm_loadu_ps(xi + p),
+				_mm_loadu_ps(xr + p + m), _mm_loadu_ps(xi + p + m),
+				_mm_loadu_ps(xr + p + 2*m), _mm_loadu_ps(xi + p + 2*m),
+				_mm_loadu_ps(xr + p + 3*m), _mm_loadu_ps(xi + p + 3*m),
+				_mm_loadu_ps(stage.w1r.data() + p), _mm_loadu_ps(stage.w1i.data() + p),
+				_mm_loadu_ps(stage.w2r.data() + p), _mm_loadu_ps(stage.w2i.data() + p),
+				_mm_loadu_ps(stage.w3r.data() + p), _mm_loadu_ps(stage.w3i.data() + p),
+				yr4, yi4);
+			_MM_TRANSPOSE4_PS(yr4[0], yr4[1], yr4[2], yr4[3]);
+			_MM_TRANSPOSE4_PS(yi4[0], yi4[1], yi4[2], yi4[3]);
+			for (uint32_t k = 0; k < 4; ++k) {
+				_mm_storeu_ps(yr + 4 * (p + k), yr4[k]);
+				_mm_storeu_ps(yi + 4 * (p + k), yi4[k]);
+			}
+		}
+	} else if (s % 4 == 0) {
+		//later stages: four values of q (which share twiddles) at a time:
+		for (; p < m; ++p) {
+			__m128 w1r = _mm_set1_ps(stage.w1r[p]), w1i = _mm_set1_ps(stage.w1i[p]);
+			__m128 w2r = _mm_set1_ps(stage.w2r[p]), w2i = _mm_set1_ps(stage.w2i[p]);
+			__m128 w3r = _mm_set1_ps(stage.w3r[p]), w3i = _mm_set1_ps(stage.w3i[p]);
+			for (q = 0; q < s; q += 4) {
+				__m128 yr4[4], yi4[4];
+				butterfly4< Inverse >(
+					_mm_loadu_ps(xr + q + s*p), _mm_loadu_ps(xi + q + s*p),
+					_mm_loadu_ps(xr + q + s*(p + m)), _mm_loadu_ps(xi + q + s*(p + m)),
+					_mm_loadu_ps(xr + q + s*(p + 2*m)), _mm_loadu_ps(xi + q + s*(p + 2*m)),
+					_mm_loadu_ps(xr + q + s*(p + 3*m)), _mm_loadu_ps(xi + q + s*(p + 3*m)),
+					w1r, w1i, w2r, w2i, w3r, w3i,
+					yr4, yi4);
+				for (uint32_t k = 0; k < 4; ++k) {
+					_mm_storeu_ps(yr + q + s*(4*p + k), yr4[k]);
+					_mm_storeu_ps(yi + q + s*(4*p + k), yi4[k]);
+				}
+			}
+		}
+	}
+	#endif
+
+	//whatever the vector code didn't cover:
+	for (; p < m; ++p) {
+		for (q = 0; q < s; ++q) {
+			float y_r[4], y_i[4];
+			butterfly4< Inverse >(
+				xr[q + s*p], xi[q + s*p],
+				xr[q + s*(p + m)], xi[q + s*(p + m)],
+				xr[q + s*(p + 2*m)], xi[q + s*(p + 2*m)],
+				xr[q + s*(p + 3*m)], xi[q + s*(p + 3*m)],
+				stage.w1r[p], stage.w1i[p], stage.w2r[p], stage.w2i[p], stage.w3r[p], stage.w3i[p],
+				y_r, y_i);
+			for (uint32_t k = 0; k < 4; ++k) {
+				yr[q + s*(4*p + k)] = y_r[k];
+				yi[q + s*(4*p + k)] = y_i[k];
+			}
+		}
+	}
+}
+
+//Final radix-2 stage (sub-transforms of length 2, so no twiddles): x[q], x[q + s] -> y[q], y[q + s]:
+void radix2_stage(uint32_t s, float const *xr, float const *xi, float *yr, float *yi) {
+	uint32_t q = 0;
+	#ifdef FFT_X86
+	for (; q + 4 <= s; q += 4) {
+		__m128 ar = _mm_loadu_ps(xr + q), ai = _mm_loadu_ps(xi + q);
+		__m128 br = _mm_loadu_ps(xr + q + s), bi = _mm_loadu_ps(xi + q + s);
+		_mm_storeu_ps(yr + q, _mm_add_ps(ar, br));
+		_mm_storeu_ps(yi + q, _mm_add_ps(ai, bi));
+		_mm_storeu_ps(yr + q + s, _mm_sub_ps(ar, br));
+		_mm_storeu_ps(yi + q + s, _mm_sub_ps(ai, bi));
+	}
+	#endif
+	for (; q < s; ++q) {
+		float ar = xr[q], ai = xi[q];
+		float br = xr[q + s], bi = xi[q + s];
+		yr[q] = ar + br;
+		yi[q] = ai + bi;
+		yr[q + s] = ar - br;
+		yi[q + s] = ai - bi;
+	}
+}
+
+} //namespace
+
+RealFFT::RealFFT(uint32_t size_) : size(size_), half(size_ / 2) {
+	assert(size >= 32 && (size & (size - 1)) == 0 && "RealFFT size must be a power of two, at least 32");
+
+	double const tau = 2.0 * 3.14159265358979323846;
+
+	//radix-4 stages while the sub-transforms are at least four long:
+	uint32_t length = half;
+	uint32_t stride = 1;
+	while (length >= 4) {
+		Stage stage;
+		stage.length = length;
+		stage.stride = stride;
+		uint32_t m = length / 4;
+		for (auto *w : {&stage.w1r, &stage.w1i, &stage.w2r, &stage.w2i, &stage.w3r, &stage.w3i}) {
+			w->resize(m);
+		}
+		for (uint32_t p = 0; p < m; ++p) {
+			double angle = -tau * double(p) / double(length);
+			stage.w1r[p] = float(std::cos(angle)); stage.w1i[p] = float(std::sin(angle));
+			stage.w2r[p] = float(std::cos(2.0 * angle)); stage.w2i[p] = float(std::sin(2.0 * angle));
+			stage.w3r[p] = float(std::cos(3.0 * angle)); stage.w3i[p] = float(std::sin(3.0 * angle));
+		}
+		stages.emplace_back(std::move(stage));
+		length /= 4;
+		stride *= 4;
+	}
+	radix2_last = (length == 2);
+
+	split_r.resize(half / 2 + 1);
+	split_i.resize(half / 2 + 1);
+	for (uint32_t k = 0; k <= half / 2; ++k) {
+		double angle = -tau * double(k) / double(size);
+		split_r[k] = float(std::cos(angle));
+		split_i[k] = float(std::sin(angle));
+	}
+
+	a_r.resize(half);
+	a_i.resize(half);
+	b_r.resize(half);
+	b_i.resize(half);
+}
+
+template< bool Inverse >
+void RealFFT::complex_fft(float **out_r, float **out_i) {
+	float *xr = a_r.data(), *xi = a_i.data();
+	float *yr = b_r.data(), *yi = b_i.data();
+	for (auto const &stage : stages) {
+		radix4_stage< Inverse >(stage, xr, xi, yr, yi);
+		std::swap(xr, yr);
+		std::swap(xi, yi);
+	}
+	if (radix2_last) {
+		radix2_stage(half / 2, xr, xi, yr, yi);
+		std::swap(xr, yr);
+		std::swap(xi, yi);
+	}
+	*out_r = xr;
+	*out_i = xi;
+}
+
+void RealFFT::forward(float const *in, float *re, float *im) {
+	assert(in && re && im);
+
+	//even values become the real parts of a half-size complex sequence, odd values the imaginary parts:
+	uint32_t m = 0;
+	#ifdef FFT_X86
+	for (; m + 4 <= half; m += 4) {
+		__m128 lo = _mm_loadu_ps(in + 2*m);
+		__m128 hi = _mm_loadu_ps(in + 2*m + 4);
+		_mm_storeu_ps(a_r.data() + m, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps(a_i.data() + m, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+	}
+	#endif
+	for (; m < half; ++m) {
+		a_r[m] = in[2*m];
+		a_i[m] = in[2*m+1];
+	}
+
+	float *zr, *zi;
+	complex_fft< false >(&zr, &zi);
+
+	//split into the spectra of the even and odd values, and combine those into the full spectrum;
+	// bins k and half-k come from the same pair of complex values, so are done together:
+	for (uint32_t k = 0; k <= half / 2; ++k) {
+		uint32_t j = (half - k) % half;
+		float sr = 0.5f * (zr[k] + zr[j]), si = 0.5f * (zi[k] - zi[j]); //even part
+		float dr = 0.5f * (zr[k] - zr[j]), di = 0.5f * (zi[k] + zi[j]); //odd part is -i * (dr + i di)
+		float wr = split_r[k], wi = split_i[k];
+		float tr = wr * di + wi * dr;
+		float ti = wi * di - wr * dr;
+		re[k] = sr + tr;
+		im[k] = si + ti;
+		re[half - k] = sr - tr;
+		im[half - k] = -(si - ti);
+	}
+}
+
+void RealFFT::inverse(float const *re, float const *im, float *out) {
+	assert(re && im && out);
+
+	//undo the split (folding in the 1/half scale of the inverse transform):
+	float const scale = 0.5f / float(half);
+	for (uint32_t k = 0; k <= half / 2; ++k) {
+		float er = scale * (re[k] + re[half - k]), ei = scale * (im[k] - im[half - k]);
+		float dr = scale * (re[k] - re[half - k]), di = scale * (im[k] + im[half - k]);
+		float wr = split_r[k], wi = split_i[k];
+		float or_ = dr * wr + di * wi;
+		float oi = di * wr - dr * wi;
+		a_r[k] = er - oi;
+		a_i[k] = ei + or_;
+		if (k != 0) {
+			a_r[half - k] = er + oi;
+			a_i[half - k] = -ei + or_;
+		}
+	}
+
+	float *zr, *zi;
+	complex_fft< true >(&zr, &zi);
+
+	uint32_t m = 0;
+	#ifdef FFT_X86
+	for (; m + 4 <= half; m += 4) {
+		__m128 r = _mm_loadu_ps(zr + m);
+		__m128 i = _mm_loadu_ps(zi + m);
+		_mm_storeu_ps(out + 2*m, _mm_unpacklo_ps(r, i));
+		_mm_storeu_ps(out + 2*m + 4, _mm_unpackhi_ps(r, i));
+	}
+	#endif
+	for (; m < half; ++m) {
+		out[2*m] = zr[m];
+		out[2*m+1] = zi[m];
+	}
+}
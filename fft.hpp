@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+//Fast Fourier transform used by the mixer's convolution reverb (Sound::ConvolutionReverb).
+// In-house rather than a library: a radix-4 (plus one radix-2 stage, for odd powers of two) Stockham complex FFT
+// with SSE2 butterflies, and the usual trick of computing a real FFT of size N with a complex FFT of size N/2.
+// Stockham stages read from one buffer and write to another, so the output comes out in order with no bit-reversal pass.
+
+//Real-input FFT of one fixed size:
+//  n.b. keeps scratch buffers, so one RealFFT shouldn't be used by several threads at once.
+struct RealFFT {
+	RealFFT(uint32_t size); //size must be a power of two, at least 32
+
+	//number of real values transformed:
+	uint32_t size;
+	//number of complex values in a spectrum (frequencies 0 .. size/2):
+	uint32_t bins() const { return size / 2 + 1; }
+
+	//transform 'size' real values into a spectrum, with the real parts of the bins in 're' and the imaginary parts in 'im':
+	void forward(float const *in, float *re, float *im);
+	//transform a spectrum back into 'size' real values (scaled so that inverse(forward(x)) == x):
+	void inverse(float const *re, float const *im, float *out);
+
+	//internals:
+	uint32_t half; //size of the complex FFT (size / 2)
+	//twiddle factors for each radix-4 stage (w^p, w^2p, w^3p for the stage's w; real parts then imaginary parts):
+	struct Stage {
+		uint32_t length; //length of the sub-transforms
+		uint32_t stride; //how many sub-transforms are interleaved
+		std::vector< float > w1r, w1i, w2r, w2i, w3r, w3i;
+	};
+	std::vector< Stage > stages;
+	bool radix2_last = false; //finish with a radix-2 stage?
+	//twiddle factors for splitting the complex FFT into the real FFT's bins (exp(-2 pi i k / size), k in [0, size/4]):
+	std::vector< float > split_r, split_i;
+	//scratch buffers for the complex FFT to ping-pong between:
+	std::vector< float > a_r, a_i, b_r, b_i;
+
+	//run the complex FFT on a_r/a_i; returns whichever buffers hold the result:
+	template< bool Inverse >
+	void complex_fft(float **out_r, float **out_i);
+};
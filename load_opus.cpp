@@ -8,7 +8,26 @@
 #include <stdexcept>
 #include <iostream>
 
-void load_opus(std::string const &filename, std::vector< float > *data_) {
+namespace {
+
+//decode some stereo audio (returns samples per channel, 0 at end of file, or <0 on error):
+int read_stereo(OggOpusFile *op, float *pcm, int size) {
+	return op_read_float_stereo(op, pcm, size);
+}
+int read_stereo(OggOpusFile *op, int16_t *pcm, int size) {
+	return op_read_stereo(op, pcm, size);
+}
+
+//downmix to mono by averaging:
+float downmix(float l, float r) {
+	return (l + r) * 0.5f;
+}
+int16_t downmix(int16_t l, int16_t r) {
+	return int16_t((int32_t(l) + int32_t(r)) / 2);
+}
+
+template< typename T >
+void load_opus_as(std::string const &filename, std::vector< T > *data_) {
 	assert(data_);
 	auto &data = *data_;
 	data.clear();
@@ -35,14 +54,14 @@ void load_opus(std::string const &filename, std::vector< float > *data_) {
 		data.reserve(2*48000);
 	}
 
-	std::vector< float > pcm(2*48000*2, 0.0f); //seems like reads are generally 960 samples so this is definitely overkill
+	std::vector< T > pcm(2*48000*2, T(0)); //seems like reads are generally 960 samples so this is definitely overkill
 	for (;;) {
-		int ret = op_read_float_stereo(op.get(), pcm.data(), int(pcm.size()));
+		int ret = read_stereo(op.get(), pcm.data(), int(pcm.size()));
 		if (ret >= 0) {
 			//positive return values are the number of samples read per channel; copy into data:
 			data.reserve(data.size() + ret);
 			for (uint32_t i = 0; i < uint32_t(ret); ++i) {
-				data.emplace_back((pcm[2*i] + pcm[2*i+1]) * 0.5f); //downmix to mono by averaging
+				data.emplace_back(downmix(pcm[2*i], pcm[2*i+1]));
 			}
 			if (ret == 0) break;
 		} else {
@@ -52,3 +71,59 @@ void load_opus(std::string const &filename, std::vector< float > *data_) {
 
 	std::cout << " done." << std::endl;
 }
+
+}
+
+void load_opus(std::string const &filename, std::vector< float > *data) {
+	load_opus_as(filename, data);
+}
+
+void load_opus(std::string const &filename, std::vector< int16_t > *data) {
+	load_opus_as(filename, data);
+}
+
+OpusReader::OpusReader(std::string const &filename_) : filename(filename_), pcm(2*48000*2/10, 0.0f) {
+	int err = 0;
+	op = op_open_file(filename.c_str(), &err);
+	if (err != 0 || !op) {
+		throw std::runtime_error("opusfile error " + std::to_string(err) + " opening \"" + filename + "\".");
+	}
+}
+
+OpusReader::~OpusReader() {
+	if (op) {
+		op_free(op);
+		op = nullptr;
+	}
+}
+
+uint32_t OpusReader::read(float *data, uint32_t count) {
+	assert(data);
+	uint32_t total = 0;
+	while (total < count) {
+		if (pcm_begin == pcm_end) {
+			//decode some more (reads are generally 960 samples per channel):
+			int ret = op_read_float_stereo(op, pcm.data(), int(pcm.size()));
+			if (ret < 0) {
+				throw std::runtime_error("opusfile read error " + std::to_string(ret) + " reading \"" + filename + "\".");
+			}
+			if (ret == 0) break; //end of file
+			pcm_begin = 0;
+			pcm_end = uint32_t(ret);
+		}
+		while (total < count && pcm_begin < pcm_end) {
+			data[total] = (pcm[2*pcm_begin] + pcm[2*pcm_begin+1]) * 0.5f; //downmix to mono by averaging
+			total += 1;
+			pcm_begin += 1;
+		}
+	}
+	return total;
+}
+
+void OpusReader::rewind() {
+	int ret = op_pcm_seek(op, 0);
+	if (ret != 0) {
+		throw std::runtime_error("opusfile error " + std::to_string(ret) + " seeking in \"" + filename + "\".");
+	}
+	pcm_begin = pcm_end = 0;
+}
@@ -2,6 +2,32 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
+
+//Version of the conversion load_opus does (see LoadWavVersion in load_wav.hpp):
+constexpr uint32_t LoadOpusVersion = 1;
 
 //Load an opus file as 48kHz floating-point mono; throws on error:
 void load_opus(std::string const &filename, std::vector< float > *data);
+
+//...or as 48kHz 16-bit PCM mono:
+void load_opus(std::string const &filename, std::vector< int16_t > *data);
+
+//Incrementally decode an opus file as 48kHz floating-point mono (used for streaming long files):
+struct OggOpusFile;
+struct OpusReader {
+	OpusReader(std::string const &filename); //throws on error
+	~OpusReader();
+	OpusReader(OpusReader const &) = delete;
+
+	//decode up to 'count' samples into 'data'; returns the number decoded (0 at end of file); throws on error:
+	uint32_t read(float *data, uint32_t count);
+
+	//go back to the start of the file; throws on error:
+	void rewind();
+
+	std::string filename;
+	OggOpusFile *op = nullptr;
+	std::vector< float > pcm; //stereo decode buffer
+	uint32_t pcm_begin = 0, pcm_end = 0; //range of samples in pcm not yet returned by read()
+};
@@ -1,50 +1,198 @@
 #include "load_wav.hpp"
 
+#include "audio_convert.hpp"
+#include "sample_cache.hpp"
+
 #include <SDL.h>
 
 #include <iostream>
 #include <cassert>
+#include <cstring>
 #include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
 
 constexpr uint32_t AUDIO_RATE = 48000;
 
-void load_wav(std::string const &filename, std::vector< float > *data_) {
+namespace {
+
+//audio data found in a WAV file:
+struct WavData {
+	PCMFormat format = PCMFormat::S16;
+	uint32_t channels = 0;
+	uint32_t rate = 0;
+	uint8_t const *data = nullptr;
+	size_t frames = 0;
+};
+
+//find the audio data in the bytes of a WAV file; throws if it isn't a WAV file,
+// returns false if the data isn't plain PCM or float (e.g., ADPCM -- those are left to SDL_LoadWAV):
+bool parse_wav(std::string const &filename, uint8_t const *bytes, size_t size, WavData *wav) {
+	assert(wav);
+	auto u16 = [&](size_t at) { return uint32_t(bytes[at]) | uint32_t(bytes[at+1]) << 8; };
+	auto u32 = [&](size_t at) { return u16(at) | u16(at+2) << 16; };
+
+	if (size < 12 || std::memcmp(bytes, "RIFF", 4) != 0 || std::memcmp(bytes + 8, "WAVE", 4) != 0) {
+		throw std::runtime_error("WAV file '" + filename + "' doesn't start with a RIFF/WAVE header.");
+	}
+
+	uint32_t tag = 0, block_align = 0;
+	bool have_format = false;
+	for (size_t at = 12; at + 8 <= size; ) {
+		uint32_t chunk_size = u32(at + 4);
+		size_t begin = at + 8;
+		size_t end = begin + std::min< size_t >(chunk_size, size - begin); //(files are sometimes truncated)
+		if (std::memcmp(bytes + at, "fmt ", 4) == 0 && end - begin >= 16) {
+			tag = u16(begin);
+			wav->channels = u16(begin + 2);
+			wav->rate = u32(begin + 4);
+			block_align = u16(begin + 12);
+			//WAVE_FORMAT_EXTENSIBLE keeps the real format tag at the start of its subformat GUID:
+			if (tag == 0xfffe && end - begin >= 26) tag = u16(begin + 24);
+			have_format = true;
+		} else if (std::memcmp(bytes + at, "data", 4) == 0) {
+			if (!have_format) break;
+			if (wav->channels == 0 || wav->rate == 0 || block_align == 0 || block_align % wav->channels != 0) {
+				throw std::runtime_error("WAV file '" + filename + "' has an invalid format chunk.");
+			}
+			//pick the format by how many bytes each value takes (e.g., 20-bit audio is stored like 24-bit audio):
+			uint32_t bytes_per_value = block_align / wav->channels;
+			if (tag == 1 && bytes_per_value == 1) wav->format = PCMFormat::U8;
+			else if (tag == 1 && bytes_per_value == 2) wav->format = PCMFormat::S16;
+			else if (tag == 1 && bytes_per_value == 3) wav->format = PCMFormat::S24;
+			else if (tag == 1 && bytes_per_value == 4) wav->format = PCMFormat::S32;
+			else if (tag == 3 && bytes_per_value == 4) wav->format = PCMFormat::F32;
+			else if (tag == 3 && bytes_per_value == 8) wav->format = PCMFormat::F64;
+			else return false;
+			wav->data = bytes + begin;
+			wav->frames = (end - begin) / block_align;
+			return true;
+		}
+		at = begin + size_t(chunk_size) + (chunk_size & 1); //(chunks are padded to even sizes)
+	}
+	throw std::runtime_error("WAV file '" + filename + "' doesn't have format and data chunks.");
+}
+
+//Conversion is split into pieces of this many frames, handed out to threads started just for the conversion:
+constexpr size_t CONVERT_CHUNK = 1 << 16;
+
+//run job(begin, end) over [0,count) in CONVERT_CHUNK-sized pieces, in parallel:
+// (the threads only live until the pieces are done, so nothing is left running once loading is over)
+template< typename F >
+void parallel_chunks(size_t count, F const &job) {
+	size_t chunks = (count + CONVERT_CHUNK - 1) / CONVERT_CHUNK;
+	std::atomic< size_t > next{0};
+	auto run_chunks = [&]() {
+		for (size_t c = next.fetch_add(1); c < chunks; c = next.fetch_add(1)) {
+			job(c * CONVERT_CHUNK, std::min(count, (c + 1) * CONVERT_CHUNK));
+		}
+	};
+
+	size_t helpers = std::min< size_t >(chunks, std::max(1U, std::thread::hardware_concurrency())) - (chunks > 0 ? 1 : 0);
+	std::vector< std::thread > threads;
+	threads.reserve(helpers);
+	for (size_t t = 0; t < helpers; ++t) {
+		threads.emplace_back(run_chunks);
+	}
+	run_chunks();
+	for (auto &thread : threads) {
+		thread.join();
+	}
+}
+
+//convert wav data into 48kHz mono floats:
+void convert(WavData const &wav, std::vector< float > *data_) {
 	assert(data_);
 	auto &data = *data_;
 
-	SDL_AudioSpec audio_spec;
-	Uint8 *audio_buf = nullptr;
-	Uint32 audio_len = 0;
-
-	SDL_AudioSpec *have = SDL_LoadWAV(filename.c_str(), &audio_spec, &audio_buf, &audio_len);
-	if (!have) {
-		throw std::runtime_error("Failed to load WAV file '" + filename + "'; SDL says \"" + std::string(SDL_GetError()) + "\"");
-	}
-
-	//based on the SDL_AudioCVT example in the docs: https://wiki.libsdl.org/SDL_AudioCVT
-	SDL_AudioCVT cvt;
-	SDL_BuildAudioCVT(&cvt, have->format, have->channels, have->freq, AUDIO_F32SYS, 1, AUDIO_RATE);
-	if (cvt.needed) {
-		std::cout << "WAV file '" + filename + "' didn't load as " + std::to_string(AUDIO_RATE) + " Hz, float32, mono; converting." << std::endl;
-		cvt.len = audio_len;
-		cvt.buf = (Uint8 *)SDL_malloc(cvt.len * cvt.len_mult);
-		SDL_memcpy(cvt.buf, audio_buf, audio_len);
-		SDL_ConvertAudio(&cvt);
-		int final_size = cvt.len_cvt;
-		assert(final_size >= 0 && final_size <= cvt.len * cvt.len_mult && "Converted audio should fit in buffer.");
-		assert(final_size % 4 == 0 && "Converted audio should consist of 4-byte elements.");
-		data.assign(reinterpret_cast< float * >(cvt.buf), reinterpret_cast< float * >(cvt.buf + final_size));
-		SDL_free(cvt.buf);
-	} else {
-		data.assign(reinterpret_cast< float * >(audio_buf), reinterpret_cast< float * >(audio_buf + audio_len));
+	uint32_t bytes_per_frame = wav.channels * pcm_format_bytes(wav.format);
+	auto decode = [&](float *out) {
+		parallel_chunks(wav.frames, [&](size_t begin, size_t end) {
+			pcm_to_mono(wav.format, wav.channels, wav.data + begin * bytes_per_frame, end - begin, out + begin);
+		});
+	};
+
+	if (wav.rate == AUDIO_RATE) {
+		data.resize(wav.frames);
+		decode(data.data());
+		return;
+	}
+
+	Resampler resampler(wav.rate, AUDIO_RATE);
+	std::vector< float > input(resampler.padding + wav.frames + resampler.padding, 0.0f);
+	decode(input.data() + resampler.padding);
+
+	data.resize(resampler.output_frames(wav.frames));
+	parallel_chunks(data.size(), [&](size_t begin, size_t end) {
+		resampler.process(input.data() + resampler.padding, begin, end, data.data() + begin);
+	});
+}
+
+void convert(WavData const &wav, std::vector< int16_t > *data) {
+	assert(data);
+	std::vector< float > mono;
+	convert(wav, &mono);
+	data->resize(mono.size());
+	parallel_chunks(mono.size(), [&](size_t begin, size_t end) {
+		float_to_int16(mono.data() + begin, end - begin, data->data() + begin);
+	});
+}
+
+//load into 'data' as 48kHz mono in 'format' (which must match T):
+template< typename T >
+void load_wav_as(std::string const &filename, PCMFormat format, char const *format_name, std::vector< T > *data_) {
+	assert(data_);
+	auto &data = *data_;
+	assert(pcm_format_bytes(format) == sizeof(T));
+
+	std::unique_ptr< MappedFile > file;
+	try {
+		file.reset(new MappedFile(filename));
+	} catch (std::exception &e) {
+		throw std::runtime_error("Failed to load WAV file '" + filename + "'; " + e.what());
 	}
-	SDL_FreeWAV(audio_buf);
 
-	float min = 0.0f;
-	float max = 0.0f;
-	for (auto d : data) {
-		min = std::min(min, d);
-		max = std::max(max, d);
+	WavData wav;
+	std::unique_ptr< Uint8, void (*)(Uint8 *) > sdl_buf(nullptr, SDL_FreeWAV); //(if SDL decoded the file)
+	if (!parse_wav(filename, file->data, file->size, &wav)) {
+		//compressed formats (ADPCM, mu-law, ...) are rare enough to leave to SDL, which decodes them to 16-bit PCM:
+		SDL_AudioSpec audio_spec;
+		Uint8 *audio_buf = nullptr;
+		Uint32 audio_len = 0;
+		SDL_AudioSpec *have = SDL_LoadWAV(filename.c_str(), &audio_spec, &audio_buf, &audio_len);
+		if (!have) {
+			throw std::runtime_error("Failed to load WAV file '" + filename + "'; SDL says \"" + std::string(SDL_GetError()) + "\"");
+		}
+		sdl_buf.reset(audio_buf);
+		if (have->format == AUDIO_U8) wav.format = PCMFormat::U8;
+		else if (have->format == AUDIO_S16LSB) wav.format = PCMFormat::S16;
+		else if (have->format == AUDIO_S32LSB) wav.format = PCMFormat::S32;
+		else if (have->format == AUDIO_F32LSB) wav.format = PCMFormat::F32;
+		else {
+			throw std::runtime_error("WAV file '" + filename + "' decoded to an unexpected format.");
+		}
+		wav.channels = have->channels;
+		wav.rate = have->freq;
+		wav.data = audio_buf;
+		wav.frames = audio_len / (wav.channels * pcm_format_bytes(wav.format));
 	}
-	std::cout << "Range: " << min << ", " << max << std::endl;
+
+	if (wav.rate == AUDIO_RATE && wav.channels == 1 && wav.format == format) {
+		data.resize(wav.frames);
+		std::memcpy(data.data(), wav.data, wav.frames * sizeof(T));
+	} else {
+		std::cout << "WAV file '" + filename + "' didn't load as " + std::to_string(AUDIO_RATE) + " Hz, " + format_name + ", mono; converting." << std::endl;
+		convert(wav, &data);
+	}
+}
+
+}
+
+void load_wav(std::string const &filename, std::vector< float > *data) {
+	load_wav_as(filename, PCMFormat::F32, "float32", data);
+}
+
+void load_wav(std::string const &filename, std::vector< int16_t > *data) {
+	load_wav_as(filename, PCMFormat::S16, "int16", data);
 }
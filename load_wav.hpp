@@ -2,6 +2,16 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
+
+//Version of the conversion load_wav does; bumped whenever a change to it alters the audio it produces
+// (decoded samples are cached on disk under this version -- see Sound::Sample and sample_cache.hpp):
+constexpr uint32_t LoadWavVersion = 3;
 
 //Load a WAV file as 48kHz floating-point mono; throws on error:
+// (8/16/24/32-bit and float files are decoded, downmixed, and resampled in-house -- see audio_convert.hpp;
+//  compressed formats are decoded by SDL first)
 void load_wav(std::string const &filename, std::vector< float > *data);
+
+//...or as 48kHz 16-bit PCM mono:
+void load_wav(std::string const &filename, std::vector< int16_t > *data);
@@ -109,7 +109,8 @@ int main(int argc, char **argv) {
 	//SDL_ShowCursor(SDL_DISABLE);
 
 	//------------ init sound --------------
-	Sound::init();
+	//(small blocks keep the delay between pressing a key and hearing its note short)
+	Sound::init(Sound::Backend::SDL, 256);
 
 	//------------ load assets --------------
 	call_load_functions();
@@ -0,0 +1,631 @@
+#include "mix_kernels.hpp"
+
+#include <SDL.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIX_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+//gcc and clang need to be told that a function may use AVX2 instructions; MSVC doesn't:
+#if defined(MIX_KERNELS_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+namespace {
+
+inline void meter(float v, MixLevel *level) {
+	level->sum_squares += v * v;
+	level->peak = std::max(level->peak, std::abs(v));
+}
+
+//reference version; also used for the tail of the vectorized versions:
+void mix_mono_to_stereo_scalar(float *out, float const *data, uint32_t count,
+	float start_l, float start_r, float step_l, float step_r, MixLevel *level) {
+	for (uint32_t k = 0; k < count; ++k) {
+		out[2*k+0] += (start_l + float(k) * step_l) * data[k];
+		out[2*k+1] += (start_r + float(k) * step_r) * data[k];
+		meter(data[k], level);
+	}
+}
+
+void mix_mono_to_stereo_resampled_scalar(float *out, float const *data, uint32_t count, float offset, float rate,
+	float start_l, float start_r, float step_l, float step_r, MixLevel *level) {
+	for (uint32_t k = 0; k < count; ++k) {
+		float p = offset + float(k) * rate;
+		uint32_t j = uint32_t(p);
+		float t = p - float(j);
+		float d = data[j] + t * (data[j+1] - data[j]);
+		out[2*k+0] += (start_l + float(k) * step_l) * d;
+		out[2*k+1] += (start_r + float(k) * step_r) * d;
+		meter(d, level);
+	}
+}
+
+void int16_to_float_scalar(float *out, int16_t const *data, uint32_t count) {
+	for (uint32_t k = 0; k < count; ++k) {
+		out[k] = float(data[k]) * (1.0f / 32768.0f);
+	}
+}
+
+void mix_stereo_scalar(float *out, float const *data, uint32_t count, float start, float step) {
+	for (uint32_t k = 0; k < count; ++k) {
+		float gain = start + float(k) * step;
+		out[2*k+0] += gain * data[2*k+0];
+		out[2*k+1] += gain * data[2*k+1];
+	}
+}
+
+void scale_stereo_scalar(float *io, uint32_t count, float start, float step, MixLevel *level) {
+	for (uint32_t k = 0; k < count; ++k) {
+		float gain = start + float(k) * step;
+		io[2*k+0] *= gain;
+		io[2*k+1] *= gain;
+		if (level) {
+			meter(io[2*k+0], level);
+			meter(io[2*k+1], level);
+		}
+	}
+}
+
+float peak_abs_scalar(float const *data, uint32_t count) {
+	float peak = 0.0f;
+	for (uint32_t i = 0; i < count; ++i) {
+		peak = std::max(peak, std::abs(data[i]));
+	}
+	return peak;
+}
+
+//one channel, one frame at a time (state is x[n-1], x[n-2], y[n-1], y[n-2]):
+inline float biquad_step(float x, BiquadCoefficients const &c, float *state) {
+	float y = c.b0 * x + c.b1 * state[0] + c.b2 * state[1] - c.a1 * state[2] - c.a2 * state[3];
+	state[1] = state[0];
+	state[0] = x;
+	state[3] = state[2];
+	state[2] = y;
+	return y;
+}
+
+void biquad_stereo_scalar(float *io, uint32_t count, BiquadCoefficients const &coefficients, float state[8]) {
+	for (uint32_t k = 0; k < count; ++k) {
+		io[2*k+0] = biquad_step(io[2*k+0], coefficients, state + 0);
+		io[2*k+1] = biquad_step(io[2*k+1], coefficients, state + 4);
+	}
+}
+
+void complex_multiply_add_scalar(float *acc_re, float *acc_im, float const *a_re, float const *a_im,
+	float const *b_re, float const *b_im, uint32_t count) {
+	for (uint32_t i = 0; i < count; ++i) {
+		acc_re[i] += a_re[i] * b_re[i] - a_im[i] * b_im[i];
+		acc_im[i] += a_re[i] * b_im[i] + a_im[i] * b_re[i];
+	}
+}
+
+//polynomial cos/sin of pi/4 + u for |u| <= pi/4 (written out so the vector versions can match it term for term):
+// truncated Taylor series; error of cos(u) is below u^8/8! < 3.6e-6 and of sin(u) below u^9/9! < 3.2e-7 on this range.
+constexpr float const PAN_C2 = -1.0f / 2.0f, PAN_C4 = 1.0f / 24.0f, PAN_C6 = -1.0f / 720.0f;
+constexpr float const PAN_S3 = -1.0f / 6.0f, PAN_S5 = 1.0f / 120.0f, PAN_S7 = -1.0f / 5040.0f;
+constexpr float const QUARTER_PI = 0.25f * 3.1415926f;
+constexpr float const HALF_SQRT2 = 0.70710678f;
+
+void pan_3D_scalar(uint32_t count,
+	float const *x, float const *y, float const *z, float const *half_radius,
+	glm::vec3 const &listener_position, glm::vec3 const &listener_right,
+	float *left, float *right) {
+	for (uint32_t i = 0; i < count; ++i) {
+		glm::vec3 to = glm::vec3(x[i], y[i], z[i]) - listener_position;
+		float distance = std::sqrt(glm::dot(to, to));
+		if (distance == 0.0f) {
+			left[i] = right[i] = std::sqrt(2.0f);
+			continue;
+		}
+		//amt ranges from -1 (most left) to 1 (most right); turn into an angle offset from pi/4:
+		float amt = glm::dot(listener_right, to) / distance;
+		float u = QUARTER_PI * amt;
+		float u2 = u * u;
+		float c = 1.0f + u2 * (PAN_C2 + u2 * (PAN_C4 + u2 * PAN_C6));
+		float s = u * (1.0f + u2 * (PAN_S3 + u2 * (PAN_S5 + u2 * PAN_S7)));
+		//cos(pi/4 + u) = (cos u - sin u) / sqrt(2), sin(pi/4 + u) = (cos u + sin u) / sqrt(2):
+		float att = HALF_SQRT2 / (1.0f + distance / half_radius[i]);
+		left[i] = (c - s) * att;
+		right[i] = (c + s) * att;
+	}
+}
+
+#ifdef MIX_KERNELS_X86
+
+void pan_3D_sse2(uint32_t count,
+	float const *x, float const *y, float const *z, float const *half_radius,
+	glm::vec3 const &listener_position, glm::vec3 const &listener_right,
+	float *left, float *right) {
+	__m128 const lx = _mm_set1_ps(listener_position.x), ly = _mm_set1_ps(listener_position.y), lz = _mm_set1_ps(listener_position.z);
+	__m128 const rx = _mm_set1_ps(listener_right.x), ry = _mm_set1_ps(listener_right.y), rz = _mm_set1_ps(listener_right.z);
+	__m128 const zero = _mm_setzero_ps();
+	__m128 const one = _mm_set1_ps(1.0f);
+	__m128 const at_listener = _mm_set1_ps(std::sqrt(2.0f));
+
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 tx = _mm_sub_ps(_mm_loadu_ps(x + i), lx);
+		__m128 ty = _mm_sub_ps(_mm_loadu_ps(y + i), ly);
+		__m128 tz = _mm_sub_ps(_mm_loadu_ps(z + i), lz);
+		__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, tx), _mm_mul_ps(ty, ty)), _mm_mul_ps(tz, tz)));
+		__m128 is_zero = _mm_cmpeq_ps(distance, zero);
+		//(divide by 1 instead of 0 for sources at the listener; they are blended out below)
+		__m128 safe_distance = _mm_or_ps(_mm_andnot_ps(is_zero, distance), _mm_and_ps(is_zero, one));
+
+		__m128 amt = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, tx), _mm_mul_ps(ry, ty)), _mm_mul_ps(rz, tz)), safe_distance);
+		__m128 u = _mm_mul_ps(_mm_set1_ps(QUARTER_PI), amt);
+		__m128 u2 = _mm_mul_ps(u, u);
+		__m128 c = _mm_add_ps(one, _mm_mul_ps(u2, _mm_add_ps(_mm_set1_ps(PAN_C2), _mm_mul_ps(u2, _mm_add_ps(_mm_set1_ps(PAN_C4), _mm_mul_ps(u2, _mm_set1_ps(PAN_C6)))))));
+		__m128 s = _mm_mul_ps(u, _mm_add_ps(one, _mm_mul_ps(u2, _mm_add_ps(_mm_set1_ps(PAN_S3), _mm_mul_ps(u2, _mm_add_ps(_mm_set1_ps(PAN_S5), _mm_mul_ps(u2, _mm_set1_ps(PAN_S7))))))));
+
+		__m128 att = _mm_div_ps(_mm_set1_ps(HALF_SQRT2), _mm_add_ps(one, _mm_div_ps(distance, _mm_loadu_ps(half_radius + i))));
+		__m128 l = _mm_mul_ps(_mm_sub_ps(c, s), att);
+		__m128 r = _mm_mul_ps(_mm_add_ps(c, s), att);
+
+		_mm_storeu_ps(left + i, _mm_or_ps(_mm_andnot_ps(is_zero, l), _mm_and_ps(is_zero, at_listener)));
+		_mm_storeu_ps(right + i, _mm_or_ps(_mm_andnot_ps(is_zero, r), _mm_and_ps(is_zero, at_listener)));
+	}
+
+	pan_3D_scalar(count - i, x + i, y + i, z + i, half_radius + i, listener_position, listener_right, left + i, right + i);
+}
+
+//Metering in registers: squares and absolute values accumulate lane-wise, and are only summed/maxed across lanes at the end:
+struct MeterSSE2 {
+	__m128 squares = _mm_setzero_ps();
+	__m128 peak = _mm_setzero_ps();
+	void add(__m128 v) {
+		squares = _mm_add_ps(squares, _mm_mul_ps(v, v));
+		peak = _mm_max_ps(peak, _mm_and_ps(_mm_castsi128_ps(_mm_set1_epi32(0x7fffffff)), v));
+	}
+	void finish(MixLevel *level) {
+		__m128 s = _mm_add_ps(squares, _mm_movehl_ps(squares, squares));
+		s = _mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1)));
+		__m128 p = _mm_max_ps(peak, _mm_movehl_ps(peak, peak));
+		p = _mm_max_ss(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1)));
+		level->sum_squares += _mm_cvtss_f32(s);
+		level->peak = std::max(level->peak, _mm_cvtss_f32(p));
+	}
+};
+
+void mix_mono_to_stereo_sse2(float *out, float const *data, uint32_t count,
+	float start_l, float start_r, float step_l, float step_r, MixLevel *level) {
+	//gains for frames (k, k+1) are computed as start + index * step, with index = [k, k, k+1, k+1]:
+	__m128 const start = _mm_setr_ps(start_l, start_r, start_l, start_r);
+	__m128 const step = _mm_setr_ps(step_l, step_r, step_l, step_r);
+	__m128 index = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+	__m128 const two = _mm_set1_ps(2.0f);
+	MeterSSE2 meter;
+
+	uint32_t k = 0;
+	for (; k + 4 <= count; k += 4) {
+		__m128 d = _mm_loadu_ps(data + k); //[d0 d1 d2 d3]
+		__m128 d01 = _mm_unpacklo_ps(d, d); //[d0 d0 d1 d1]
+		__m128 d23 = _mm_unpackhi_ps(d, d); //[d2 d2 d3 d3]
+
+		__m128 g01 = _mm_add_ps(start, _mm_mul_ps(index, step));
+		index = _mm_add_ps(index, two);
+		__m128 g23 = _mm_add_ps(start, _mm_mul_ps(index, step));
+		index = _mm_add_ps(index, two);
+
+		_mm_storeu_ps(out + 2*k + 0, _mm_add_ps(_mm_loadu_ps(out + 2*k + 0), _mm_mul_ps(g01, d01)));
+		_mm_storeu_ps(out + 2*k + 4, _mm_add_ps(_mm_loadu_ps(out + 2*k + 4), _mm_mul_ps(g23, d23)));
+		meter.add(d);
+	}
+	meter.finish(level);
+
+	mix_mono_to_stereo_scalar(out + 2*k, data + k, count - k,
+		start_l + float(k) * step_l, start_r + float(k) * step_r, step_l, step_r, level);
+}
+
+void int16_to_float_sse2(float *out, int16_t const *data, uint32_t count) {
+	__m128 const scale = _mm_set1_ps(1.0f / 32768.0f);
+	uint32_t k = 0;
+	for (; k + 8 <= count; k += 8) {
+		__m128i d = _mm_loadu_si128(reinterpret_cast< __m128i const * >(data + k));
+		//sign-extend by putting each value in the high half of a 32-bit lane, then shifting down:
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(d, d), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(d, d), 16);
+		_mm_storeu_ps(out + k + 0, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(out + k + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+	int16_to_float_scalar(out + k, data + k, count - k);
+}
+
+void mix_stereo_sse2(float *out, float const *data, uint32_t count, float start, float step) {
+	//gains for frames (k, k+1) are start + index * step, with index = [k, k, k+1, k+1]:
+	__m128 const start4 = _mm_set1_ps(start);
+	__m128 const step4 = _mm_set1_ps(step);
+	__m128 index = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+	__m128 const two = _mm_set1_ps(2.0f);
+
+	uint32_t k = 0;
+	for (; k + 2 <= count; k += 2) {
+		__m128 gain = _mm_add_ps(start4, _mm_mul_ps(index, step4));
+		index = _mm_add_ps(index, two);
+		_mm_storeu_ps(out + 2*k, _mm_add_ps(_mm_loadu_ps(out + 2*k), _mm_mul_ps(gain, _mm_loadu_ps(data + 2*k))));
+	}
+	mix_stereo_scalar(out + 2*k, data + 2*k, count - k, start + float(k) * step, step);
+}
+
+template< bool Metered >
+void scale_stereo_sse2(float *io, uint32_t count, float start, float step, MixLevel *level) {
+	__m128 const start4 = _mm_set1_ps(start);
+	__m128 const step4 = _mm_set1_ps(step);
+	__m128 index = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+	__m128 const two = _mm_set1_ps(2.0f);
+	MeterSSE2 meter;
+
+	uint32_t k = 0;
+	for (; k + 2 <= count; k += 2) {
+		__m128 gain = _mm_add_ps(start4, _mm_mul_ps(index, step4));
+		index = _mm_add_ps(index, two);
+		__m128 v = _mm_mul_ps(gain, _mm_loadu_ps(io + 2*k));
+		_mm_storeu_ps(io + 2*k, v);
+		if (Metered) meter.add(v);
+	}
+	if (Metered) meter.finish(level);
+	scale_stereo_scalar(io + 2*k, count - k, start + float(k) * step, step, level);
+}
+
+void scale_stereo_sse2(float *io, uint32_t count, float start, float step, MixLevel *level) {
+	if (level) scale_stereo_sse2< true >(io, count, start, step, level);
+	else scale_stereo_sse2< false >(io, count, start, step, nullptr);
+}
+
+float peak_abs_sse2(float const *data, uint32_t count) {
+	__m128 const abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 peak = _mm_setzero_ps();
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		peak = _mm_max_ps(peak, _mm_and_ps(abs_mask, _mm_loadu_ps(data + i)));
+	}
+	//reduce the four lanes:
+	peak = _mm_max_ps(peak, _mm_shuffle_ps(peak, peak, _MM_SHUFFLE(1, 0, 3, 2)));
+	peak = _mm_max_ps(peak, _mm_shuffle_ps(peak, peak, _MM_SHUFFLE(2, 3, 0, 1)));
+	return std::max(_mm_cvtss_f32(peak), peak_abs_scalar(data + i, count - i));
+}
+
+void biquad_stereo_sse2(float *io, uint32_t count, BiquadCoefficients const &coefficients, float state[8]) {
+	__m128 c[8];
+	for (uint32_t t = 0; t < 8; ++t) {
+		c[t] = _mm_loadu_ps(coefficients.block[t]);
+	}
+	//state, as broadcast values (x1 == x[n-1], etc):
+	__m128 x1_l = _mm_set1_ps(state[0]), x2_l = _mm_set1_ps(state[1]), y1_l = _mm_set1_ps(state[2]), y2_l = _mm_set1_ps(state[3]);
+	__m128 x1_r = _mm_set1_ps(state[4]), x2_r = _mm_set1_ps(state[5]), y1_r = _mm_set1_ps(state[6]), y2_r = _mm_set1_ps(state[7]);
+
+	//four outputs of one channel from four inputs (only the last two lines depend on previous outputs):
+	auto block = [&c](__m128 x, __m128 &x1, __m128 &x2, __m128 &y1, __m128 &y2) {
+		__m128 y = _mm_add_ps(_mm_mul_ps(c[0], x2), _mm_mul_ps(c[1], x1));
+		y = _mm_add_ps(y, _mm_mul_ps(c[2], _mm_shuffle_ps(x, x, _MM_SHUFFLE(0, 0, 0, 0))));
+		y = _mm_add_ps(y, _mm_mul_ps(c[3], _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 1, 1, 1))));
+		x2 = _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 2, 2, 2));
+		x1 = _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3));
+		y = _mm_add_ps(y, _mm_mul_ps(c[4], x2));
+		y = _mm_add_ps(y, _mm_mul_ps(c[5], x1));
+		y = _mm_add_ps(y, _mm_add_ps(_mm_mul_ps(c[6], y2), _mm_mul_ps(c[7], y1)));
+		y2 = _mm_shuffle_ps(y, y, _MM_SHUFFLE(2, 2, 2, 2));
+		y1 = _mm_shuffle_ps(y, y, _MM_SHUFFLE(3, 3, 3, 3));
+		return y;
+	};
+
+	uint32_t k = 0;
+	for (; k + 4 <= count; k += 4) {
+		__m128 a = _mm_loadu_ps(io + 2*k + 0); //[l0 r0 l1 r1]
+		__m128 b = _mm_loadu_ps(io + 2*k + 4); //[l2 r2 l3 r3]
+		__m128 l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)); //[l0 l1 l2 l3]
+		__m128 r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)); //[r0 r1 r2 r3]
+		l = block(l, x1_l, x2_l, y1_l, y2_l);
+		r = block(r, x1_r, x2_r, y1_r, y2_r);
+		_mm_storeu_ps(io + 2*k + 0, _mm_unpacklo_ps(l, r));
+		_mm_storeu_ps(io + 2*k + 4, _mm_unpackhi_ps(l, r));
+	}
+
+	state[0] = _mm_cvtss_f32(x1_l); state[1] = _mm_cvtss_f32(x2_l); state[2] = _mm_cvtss_f32(y1_l); state[3] = _mm_cvtss_f32(y2_l);
+	state[4] = _mm_cvtss_f32(x1_r); state[5] = _mm_cvtss_f32(x2_r); state[6] = _mm_cvtss_f32(y1_r); state[7] = _mm_cvtss_f32(y2_r);
+	biquad_stereo_scalar(io + 2*k, count - k, coefficients, state);
+}
+
+void complex_multiply_add_sse2(float *acc_re, float *acc_im, float const *a_re, float const *a_im,
+	float const *b_re, float const *b_im, uint32_t count) {
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 ar = _mm_loadu_ps(a_re + i), ai = _mm_loadu_ps(a_im + i);
+		__m128 br = _mm_loadu_ps(b_re + i), bi = _mm_loadu_ps(b_im + i);
+		_mm_storeu_ps(acc_re + i, _mm_add_ps(_mm_loadu_ps(acc_re + i), _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi))));
+		_mm_storeu_ps(acc_im + i, _mm_add_ps(_mm_loadu_ps(acc_im + i), _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br))));
+	}
+	complex_multiply_add_scalar(acc_re + i, acc_im + i, a_re + i, a_im + i, b_re + i, b_im + i, count - i);
+}
+
+void mix_mono_to_stereo_resampled_sse2(float *out, float const *data, uint32_t count, float offset, float rate,
+	float start_l, float start_r, float step_l, float step_r, MixLevel *level) {
+	//four frames at a time: interpolate four values, then mix them just like mix_mono_to_stereo_sse2:
+	__m128 const start = _mm_setr_ps(start_l, start_r, start_l, start_r);
+	__m128 const step = _mm_setr_ps(step_l, step_r, step_l, step_r);
+	__m128 index = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+	__m128 const two = _mm_set1_ps(2.0f);
+	__m128 frame = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	__m128 const four = _mm_set1_ps(4.0f);
+	__m128 const offset4 = _mm_set1_ps(offset);
+	__m128 const rate4 = _mm_set1_ps(rate);
+	MeterSSE2 meter;
+
+	uint32_t k = 0;
+	for (; k + 4 <= count; k += 4) {
+		__m128 p = _mm_add_ps(offset4, _mm_mul_ps(frame, rate4));
+		frame = _mm_add_ps(frame, four);
+		__m128i j = _mm_cvttps_epi32(p); //(p >= 0, so truncation == floor)
+		__m128 t = _mm_sub_ps(p, _mm_cvtepi32_ps(j));
+
+		//no gather in SSE2, so fetch the pairs of values one at a time:
+		alignas(16) int32_t js[4];
+		_mm_store_si128(reinterpret_cast< __m128i * >(js), j);
+		__m128 a = _mm_setr_ps(data[js[0]], data[js[1]], data[js[2]], data[js[3]]);
+		__m128 b = _mm_setr_ps(data[js[0]+1], data[js[1]+1], data[js[2]+1], data[js[3]+1]);
+		__m128 d = _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+
+		__m128 d01 = _mm_unpacklo_ps(d, d);
+		__m128 d23 = _mm_unpackhi_ps(d, d);
+		__m128 g01 = _mm_add_ps(start, _mm_mul_ps(index, step));
+		index = _mm_add_ps(index, two);
+		__m128 g23 = _mm_add_ps(start, _mm_mul_ps(index, step));
+		index = _mm_add_ps(index, two);
+
+		_mm_storeu_ps(out + 2*k + 0, _mm_add_ps(_mm_loadu_ps(out + 2*k + 0), _mm_mul_ps(g01, d01)));
+		_mm_storeu_ps(out + 2*k + 4, _mm_add_ps(_mm_loadu_ps(out + 2*k + 4), _mm_mul_ps(g23, d23)));
+		meter.add(d);
+	}
+	meter.finish(level);
+
+	mix_mono_to_stereo_resampled_scalar(out + 2*k, data, count - k, offset + float(k) * rate, rate,
+		start_l + float(k) * step_l, start_r + float(k) * step_r, step_l, step_r, level);
+}
+
+//(as MeterSSE2, eight lanes at a time)
+struct MeterAVX2 {
+	__m256 squares, peak;
+	TARGET_AVX2 MeterAVX2() : squares(_mm256_setzero_ps()), peak(_mm256_setzero_ps()) { }
+	TARGET_AVX2 void add(__m256 v) {
+		squares = _mm256_add_ps(squares, _mm256_mul_ps(v, v));
+		peak = _mm256_max_ps(peak, _mm256_and_ps(_mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff)), v));
+	}
+	TARGET_AVX2 void finish(MixLevel *level) {
+		MeterSSE2 half;
+		half.squares = _mm_add_ps(_mm256_castps256_ps128(squares), _mm256_extractf128_ps(squares, 1));
+		half.peak = _mm_max_ps(_mm256_castps256_ps128(peak), _mm256_extractf128_ps(peak, 1));
+		half.finish(level);
+	}
+};
+
+TARGET_AVX2
+void mix_mono_to_stereo_resampled_avx2(float *out, float const *data, uint32_t count, float offset, float rate,
+	float start_l, float start_r, float step_l, float step_r, MixLevel *level) {
+	//eight frames at a time, using gathers to fetch the values to interpolate between:
+	__m256 const start = _mm256_setr_ps(start_l, start_r, start_l, start_r, start_l, start_r, start_l, start_r);
+	__m256 const step = _mm256_setr_ps(step_l, step_r, step_l, step_r, step_l, step_r, step_l, step_r);
+	__m256 index = _mm256_setr_ps(0.0f, 0.0f, 1.0f, 1.0f, 2.0f, 2.0f, 3.0f, 3.0f);
+	__m256 const four = _mm256_set1_ps(4.0f);
+	__m256 frame = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+	__m256 const eight = _mm256_set1_ps(8.0f);
+	__m256 const offset8 = _mm256_set1_ps(offset);
+	__m256 const rate8 = _mm256_set1_ps(rate);
+	__m256i const lo_frames = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+	__m256i const hi_frames = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+	MeterAVX2 meter;
+
+	uint32_t k = 0;
+	for (; k + 8 <= count; k += 8) {
+		__m256 p = _mm256_add_ps(offset8, _mm256_mul_ps(frame, rate8));
+		frame = _mm256_add_ps(frame, eight);
+		__m256i j = _mm256_cvttps_epi32(p);
+		__m256 t = _mm256_sub_ps(p, _mm256_cvtepi32_ps(j));
+		__m256 a = _mm256_i32gather_ps(data, j, 4);
+		__m256 b = _mm256_i32gather_ps(data + 1, j, 4);
+		__m256 d = _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+
+		__m256 d0123 = _mm256_permutevar8x32_ps(d, lo_frames);
+		__m256 d4567 = _mm256_permutevar8x32_ps(d, hi_frames);
+		__m256 g0123 = _mm256_add_ps(start, _mm256_mul_ps(index, step));
+		index = _mm256_add_ps(index, four);
+		__m256 g4567 = _mm256_add_ps(start, _mm256_mul_ps(index, step));
+		index = _mm256_add_ps(index, four);
+
+		_mm256_storeu_ps(out + 2*k + 0, _mm256_add_ps(_mm256_loadu_ps(out + 2*k + 0), _mm256_mul_ps(g0123, d0123)));
+		_mm256_storeu_ps(out + 2*k + 8, _mm256_add_ps(_mm256_loadu_ps(out + 2*k + 8), _mm256_mul_ps(g4567, d4567)));
+		meter.add(d);
+	}
+	meter.finish(level);
+
+	mix_mono_to_stereo_resampled_sse2(out + 2*k, data, count - k, offset + float(k) * rate, rate,
+		start_l + float(k) * step_l, start_r + float(k) * step_r, step_l, step_r, level);
+}
+
+TARGET_AVX2
+void mix_mono_to_stereo_avx2(float *out, float const *data, uint32_t count,
+	float start_l, float start_r, float step_l, float step_r, MixLevel *level) {
+	//as above, but four frames per register; index = [k, k, k+1, k+1, k+2, k+2, k+3, k+3]:
+	__m256 const start = _mm256_setr_ps(start_l, start_r, start_l, start_r, start_l, start_r, start_l, start_r);
+	__m256 const step = _mm256_setr_ps(step_l, step_r, step_l, step_r, step_l, step_r, step_l, step_r);
+	__m256 index = _mm256_setr_ps(0.0f, 0.0f, 1.0f, 1.0f, 2.0f, 2.0f, 3.0f, 3.0f);
+	__m256 const four = _mm256_set1_ps(4.0f);
+	__m256i const lo_frames = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+	__m256i const hi_frames = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+	MeterAVX2 meter;
+
+	uint32_t k = 0;
+	for (; k + 8 <= count; k += 8) {
+		__m256 d = _mm256_loadu_ps(data + k); //[d0 .. d7]
+		__m256 d0123 = _mm256_permutevar8x32_ps(d, lo_frames); //[d0 d0 d1 d1 d2 d2 d3 d3]
+		__m256 d4567 = _mm256_permutevar8x32_ps(d, hi_frames); //[d4 d4 .. d7 d7]
+
+		__m256 g0123 = _mm256_add_ps(start, _mm256_mul_ps(index, step));
+		index = _mm256_add_ps(index, four);
+		__m256 g4567 = _mm256_add_ps(start, _mm256_mul_ps(index, step));
+		index = _mm256_add_ps(index, four);
+
+		_mm256_storeu_ps(out + 2*k + 0, _mm256_add_ps(_mm256_loadu_ps(out + 2*k + 0), _mm256_mul_ps(g0123, d0123)));
+		_mm256_storeu_ps(out + 2*k + 8, _mm256_add_ps(_mm256_loadu_ps(out + 2*k + 8), _mm256_mul_ps(g4567, d4567)));
+		meter.add(d);
+	}
+	meter.finish(level);
+
+	mix_mono_to_stereo_sse2(out + 2*k, data + k, count - k,
+		start_l + float(k) * step_l, start_r + float(k) * step_r, step_l, step_r, level);
+}
+
+TARGET_AVX2
+void complex_multiply_add_avx2(float *acc_re, float *acc_im, float const *a_re, float const *a_im,
+	float const *b_re, float const *b_im, uint32_t count) {
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 ar = _mm256_loadu_ps(a_re + i), ai = _mm256_loadu_ps(a_im + i);
+		__m256 br = _mm256_loadu_ps(b_re + i), bi = _mm256_loadu_ps(b_im + i);
+		_mm256_storeu_ps(acc_re + i, _mm256_add_ps(_mm256_loadu_ps(acc_re + i), _mm256_sub_ps(_mm256_mul_ps(ar, br), _mm256_mul_ps(ai, bi))));
+		_mm256_storeu_ps(acc_im + i, _mm256_add_ps(_mm256_loadu_ps(acc_im + i), _mm256_add_ps(_mm256_mul_ps(ar, bi), _mm256_mul_ps(ai, br))));
+	}
+	complex_multiply_add_sse2(acc_re + i, acc_im + i, a_re + i, a_im + i, b_re + i, b_im + i, count - i);
+}
+
+TARGET_AVX2
+void int16_to_float_avx2(float *out, int16_t const *data, uint32_t count) {
+	__m256 const scale = _mm256_set1_ps(1.0f / 32768.0f);
+	uint32_t k = 0;
+	for (; k + 16 <= count; k += 16) {
+		__m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast< __m128i const * >(data + k + 0)));
+		__m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast< __m128i const * >(data + k + 8)));
+		_mm256_storeu_ps(out + k + 0, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+		_mm256_storeu_ps(out + k + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+	}
+	int16_to_float_sse2(out + k, data + k, count - k);
+}
+
+#endif //MIX_KERNELS_X86
+
+//the kernel table, filled in on first use:
+struct Kernels {
+	decltype(&mix_mono_to_stereo_scalar) mix_mono_to_stereo = mix_mono_to_stereo_scalar;
+	decltype(&mix_mono_to_stereo_resampled_scalar) mix_mono_to_stereo_resampled = mix_mono_to_stereo_resampled_scalar;
+	decltype(&int16_to_float_scalar) int16_to_float = int16_to_float_scalar;
+	decltype(&mix_stereo_scalar) mix_stereo = mix_stereo_scalar;
+	decltype(&scale_stereo_scalar) scale_stereo = scale_stereo_scalar;
+	decltype(&peak_abs_scalar) peak_abs = peak_abs_scalar;
+	decltype(&biquad_stereo_scalar) biquad_stereo = biquad_stereo_scalar;
+	decltype(&complex_multiply_add_scalar) complex_multiply_add = complex_multiply_add_scalar;
+	decltype(&pan_3D_scalar) pan_3D = pan_3D_scalar;
+	char const *variant = "scalar";
+
+	Kernels() {
+		#ifdef MIX_KERNELS_X86
+		pan_3D = pan_3D_sse2; //(not enough work per source for AVX2 to be worth a separate version)
+		//(these run once per bus rather than per voice, so SSE2 is plenty:)
+		mix_stereo = mix_stereo_sse2;
+		scale_stereo = scale_stereo_sse2;
+		peak_abs = peak_abs_sse2;
+		biquad_stereo = biquad_stereo_sse2;
+		if (SDL_HasAVX2()) {
+			mix_mono_to_stereo = mix_mono_to_stereo_avx2;
+			mix_mono_to_stereo_resampled = mix_mono_to_stereo_resampled_avx2;
+			int16_to_float = int16_to_float_avx2;
+			complex_multiply_add = complex_multiply_add_avx2;
+			variant = "avx2";
+		} else {
+			mix_mono_to_stereo = mix_mono_to_stereo_sse2;
+			mix_mono_to_stereo_resampled = mix_mono_to_stereo_resampled_sse2;
+			int16_to_float = int16_to_float_sse2;
+			complex_multiply_add = complex_multiply_add_sse2;
+			variant = "sse2";
+		}
+		#endif
+	}
+};
+
+Kernels const &get_kernels() {
+	static Kernels kernels;
+	return kernels;
+}
+
+}
+
+void mix_mono_to_stereo(float *out, float const *data, uint32_t count,
+	float start_l, float start_r, float step_l, float step_r, MixLevel *level) {
+	get_kernels().mix_mono_to_stereo(out, data, count, start_l, start_r, step_l, step_r, level);
+}
+
+void mix_mono_to_stereo_resampled(float *out, float const *data, uint32_t count, float offset, float rate,
+	float start_l, float start_r, float step_l, float step_r, MixLevel *level) {
+	get_kernels().mix_mono_to_stereo_resampled(out, data, count, offset, rate, start_l, start_r, step_l, step_r, level);
+}
+
+void int16_to_float(float *out, int16_t const *data, uint32_t count) {
+	get_kernels().int16_to_float(out, data, count);
+}
+
+void mix_stereo(float *out, float const *data, uint32_t count, float start, float step) {
+	get_kernels().mix_stereo(out, data, count, start, step);
+}
+
+void scale_stereo(float *io, uint32_t count, float start, float step, MixLevel *level) {
+	get_kernels().scale_stereo(io, count, start, step, level);
+}
+
+float peak_abs(float const *data, uint32_t count) {
+	return get_kernels().peak_abs(data, count);
+}
+
+void compute_biquad_coefficients(float b0, float b1, float b2, float a1, float a2, BiquadCoefficients *coefficients_) {
+	assert(coefficients_);
+	auto &coefficients = *coefficients_;
+	coefficients.b0 = b0;
+	coefficients.b1 = b1;
+	coefficients.b2 = b2;
+	coefficients.a1 = a1;
+	coefficients.a2 = a2;
+
+	//write y[n-2] .. y[n+3] in terms of x[n-2], .., x[n+3], y[n-2], y[n-1] by running the recurrence symbolically:
+	float y[6][8] = {};
+	y[0][6] = 1.0f;
+	y[1][7] = 1.0f;
+	for (uint32_t i = 0; i < 4; ++i) {
+		float *out = y[i + 2];
+		out[i + 2] += b0; //x[n+i]
+		out[i + 1] += b1; //x[n+i-1]
+		out[i + 0] += b2; //x[n+i-2]
+		for (uint32_t t = 0; t < 8; ++t) {
+			out[t] -= a1 * y[i + 1][t] + a2 * y[i][t];
+		}
+	}
+	for (uint32_t t = 0; t < 8; ++t) {
+		for (uint32_t i = 0; i < 4; ++i) {
+			coefficients.block[t][i] = y[i + 2][t];
+		}
+	}
+}
+
+void biquad_stereo(float *io, uint32_t count, BiquadCoefficients const &coefficients, float state[8]) {
+	get_kernels().biquad_stereo(io, count, coefficients, state);
+}
+
+void complex_multiply_add(float *acc_re, float *acc_im, float const *a_re, float const *a_im,
+	float const *b_re, float const *b_im, uint32_t count) {
+	get_kernels().complex_multiply_add(acc_re, acc_im, a_re, a_im, b_re, b_im, count);
+}
+
+void pan_3D(uint32_t count,
+	float const *x, float const *y, float const *z, float const *half_radius,
+	glm::vec3 const &listener_position, glm::vec3 const &listener_right,
+	float *left, float *right) {
+	get_kernels().pan_3D(count, x, y, z, half_radius, listener_position, listener_right, left, right);
+}
+
+char const *mix_kernels_variant() {
+	return get_kernels().variant;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+//Inner loops used by the audio mixer (Sound.cpp).
+// Implementations are vectorized (SSE2 baseline, AVX2 if the CPU supports it; picked at runtime)
+// with a plain C++ fallback for other architectures.
+
+//Running level of the values passed through a kernel (for metering -- see Sound::Level):
+// kernels that take a MixLevel add the squares of the values they meter to 'sum_squares', and raise 'peak' to the largest absolute value.
+struct MixLevel {
+	float sum_squares = 0.0f;
+	float peak = 0.0f;
+};
+
+//Add 'count' frames of mono 'data' into interleaved stereo 'out' (l,r,l,r,...),
+// scaling by a linearly-ramped gain: frame k uses (start_l + k * step_l, start_r + k * step_r).
+// The (unscaled) mono values are metered into 'level' -- callers apply the gains to the totals, which is exact for constant gains
+// and costs one register of metering per 4 (SSE2) or 8 (AVX2) frames rather than two:
+void mix_mono_to_stereo(float *out, float const *data, uint32_t count,
+	float start_l, float start_r, float step_l, float step_r, MixLevel *level);
+
+//Like mix_mono_to_stereo (including metering the mono values), but reads 'data' at fractional positions (for pitched playback), with linear interpolation:
+// frame k uses the value at position p = offset + k * rate, i.e., data[j] + (p - j) * (data[j+1] - data[j]) with j = floor(p).
+// (requires offset >= 0, rate > 0, and 'data' readable up to index floor(offset + (count-1) * rate) + 1)
+void mix_mono_to_stereo_resampled(float *out, float const *data, uint32_t count, float offset, float rate,
+	float start_l, float start_r, float step_l, float step_r, MixLevel *level);
+
+//Convert 'count' 16-bit PCM values to floats in [-1,1) (for playing Int16 samples):
+void int16_to_float(float *out, int16_t const *data, uint32_t count);
+
+//Add 'count' frames of interleaved stereo 'data' into 'out', scaled by a linearly-ramped gain (start + k * step);
+// used to add submix buses into the master mix:
+void mix_stereo(float *out, float const *data, uint32_t count, float start, float step);
+
+//Scale 'count' frames of interleaved stereo audio in place by a linearly-ramped gain (start + k * step);
+// if 'level' is given, the scaled values are metered into it:
+void scale_stereo(float *io, uint32_t count, float start, float step, MixLevel *level = nullptr);
+
+//Largest absolute value among 'count' floats:
+float peak_abs(float const *data, uint32_t count);
+
+//Biquad filter coefficients (direct form I, normalized so a0 == 1), along with the same filter unrolled
+// to compute four outputs at once -- which is what lets a recursive filter use SIMD:
+struct BiquadCoefficients {
+	float b0 = 1.0f, b1 = 0.0f, b2 = 0.0f, a1 = 0.0f, a2 = 0.0f;
+	//block[t][i] is the weight of term t in output y[n+i], for terms x[n-2], x[n-1], x[n], .., x[n+3], y[n-2], y[n-1]:
+	float block[8][4] = {};
+};
+void compute_biquad_coefficients(float b0, float b1, float b2, float a1, float a2, BiquadCoefficients *coefficients);
+
+//Filter 'count' frames of interleaved stereo audio in place;
+// 'state' holds x[n-1], x[n-2], y[n-1], y[n-2] for the left channel, then the same for the right:
+void biquad_stereo(float *io, uint32_t count, BiquadCoefficients const &coefficients, float state[8]);
+
+//Multiply-accumulate complex spectra stored as separate real/imaginary arrays: acc += a * b
+// (the inner loop of the convolution reverb -- see Sound::ConvolutionReverb):
+void complex_multiply_add(float *acc_re, float *acc_im, float const *a_re, float const *a_im,
+	float const *b_re, float const *b_im, uint32_t count);
+
+//Compute equal-power 3D panning gains for 'count' sources (given as structure-of-arrays) around one listener:
+// the left/right split is cos/sin of an angle from 0 (source directly left) to pi/2 (directly right),
+// scaled by distance attenuation 1 / (1 + distance / half_radius); sources at the listener get sqrt(2) on both sides.
+//sin/cos are polynomial approximations: each gain is within 4e-6 of the exact value,
+// and left^2 + right^2 (before attenuation) is within 1e-5 of 1 -- so panning stays constant-power.
+void pan_3D(uint32_t count,
+	float const *x, float const *y, float const *z, float const *half_radius,
+	glm::vec3 const &listener_position, glm::vec3 const &listener_right,
+	float *left, float *right);
+
+//Name of the kernel variant in use (e.g., "avx2"); useful for logging/benchmarks:
+char const *mix_kernels_variant();
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cassert>
+#include <utility>
+
+//Single-producer, single-consumer lock-free ring buffer.
+// Exactly one thread may call push() and exactly one (other) thread may call pop();
+// neither side ever blocks or allocates, so this is safe to use from the audio callback.
+//
+//Capacity is fixed at construction and rounded up to a power of two.
+
+template< typename T >
+struct RingBuffer {
+	RingBuffer(uint32_t capacity_) {
+		uint32_t capacity = 1;
+		while (capacity < capacity_) capacity *= 2;
+		items.resize(capacity);
+		mask = capacity - 1;
+	}
+
+	//non-copyable (other threads may be holding references):
+	RingBuffer(RingBuffer const &) = delete;
+	RingBuffer &operator=(RingBuffer const &) = delete;
+
+	//producer side: returns false (and leaves 'item' alone) if the ring is full:
+	bool push(T &&item) {
+		uint32_t w = write.load(std::memory_order_relaxed);
+		uint32_t r = read.load(std::memory_order_acquire);
+		if (w - r > mask) return false;
+		items[w & mask] = std::move(item);
+		write.store(w + 1, std::memory_order_release);
+		return true;
+	}
+
+	//consumer side: returns false if the ring is empty:
+	bool pop(T *item) {
+		assert(item);
+		uint32_t r = read.load(std::memory_order_relaxed);
+		uint32_t w = write.load(std::memory_order_acquire);
+		if (r == w) return false;
+		*item = std::move(items[r & mask]);
+		read.store(r + 1, std::memory_order_release);
+		return true;
+	}
+
+	//bulk access (handy for audio data), in contiguous spans that stop at the end of storage:
+
+	//producer side: get space to write into; call commit() once (some of) it has been filled:
+	uint32_t write_span(T **span) {
+		assert(span);
+		uint32_t w = write.load(std::memory_order_relaxed);
+		uint32_t r = read.load(std::memory_order_acquire);
+		uint32_t free = (mask + 1) - (w - r);
+		uint32_t to_end = (mask + 1) - (w & mask);
+		*span = &items[w & mask];
+		return free < to_end ? free : to_end;
+	}
+	void commit(uint32_t count) {
+		uint32_t w = write.load(std::memory_order_relaxed);
+		write.store(w + count, std::memory_order_release);
+	}
+
+	//consumer side: get items to read; call consume() once (some of) them have been used:
+	uint32_t read_span(T const **span) {
+		assert(span);
+		uint32_t r = read.load(std::memory_order_relaxed);
+		uint32_t w = write.load(std::memory_order_acquire);
+		uint32_t available = w - r;
+		uint32_t to_end = (mask + 1) - (r & mask);
+		*span = &items[r & mask];
+		return available < to_end ? available : to_end;
+	}
+	void consume(uint32_t count) {
+		uint32_t r = read.load(std::memory_order_relaxed);
+		read.store(r + count, std::memory_order_release);
+	}
+
+	//consumer side: discard everything before free-running index 'index'
+	// (which must be between the current read and write positions):
+	void skip_to(uint32_t index) {
+		assert(index - read.load(std::memory_order_relaxed) <= write.load(std::memory_order_acquire) - read.load(std::memory_order_relaxed));
+		read.store(index, std::memory_order_release);
+	}
+
+	//free-running positions (e.g., to remember a spot for a later skip_to()):
+	uint32_t write_position() const {
+		return write.load(std::memory_order_acquire);
+	}
+	uint32_t read_position() const {
+		return read.load(std::memory_order_acquire);
+	}
+
+	//approximate number of items waiting (exact when called from either endpoint thread while the other is idle):
+	uint32_t size() const {
+		return write.load(std::memory_order_acquire) - read.load(std::memory_order_acquire);
+	}
+	uint32_t capacity() const {
+		return mask + 1;
+	}
+
+	//internals:
+	std::vector< T > items;
+	uint32_t mask = 0;
+
+	//indices are free-running (wrap at 2^32) and masked on access;
+	// padded onto separate cache lines so producer and consumer don't false-share:
+	// (explicit padding rather than alignas() because MSVC warns about padded structures)
+	char pad0[64];
+	std::atomic< uint32_t > write{0};
+	char pad1[64 - sizeof(std::atomic< uint32_t >)];
+	std::atomic< uint32_t > read{0};
+	char pad2[64 - sizeof(std::atomic< uint32_t >)];
+};
@@ -0,0 +1,181 @@
+#include "sample_cache.hpp"
+
+#include "data_path.hpp"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+	std::string cache_directory() {
+		return data_path("sample-cache");
+	}
+
+	//FNV-1a, but eight bytes at a time (audio files are big enough that hashing byte-by-byte would show up at startup):
+	uint64_t hash_bytes(uint8_t const *data, size_t size) {
+		uint64_t hash = 0xcbf29ce484222325ULL;
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8) {
+			uint64_t word;
+			std::memcpy(&word, data + i, 8);
+			hash = (hash ^ word) * 0x100000001b3ULL;
+		}
+		for (; i < size; ++i) {
+			hash = (hash ^ data[i]) * 0x100000001b3ULL;
+		}
+		hash = (hash ^ uint64_t(size)) * 0x100000001b3ULL;
+		//(multiplication only carries upward, so mix the high bits back down -- as in MurmurHash3's finalizer)
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 33;
+		return hash;
+	}
+}
+
+MappedFile::MappedFile(std::string const &filename) {
+	#if defined(_WIN32)
+	HANDLE handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error("Failed to open '" + filename + "' for mapping.");
+	}
+	file = handle;
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(handle, &file_size)) {
+		CloseHandle(handle);
+		throw std::runtime_error("Failed to get size of '" + filename + "'.");
+	}
+	size = size_t(file_size.QuadPart);
+	if (size == 0) return; //(can't map an empty file)
+	mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping) {
+		CloseHandle(handle);
+		throw std::runtime_error("Failed to create mapping of '" + filename + "'.");
+	}
+	data = reinterpret_cast< uint8_t const * >(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!data) {
+		CloseHandle(mapping);
+		CloseHandle(handle);
+		throw std::runtime_error("Failed to map '" + filename + "'.");
+	}
+	#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error("Failed to open '" + filename + "' for mapping.");
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		throw std::runtime_error("Failed to get size of '" + filename + "'.");
+	}
+	size = size_t(info.st_size);
+	if (size != 0) {
+		void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error("Failed to map '" + filename + "'.");
+		}
+		data = reinterpret_cast< uint8_t const * >(mapped);
+	}
+	close(fd); //(the mapping stays valid)
+	#endif
+}
+
+MappedFile::~MappedFile() {
+	#if defined(_WIN32)
+	if (data) UnmapViewOfFile(data);
+	if (mapping) CloseHandle(mapping);
+	if (file) CloseHandle(file);
+	#else
+	if (data) munmap(const_cast< uint8_t * >(data), size);
+	#endif
+}
+
+void MappedFile::touch() const {
+	uint8_t volatile sum = 0;
+	for (size_t i = 0; i < size; i += 4096) {
+		sum = uint8_t(sum + data[i]);
+	}
+	(void)sum;
+}
+
+bool MappedFile::chunk(size_t *offset_, std::string const &magic, void const **chunk_data, uint32_t *chunk_size) const {
+	assert(offset_);
+	assert(magic.size() == 4);
+	assert(chunk_data);
+	assert(chunk_size);
+	size_t &offset = *offset_;
+
+	if (offset > size || size - offset < 8) return false;
+	if (std::memcmp(data + offset, magic.data(), 4) != 0) return false;
+	uint32_t bytes;
+	std::memcpy(&bytes, data + offset + 4, 4);
+	if (size - offset - 8 < bytes) return false;
+
+	*chunk_data = data + offset + 8;
+	*chunk_size = bytes;
+	offset += 8 + size_t(bytes);
+	return true;
+}
+
+std::string sample_cache_entry(std::string const &filename, std::string const &variant) {
+	MappedFile source(filename);
+	uint64_t hash = hash_bytes(source.data, source.size);
+
+	char hex[17];
+	std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+	return cache_directory() + "/" + hex + "." + variant;
+}
+
+std::shared_ptr< MappedFile const > sample_cache_open(std::string const &entry) {
+	try {
+		return std::make_shared< MappedFile >(entry);
+	} catch (std::exception &) {
+		//(not in the cache -- yet)
+		return nullptr;
+	}
+}
+
+void sample_cache_store(std::string const &entry, std::function< void(std::ostream &) > const &write) {
+	#if defined(_WIN32)
+	_mkdir(cache_directory().c_str());
+	#else
+	mkdir(cache_directory().c_str(), 0755);
+	#endif
+
+	std::string temp = entry + ".tmp";
+	{
+		std::ofstream out(temp, std::ios::binary);
+		write(out);
+		if (!out) {
+			std::cerr << "WARNING: failed to write sample cache entry '" << temp << "'." << std::endl;
+			out.close();
+			std::remove(temp.c_str());
+			return;
+		}
+	}
+
+	#if defined(_WIN32)
+	bool renamed = (MoveFileExA(temp.c_str(), entry.c_str(), MOVEFILE_REPLACE_EXISTING) != 0);
+	#else
+	bool renamed = (std::rename(temp.c_str(), entry.c_str()) == 0);
+	#endif
+	if (!renamed) {
+		std::cerr << "WARNING: failed to rename '" << temp << "' to '" << entry << "'." << std::endl;
+		std::remove(temp.c_str());
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+
+//On-disk cache of decoded audio (used by Sound::Sample), so sounds don't have to be decoded and resampled at every launch.
+// Entries live in 'sample-cache/' next to the executable (see data_path.hpp) and are named by a hash of the
+// source file's contents -- so editing a source file just means its old entry is never looked up again.
+// Entries are written with write_chunk (read_write_chunk.hpp) and read back by memory-mapping them.
+//
+//The cache is best-effort: failing to read or write it only prints a warning.
+
+//Read-only memory mapping of a whole file:
+struct MappedFile {
+	MappedFile(std::string const &filename); //throws on error
+	~MappedFile();
+	MappedFile(MappedFile const &) = delete;
+	MappedFile &operator=(MappedFile const &) = delete;
+
+	uint8_t const *data = nullptr;
+	size_t size = 0;
+
+	//read every page, so later reads (e.g., by the mixer) don't stall on page faults:
+	void touch() const;
+
+	//get the data of the chunk (as written by write_chunk) with the given magic number at *offset, and advance *offset
+	// past it; returns false if there isn't such a chunk there:
+	bool chunk(size_t *offset, std::string const &magic, void const **chunk_data, uint32_t *chunk_size) const;
+
+	//internals:
+	#if defined(_WIN32)
+	void *file = nullptr; //(HANDLE)
+	void *mapping = nullptr; //(HANDLE)
+	#endif
+};
+
+//name of the cache entry for 'filename' converted to 'variant' (e.g., "i16"); reads the whole file to hash it:
+std::string sample_cache_entry(std::string const &filename, std::string const &variant);
+
+//map a cache entry; returns null if it isn't in the cache:
+std::shared_ptr< MappedFile const > sample_cache_open(std::string const &entry);
+
+//create (or replace) a cache entry with whatever 'write' writes:
+// (written to a temporary file that is then renamed, so a partially-written entry is never seen)
+void sample_cache_store(std::string const &entry, std::function< void(std::ostream &) > const &write);
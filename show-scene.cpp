@@ -120,6 +120,8 @@ int main(int argc, char **argv) {
 				drawable.pipeline.type = mesh.type;
 				drawable.pipeline.start = mesh.start;
 				drawable.pipeline.count = mesh.count;
+				drawable.pipeline.min = mesh.min;
+				drawable.pipeline.max = mesh.max;
 
 			});
 		} catch (std::exception &e) {
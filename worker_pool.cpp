@@ -0,0 +1,174 @@
+#include "worker_pool.hpp"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+namespace {
+	//how long an idle worker keeps checking for new work before going to sleep:
+	constexpr std::chrono::microseconds const SPIN_TIME = std::chrono::microseconds(500);
+
+	void pin_thread(std::thread &thread, uint32_t core) {
+		#if defined(_WIN32)
+		SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << (core % (8 * sizeof(DWORD_PTR))));
+		#elif defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core, &set);
+		pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+		#else
+		//(no portable way to do this on macOS; just let the scheduler decide)
+		(void)thread;
+		(void)core;
+		#endif
+	}
+}
+
+WorkerPool::WorkerPool(uint32_t threads, uint32_t max_chunks_, bool pin) : max_chunks(max_chunks_) {
+	chunk_states.reset(new std::atomic< uint64_t >[max_chunks]);
+	for (uint32_t c = 0; c < max_chunks; ++c) {
+		chunk_states[c].store(0, std::memory_order_relaxed);
+	}
+	progress.reset(new Progress[threads + 1]);
+	owners.assign(max_chunks, 0);
+	contributors.assign(threads + 1, 0);
+
+	uint32_t cores = std::max(1U, std::thread::hardware_concurrency());
+	workers.reserve(threads);
+	for (uint32_t t = 0; t < threads; ++t) {
+		workers.emplace_back(&WorkerPool::worker, this, t + 1);
+		//leave core 0 for the main thread:
+		if (pin) pin_thread(workers.back(), (t + 1) % cores);
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	quit.store(true);
+	{
+		std::lock_guard< std::mutex > lock(sleep_mutex);
+		sleep_cv.notify_all();
+	}
+	for (auto &thread : workers) {
+		thread.join();
+	}
+}
+
+uint32_t WorkerPool::next_input() const {
+	uint64_t run = generation.load() + 1;
+	for (uint32_t t = 1; t <= threads(); ++t) {
+		uint64_t inside = progress[t].inside.load();
+		if (inside != 0 && (inside & 1) == (run & 1)) return -1U;
+	}
+	return uint32_t(run & 1);
+}
+
+void WorkerPool::run(uint32_t count, uint32_t chunk, Job job, void *context) {
+	uint64_t run = generation.load(std::memory_order_relaxed) + 1;
+
+	//n.b. no worker can be reading these parameters: the last run to use them is over, and any worker
+	// still inside it was checked for by next_input() (and workers that look later see it isn't current):
+	Params &p = params[run & 1];
+	p.count = count;
+	p.chunk = std::max(1U, chunk);
+	p.chunks = (count + p.chunk - 1) / p.chunk;
+	p.job = job;
+	p.context = context;
+	assert(p.chunks <= max_chunks);
+	for (uint32_t c = 0; c < p.chunks; ++c) {
+		chunk_states[c].store(run << 16, std::memory_order_relaxed);
+	}
+	next.store(0, std::memory_order_relaxed);
+
+	//post the run (seq_cst, so either a worker about to sleep sees it, or this sees the worker in 'sleepers'):
+	generation.store(run);
+	if (sleepers.load() != 0) {
+		//(never wait for the mutex: if a worker holds it, that worker may sleep through this run, and wakes for the next)
+		std::unique_lock< std::mutex > lock(sleep_mutex, std::try_to_lock);
+		sleep_cv.notify_all();
+	}
+
+	//help out:
+	claim(run, 0);
+
+	//check on every chunk: do any still unclaimed here, and take back chunks from workers that haven't finished:
+	std::fill(contributors.begin(), contributors.end(), uint8_t(0));
+	contributors[0] = 1;
+	for (uint32_t c = 0; c < p.chunks; ++c) {
+		uint64_t state = run << 16;
+		if (chunk_states[c].compare_exchange_strong(state, state | 1)) {
+			p.job(p.context, c * p.chunk, std::min(count, (c + 1) * p.chunk), 0);
+			owners[c] = 0;
+			continue;
+		}
+		uint32_t thread = uint32_t(state & 0xffff) - 1;
+		if (thread != 0) {
+			//once revoked, a worker can't mark itself done -- so its outputs are either all used or all ignored:
+			uint64_t status = run << 2 | Working;
+			progress[thread].status.compare_exchange_strong(status, run << 2 | Revoked);
+			if (status == (run << 2 | Done)) {
+				owners[c] = thread;
+				contributors[thread] = 1;
+				continue;
+			}
+			p.job(p.context, c * p.chunk, std::min(count, (c + 1) * p.chunk), 0);
+		}
+		owners[c] = 0;
+	}
+}
+
+void WorkerPool::claim(uint64_t run, uint32_t thread) {
+	Params const &p = params[run & 1];
+	while (true) {
+		uint32_t c = next.fetch_add(1, std::memory_order_relaxed);
+		if (c >= p.chunks) break;
+		//(a worker that fell behind stops once its run is no longer the latest)
+		if (thread != 0 && generation.load(std::memory_order_relaxed) != run) break;
+		uint64_t state = run << 16;
+		if (!chunk_states[c].compare_exchange_strong(state, state | (thread + 1))) continue;
+		p.job(p.context, c * p.chunk, std::min(p.count, (c + 1) * p.chunk), thread);
+	}
+}
+
+void WorkerPool::worker(uint32_t thread) {
+	Progress &mine = progress[thread];
+	uint64_t seen = 0;
+	auto idle_since = std::chrono::steady_clock::now();
+	while (!quit.load(std::memory_order_relaxed)) {
+		uint64_t run = generation.load();
+		if (run == seen) {
+			//nothing new; spin a while, then sleep until run() posts something:
+			if (std::chrono::steady_clock::now() - idle_since < SPIN_TIME) {
+				std::this_thread::yield();
+			} else {
+				std::unique_lock< std::mutex > lock(sleep_mutex);
+				sleepers.fetch_add(1);
+				sleep_cv.wait(lock, [&]() {
+					return quit.load() || generation.load() != seen;
+				});
+				sleepers.fetch_sub(1);
+			}
+			continue;
+		}
+		seen = run;
+		//announce that this thread is reading the run's parameters, and make sure the run is still current
+		// (seq_cst, so either next_input() sees 'inside' or this sees the newer run):
+		mine.inside.store(run);
+		if (generation.load() == run) {
+			mine.status.store(run << 2 | Working);
+			claim(run, thread);
+			uint64_t status = run << 2 | Working;
+			mine.status.compare_exchange_strong(status, run << 2 | Done);
+		}
+		mine.inside.store(0);
+		idle_since = std::chrono::steady_clock::now();
+	}
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Small pool of worker threads for splitting a loop over many items across cores.
+// Made for the audio mixer (Sound.cpp): run() never takes a lock, allocates, or waits for another thread.
+// The calling thread works through the items too, and once there are none left to claim it takes back any chunk
+// a worker has claimed but not finished and does it itself -- so a descheduled worker can't hold up a run.
+//
+//The price is that a chunk may be done twice (once by a worker whose results are then ignored),
+// and that a worker may still be running a job after run() returns. So a job must:
+//  - only read its inputs, which must stay untouched while the pool might still be reading them (see next_input()), and
+//  - write only to outputs that belong to the thread running it (see 'thread', below);
+// after run(), finished_by() says which thread's outputs hold each chunk's results.
+//
+//Idle workers spin briefly waiting for the next run() and then block (with no timeout) until one is posted.
+
+struct WorkerPool {
+	//start 'threads' worker threads, for runs of at most 'max_chunks' chunks;
+	// if 'pin' is set, worker k is pinned to core k (on Linux and Windows):
+	WorkerPool(uint32_t threads, uint32_t max_chunks, bool pin);
+	~WorkerPool();
+
+	WorkerPool(WorkerPool const &) = delete;
+	WorkerPool &operator=(WorkerPool const &) = delete;
+
+	//number of worker threads (not counting the thread calling run()):
+	uint32_t threads() const { return uint32_t(workers.size()); }
+
+	//job(context, begin, end, thread) handles items [begin,end); 'thread' is 0 for the calling thread
+	// and 1..threads() for workers (handy for indexing per-thread outputs):
+	using Job = void (*)(void *context, uint32_t begin, uint32_t end, uint32_t thread);
+
+	//A worker whose chunk was taken back may still be reading the run's inputs during the next run,
+	// so inputs should alternate between two buffers: fill buffer next_input() and pass it to run() as 'context'.
+	//Returns -1U if a worker is still inside the last run that used that buffer (do the work without the pool this time):
+	uint32_t next_input() const;
+
+	//call job for chunks of [0,count), 'chunk' items at a time (at most max_chunks chunks), and return once each chunk
+	// has been done by some thread. Only one thread may call run() (at a time):
+	void run(uint32_t count, uint32_t chunk, Job job, void *context);
+
+	//after run(): the thread whose outputs hold the results of chunk 'c' (that is, of items [c * chunk, (c + 1) * chunk)):
+	uint32_t finished_by(uint32_t c) const { return owners[c]; }
+	//...and whether thread 't' holds the results of any chunk:
+	bool contributed(uint32_t t) const { return contributors[t] != 0; }
+
+	//internals:
+	void worker(uint32_t thread); //worker thread body
+	void claim(uint64_t run, uint32_t thread); //claim and do chunks of run 'run' until there are none left
+
+	//parameters of the two most recent runs (run r uses params[r & 1]):
+	struct Params {
+		uint32_t count = 0;
+		uint32_t chunk = 1;
+		uint32_t chunks = 0;
+		Job job = nullptr;
+		void *context = nullptr;
+	} params[2];
+
+	//number of the most recent run (runs are numbered from 1):
+	std::atomic< uint64_t > generation{0};
+	//chunk c of run r is (r << 16) while unclaimed and (r << 16 | (thread + 1)) once claimed by 'thread':
+	std::unique_ptr< std::atomic< uint64_t >[] > chunk_states;
+	uint32_t max_chunks = 0;
+	std::atomic< uint32_t > next{0}; //next chunk to try claiming (just a hint; claims are made on chunk_states)
+
+	//per-worker progress, each on its own cache line:
+	enum : uint64_t { Working = 1, Done = 2, Revoked = 3 };
+	struct alignas(64) Progress {
+		std::atomic< uint64_t > inside{0}; //run the worker is reading parameters and inputs of (0 if none)
+		std::atomic< uint64_t > status{0}; //(run << 2 | Working, Done, or Revoked); a revoked worker's outputs are ignored
+	};
+	std::unique_ptr< Progress[] > progress; //(index 0 is unused)
+
+	//results of the most recent run (calling thread only):
+	std::vector< uint32_t > owners; //per chunk
+	std::vector< uint8_t > contributors; //per thread
+
+	//for idle workers:
+	std::mutex sleep_mutex;
+	std::condition_variable sleep_cv;
+	std::atomic< uint32_t > sleepers{0};
+	std::atomic< bool > quit{false};
+
+	std::vector< std::thread > workers;
+};